@@ -0,0 +1,23 @@
+cmake_minimum_required(VERSION 3.0)
+CMAKE_POLICY(SET CMP0020 NEW)
+# A headless executable, it only links QtCore and the libraries listed in CORE_LIBRARIES.
+
+get_filename_component(ProjectId ${CMAKE_CURRENT_SOURCE_DIR} NAME)
+string(REPLACE " " "_" ProjectId ${ProjectId})
+project(${ProjectId})
+
+include_directories(
+    ${PROJECT_LIBRARIES_PATH}
+)
+
+file(GLOB_RECURSE SOURCES *.cpp)
+file(GLOB_RECURSE HEADER *.h)
+
+add_executable(${ProjectId} ${SOURCES} ${HEADER} ${EXTERNAL_CODE})
+
+message( "CORE_LIBRARIES: " ${CORE_LIBRARIES} )
+
+target_link_libraries(
+    ${ProjectId}
+    ${CORE_LIBRARIES}
+)
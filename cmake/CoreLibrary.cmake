@@ -0,0 +1,21 @@
+cmake_minimum_required(VERSION 3.0)
+# A library that only links QtCore (and CORE_LIBRARIES), so headless executables can use it without a display.
+
+get_filename_component(ProjectId ${CMAKE_CURRENT_SOURCE_DIR} NAME)
+string(REPLACE " " "_" ProjectId ${ProjectId})
+project(${ProjectId})
+
+include_directories(
+    ${PROJECT_LIBRARIES_PATH}
+)
+
+file(GLOB_RECURSE SOURCES *.cpp)
+file(GLOB_RECURSE HEADER *.h)
+
+add_library(${ProjectId} ${SOURCES} ${HEADER} ${EXTERNAL_CODE})
+
+list(REMOVE_ITEM CORE_LIBRARIES ${ProjectId})
+target_link_libraries(
+    ${ProjectId}
+    ${CORE_LIBRARIES}
+)
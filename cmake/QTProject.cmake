@@ -54,6 +54,7 @@ IF (WIN32)
     set(CMAKE_PREFIX_PATH ${QT_CMAKE_DIR})
 endif (WIN32)
 
+find_package(Qt5Core REQUIRED)
 find_package(Qt5Widgets REQUIRED)
 find_package(Qt5OpenGL REQUIRED)
 
@@ -67,6 +68,8 @@ include_directories(
 
 add_definitions(${Qt5Widgets_DEFINITIONS})
 
+# The Atoms and Util libraries and the headless executables only link QtCore, see CoreLibrary.cmake
+set(CORE_LIBRARIES Qt5::Core)
 set(ALL_LIBRARIES ${ALL_LIBRARIES} Qt5::Widgets Qt5::OpenGL Qt5::Qml Qt5::Quick Qt5::QuickWidgets ${GLEW_LIBRARY})
 
 # Compiler flags
@@ -84,6 +87,12 @@ if (CMAKE_COMPILER_IS_GNUCXX)
         string(REPLACE ";" " " CMAKE_CXX_FLAGS_STR "${CMAKE_CXX_FLAGS}")
         set(CMAKE_CXX_FLAGS ${CMAKE_CXX_FLAGS_STR})
     endif ()
+    # The surface extraction kernels use the widest SIMD instruction set (SSE2, AVX or AVX-512) enabled at compile time.
+    option(PROJECT_NATIVE_ARCH "Optimize for the instruction set of the building machine? The binary may not run on other CPUs!")
+    if (PROJECT_NATIVE_ARCH)
+        # No FMA contraction: the intrinsics are never contracted, the scalar code would be, and the results would differ.
+        set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -march=native -ffp-contract=off")
+    endif ()
 endif ()
 
 
@@ -129,6 +138,8 @@ elseif ("${CMAKE_CXX_COMPILER_ID}" STREQUAL "MSVC")
     add_definitions(/W2)
 endif ()
 
+enable_testing()
+
 set(LIBRARY_OUTPUT_PATH ${PROJECT_BINARY_DIR}/lib)
 GENERATE_SUBDIRS(ALL_LIBRARIES ${PROJECT_LIBRARIES_PATH} ${PROJECT_BINARY_DIR}/libraries)
 
@@ -44,8 +44,31 @@
 
 #include "Dialogs/RenderDockWidget.h"
 #include <Util/ResourcePath.h>
+#include <Util/SystemMemory.h>
 #include <QClipboard>
 
+/// Formats the metrics of an extraction as a multi line tooltip.
+inline QString metricsToolTip(const extractionMetrics &metrics) {
+    const auto ms = [](qint64 ns) { return QString::number(ns / 1000000.0, 'f', 1) + "ms"; };
+    QString text = "Frames: " + QString::number(metrics.frames) + " (" +
+                   QString::number(metrics.framesPerSecond(), 'f', 2) + "/s)\n" +
+                   "Atoms: " + QString::number(metrics.atomsPerSecond(), 'f', 0) + "/s\n" +
+                   "Peel iterations per frame: " +
+                   QString::number((metrics.frames) ? metrics.peelIterations / (double) metrics.frames : 0.0, 'f', 1) + "\n" +
+                   "Neighbour list rebuilds: " + QString::number(metrics.neighbourListRebuilds) + "\n" +
+                   "Failed frames: " + QString::number(metrics.failedFrames) + "\n" +
+                   "Peak scratch memory: " + formatBytes(metrics.peakScratchMemory) + "\n" +
+                   "Thread utilisation: " + QString::number(100.0 * metrics.utilisation(), 'f', 0) + "% of " +
+                   QString::number(metrics.threads) + " threads\n" +
+                   "Decode: " + ms(metrics.decodeTime) + "\n" +
+                   "Grid: " + ms(metrics.gridTime) + "\n" +
+                   "Neighbours: " + ms(metrics.neighbourTime) + "\n" +
+                   "Extraction: " + ms(metrics.extractionTime);
+    if (metrics.intersectionTime || metrics.endPointTime)
+        text += "\nIntersection: " + ms(metrics.intersectionTime) + "\nEnd points: " + ms(metrics.endPointTime);
+    return text;
+}
+
 inline void about(QWidget *parent) {
     QMessageBox msgBox(parent);
     msgBox.setIcon(QMessageBox::Information);
@@ -83,6 +106,8 @@ inline void about(QWidget *parent) {
 #include "Dialogs/FrameContolWidget.h"
 
 #include <QQuickItem>
+#include <Atoms/LayerCheckpoint.h>
+#include <algorithm>
 
 AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
                                             m_settings(configPath() + "/config.ini", QSettings::IniFormat, this) {
@@ -101,9 +126,15 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
 
     //========= Setup data =========
     m_colors = new ColorLibrary(configPath() + "/colors.ini", this);
+    Atoms::setErrorHandler([](const QString &title, const QString &text) {
+        QMessageBox::critical(nullptr, title, text, QMessageBox::Ok);
+    });
     m_data = new Atoms(resourcePath(), this);
     m_timeline = new Timeline(this);
     m_filterAtomsListModel = new FilterAtomsListModel(m_data, m_timeline, this);
+    connect(m_filterAtomsListModel, &FilterAtomsListModel::copyToClipboard, this, [](const QString &text) {
+        QApplication::clipboard()->setText(text, QClipboard::Clipboard);
+    });
     m_heatmapProvider = new SurfaceLayersImageProvider(m_data, m_timeline, m_colors);
     m_data->setData(m_timeline, m_filterAtomsListModel);
 
@@ -131,12 +162,17 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
 
     connect(actionImport_Layer_Data, &QAction::triggered, this, [this] {
         if (*m_data && m_threads.empty()) {
-            const QString fileName = QFileDialog::getOpenFileName(this, tr("Import Atom Layer Data"),
-                                                                  QFileInfo(m_data->getTitle()).baseName(),
-                                                                  tr("Binary Atom Layer Data (*.bald);; Comma Separated Values (*.csv)"));
-            if (!fileName.isEmpty()) {
+            stopFrameExtraction();
+            //several shards (.balc) of a distributed extraction can be selected at once and are merged
+            const QStringList fileNames = QFileDialog::getOpenFileNames(this, tr("Import Atom Layer Data"),
+                                                                        QFileInfo(m_data->getTitle()).baseName(),
+                                                                        tr("Binary Atom Layer Data (*.bald);; Comma Separated Values (*.csv);; Layer Shards (*.balc)"));
+            for (const QString &fileName: fileNames) {
                 float sasRadius;
                 if (m_data->importLayerData(fileName, sasRadius)) {
+                    m_data->buildLayerColumns();
+                    m_data->buildLayerRanges();
+                    m_data->buildResidueStatistics();
                     m_currentlyUsedPropeRadius = sasRadius;
                     probeSizeDoubleSpinBox->setValue(sasRadius);
 
@@ -160,7 +196,8 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
                                                             QFileInfo(m_data->getTitle()).baseName(),
                                                             tr("Binary Atom Layer Data (*.bald);; Comma Separated Values (*.csv)"));
             if (!fileName.isEmpty()) {
-                if (m_data->exportLayerData(fileName, m_currentlyUsedPropeRadius)) {
+                //exports are compressed, they are shared rather than mapped
+                if (m_data->exportLayerData(fileName, m_currentlyUsedPropeRadius, false, true)) {
                     windowStatusBar->showMessage("Successfully exported atom layer data to: " + fileName, 4000);
                 } else {
                     QMessageBox::warning(this, "Failed to export!",
@@ -291,6 +328,9 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
             endFrameSpinBox->setMaximum(time);
             emit updateHeatMap();
         });
+        //the running extraction follows the heatmap right away when it is scrolled or zoomed
+        connect(m_timeline, &Timeline::onStartFrameChanged, this, [this] { prioritizeExtraction(); });
+        connect(m_timeline, &Timeline::onEndFrameChanged, this, [this] { prioritizeExtraction(); });
 
         connect(startFrameSpinBox, SIGNAL(valueChanged(int)), m_timeline, SLOT(setStart(int)));
         connect(endFrameSpinBox, SIGNAL(valueChanged(int)), m_timeline, SLOT(setEnd(int)));
@@ -400,7 +440,7 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
             trackerComboBox->clear();
             for (int i = 0; i < m_timeline->getSize(); i++) {
                 QPixmap pixmap(16, 16);
-                pixmap.fill(m_timeline->get(i)->getColor());
+                pixmap.fill(QColor(m_timeline->get(i)->getColor()));
                 trackerComboBox->addItem(pixmap, QString::number(i + 1));
             }
             trackerComboBox->setCurrentIndex(m_timeline->getActiveTracker());
@@ -577,6 +617,35 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
                     emit changeGlPropeRadius((m_animateSAS || showPropeSurfaceCheckBox->isChecked()) ? v : 0.f);
                 });
 
+        //layer sets, one for each extracted probe radius
+        connect(m_data, &Atoms::onLayerSetsChanged, this, [this] {
+            layerSetComboBox->blockSignals(true);
+            layerSetComboBox->clear();
+            for (int i = 0; i < m_data->numberOfLayerSets(); i++) {
+                const float radius = m_data->getLayerSet(i).probeRadius;
+                layerSetComboBox->addItem((radius < 0) ? QString("No layers") : "Probe radius " + QString::number(radius));
+            }
+            layerSetComboBox->setCurrentIndex(m_data->getActiveLayerSet());
+            layerSetComboBox->blockSignals(false);
+            m_failedFrames.clear();
+
+            //the timeline reads atoms over time, which is faster in atom-major order, the range filters use summaries
+            if (m_threads.empty()) {
+                m_data->buildLayerColumns();
+                m_data->buildLayerRanges();
+                m_data->buildResidueStatistics();
+            }
+
+            m_currentlyUsedPropeRadius = m_data->getLayerSet(m_data->getActiveLayerSet()).probeRadius;
+            emit updateGlLayers();
+            emit updateHeatMap();
+        });
+
+        connect(layerSetComboBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged), this,
+                [this](int index) {
+                    m_data->setActiveLayerSet(index);
+                });
+
         //calculateSurface
         connect(m_data, &Atoms::onFramesChanged, this, [this] {
             if (m_data->numberOfFrames() > 0)
@@ -592,35 +661,106 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
                 return;
             }
             const int maxNumberOfThreads = m_settings.value("SurfaceExtraction/Threads", 4).toInt();
+            const size_t scratchMemoryLimit = (size_t) m_settings.value("SurfaceExtraction/ScratchMemoryMB", 256).toUInt() * 1024u * 1024u;
             if (m_threads.empty()) { // if there are no threads running then we start
                 if (m_data->numberOfFrames() && maxNumberOfThreads > 0 && maxNumberOfThreads < 42) {
 
-                    //clear existing data if the probe radius is different
-                    if (m_currentlyUsedPropeRadius != (float) probeSizeDoubleSpinBox->value())
-                        for (Atoms::layerFrame &frame: m_data->getLayers())
-                            frame.maxLayer = -1;
-                    m_currentlyUsedPropeRadius = (float) probeSizeDoubleSpinBox->value();
+                    //all probe radii are extracted in the same pass, each into its own layer set
+                    QVector<float> probeRadii;
+                    probeRadii.push_back((float) probeSizeDoubleSpinBox->value());
+                    for (const QString &str: probeRadiiLineEdit->text().split(QRegExp(";|,|\\s"), QString::SkipEmptyParts)) {
+                        bool ok = false;
+                        const float radius = str.toFloat(&ok);
+                        if (ok && radius >= 0 && !probeRadii.contains(radius)) probeRadii.push_back(radius);
+                    }
+
+                    //reject jobs that don't fit into memory before anything is allocated
+                    const int numberOfFrames = m_timeline->getEndFrame() - m_timeline->getStartFrame() + 1;
+                    const size_t neededMemory = estimateExtractionMemory(m_data->numberOfAtroms(), numberOfFrames, probeRadii.size(),
+                                                                         maxNumberOfThreads, scratchMemoryLimit);
+                    const size_t availableMemory = availablePhysicalMemory();
+                    if (availableMemory && neededMemory > availableMemory) {
+                        extractSurfaceLayersLabel->setText("Not enough memory: needs " + formatBytes(neededMemory) + ", " +
+                                                           formatBytes(availableMemory) + " available.");
+                        return;
+                    }
+                    stopFrameExtraction();
+                    QVector<int> layerSets;
+                    for (float radius: probeRadii)
+                        layerSets.push_back(m_data->addLayerSet(radius));
+                    if (layerSets.contains(-1)) {
+                        extractSurfaceLayersLabel->setText("Not enough memory for the layers!");
+                        return;
+                    }
+                    m_data->setActiveLayerSet(layerSets.first());
+                    m_currentlyUsedPropeRadius = probeRadii.first();
+
+                    //only the residues matching the filters and the atoms around them
+                    regionOfInterest roi;
+                    if (roiCheckBox->isChecked()) {
+                        roi.exactLayers = roiExactLayersSpinBox->value();
+                        for (int group: m_filterAtomsListModel->getFilterResidueResults().keys())
+                            for (int i = 0; i < m_data->getAtomsInGroup(group); i++)
+                                roi.atoms.push_back(m_data->getGroupStartID(group) + i);
+                        for (int atom: m_filterAtomsListModel->getFilterAtomResults().keys())
+                            roi.atoms.push_back(atom);
+                        std::sort(roi.atoms.begin(), roi.atoms.end());
+                        roi.atoms.erase(std::unique(roi.atoms.begin(), roi.atoms.end()), roi.atoms.end());
+                        if (roi.empty()) {
+                            extractSurfaceLayersLabel->setText("No residues match the filters!");
+                            return;
+                        }
+                    }
+
+                    //completed frames are stored next to the trajectory, so a stopped or crashed extraction can be resumed
+                    QVector<QSharedPointer<LayerCheckpoint>> checkpoints;
+                    int resumedFrames = 0;
+                    if (m_settings.value("SurfaceExtraction/Checkpoints", true).toBool()) {
+                        for (int s = 0; s < probeRadii.size(); s++) {
+                            const QByteArray identity = LayerCheckpoint::identity(*m_data, probeRadii[s], roi);
+                            QSharedPointer<LayerCheckpoint> checkpoint(new LayerCheckpoint());
+                            if (checkpoint->open(LayerCheckpoint::defaultPath(*m_data, probeRadii[s], identity), identity,
+                                                 probeRadii[s], m_data->numberOfAtroms(),
+                                                 m_data->getLayerSet(layerSets[s]).frames)) {
+                                resumedFrames += checkpoint->numberOfDoneFrames();
+                                checkpoints.push_back(checkpoint);
+                            } else
+                                checkpoints.push_back(QSharedPointer<LayerCheckpoint>());
+                        }
+                        if (resumedFrames) emit updateGlLayers();
+                    }
 
                     m_SASExtractionTimer.start();
+                    m_finishedMetrics.clear();
 
                     extractSurfaceLayersPushButton->setText("Stop");
                     extractSurfaceLayersProgressBar->setValue(0);
                     actionImport_Layer_Data->setEnabled(false);
                     actionExport_Layer_Data->setEnabled(false);
 
-                    int step = (m_timeline->getEndFrame() - m_timeline->getStartFrame()) / (float) maxNumberOfThreads;
-                    step += 1;
-                    if (step <= 1) step = 100; // in case getEndFrame() is very small
-
-                    for (int start = m_timeline->getStartFrame(); start <= m_timeline->getEndFrame(); start += step) {
-                        qDebug() << "Starting thread" << start << "-" << (start + step) << ".";
-                        ExtractSurfaceThread *thread = new ExtractSurfaceThread(m_data, start, start + step,
-                                                                                probeSizeDoubleSpinBox->value(), this);
+                    //the threads take the frames the views and the heatmap show first, see prioritizeExtraction
+                    m_extractionQueue.reset(new ExtractionQueue(m_timeline->getStartFrame(), m_timeline->getEndFrame()));
+                    m_extractionProbeRadii = probeRadii;
+                    m_extractionLayerSets = layerSets;
+                    m_extractionRoi = roi;
+                    m_extractionCheckpoints = checkpoints;
+                    prioritizeExtraction();
+
+                    for (int t = 0; t < qMin(maxNumberOfThreads, numberOfFrames); t++) {
+                        qDebug() << "Starting thread" << t << ".";
+                        ExtractSurfaceThread *thread = new ExtractSurfaceThread(m_data, m_timeline->getStartFrame(),
+                                                                                m_timeline->getEndFrame(), probeRadii,
+                                                                                layerSets, this);
+                        thread->setQueue(m_extractionQueue);
+                        thread->setScratchMemoryLimit(scratchMemoryLimit);
+                        thread->setRegionOfInterest(roi);
+                        thread->setCheckpoints(checkpoints);
 
                         connect(thread, &QThread::finished,
                                 [=]() {
                                     m_threadMutex.lock();
                                     qDebug() << "Thread Done!";
+                                    m_finishedMetrics.push_back(thread->getMetrics());
                                     QMutableListIterator<ExtractSurfaceThread *> i(m_threads);
                                     while (i.hasNext()) {
                                         if (i.next()->isFinished()) i.remove();
@@ -633,7 +773,7 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
                         //connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater())); //QT manages the deletion for us
 
                         m_threads.push_back(thread);
-                        thread->start();
+                        thread->start(QThread::LowPriority);
                     }
 
                     //on timeout we collect all the progress of all threads
@@ -641,23 +781,31 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
                             [=]() {
                                 m_threadMutex.lock();
                                 if (m_threads.empty()) {
+                                    resetExtractionQueue();
                                     extractSurfaceLayersProgressBar->setValue(100);
                                     m_extractSurfaceTimer->stop();
                                     extractSurfaceLayersPushButton->setText("Start");
+                                    m_data->buildLayerColumns();
+                                    m_data->buildLayerRanges();
+                                    m_data->buildResidueStatistics();
                                     emit updateGlLayers();
+                                    const extractionMetrics metrics = collectExtractionMetrics();
                                     extractSurfaceLayersLabel->setText(
-                                            "Finished in " + QString::number(m_SASTime) + "ms");
+                                            "Finished in " + QString::number(m_SASTime) + "ms, " +
+                                            QString::number(metrics.framesPerSecond(), 'f', 2) + " frames/s");
+                                    extractSurfaceLayersLabel->setToolTip(metricsToolTip(metrics));
                                     actionImport_Layer_Data->setEnabled(true);
                                     actionExport_Layer_Data->setEnabled(true);
                                 } else {
                                     float totalProgress = 0;
                                     float avarage = 0; //in ms
-                                    int remaining = 0;
                                     for (ExtractSurfaceThread *th: m_threads) {
                                         totalProgress += (th->isFinished()) ? 1 : th->getProgress();
-                                        remaining += th->getRemainingFrames();
                                         avarage += th->getAverageTime();
                                     }
+                                    //the threads share the frames of the queue, which follows the views
+                                    const int remaining = (m_extractionQueue) ? m_extractionQueue->remainingFrames() : 0;
+                                    prioritizeExtraction();
                                     totalProgress /= m_threads.size();
                                     avarage /= m_threads.size();
                                     extractSurfaceLayersProgressBar->setValue(100 * totalProgress);
@@ -666,11 +814,14 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
                                     float milliseconds = ((remaining * avarage) / m_threads.size());
                                     int seconds = (int) fmodf((milliseconds / 1000), 60.f);
                                     int minutes = (int) ((milliseconds / 1000) / 60);
+                                    const extractionMetrics metrics = collectExtractionMetrics();
                                     extractSurfaceLayersLabel->setText("Average: " + QString::number(avarage)
                                                                        + "ms Remaining: " +
                                                                        QString("%1.%2").arg(minutes).arg(seconds, 2, 10,
                                                                                                          QChar('0')) +
-                                                                       "min");
+                                                                       "min " + QString::number(metrics.framesPerSecond(), 'f', 2) +
+                                                                       " frames/s");
+                                    extractSurfaceLayersLabel->setToolTip(metricsToolTip(metrics));
                                 }
 
                                 emit updateHeatMap();
@@ -681,7 +832,8 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
                     m_extractSurfaceTimer->start();
 
                     extractSurfaceLayersLabel->setText(
-                            "Started with " + QString::number(m_threads.size()) + " threads");
+                            "Started with " + QString::number(m_threads.size()) + " threads" +
+                            ((resumedFrames) ? ", resumed " + QString::number(resumedFrames) + " frames from checkpoints" : QString()));
                 }
             } else { //we stop all threads
                 stopThreads();
@@ -772,6 +924,7 @@ AminoVisApp::AminoVisApp(QWidget *parent) : QMainWindow(parent),
 }
 
 AminoVisApp::~AminoVisApp() {
+    stopFrameExtraction();
     for (ExtractSurfaceThread *th: m_threads) {
         th->deleteLater();
         th->requestInterruption();
@@ -890,16 +1043,18 @@ void AminoVisApp::setAtomInfo(int id) {
     }
     const Atoms::atom &a = m_data->getAtom(id);
     const TrajectoryStream::xtcFrame &f = m_data->getCurrentFrame();
-    const Atoms::layerFrame &l = m_data->getLayer(m_timeline->get(m_timeline->getActiveTracker())->get());
+    const LayerStore &layers = m_data->getLayers();
+    const int frame = m_timeline->get(m_timeline->getActiveTracker())->get();
+    const bool valid = frame >= 0 && frame < layers.size() && layers.isValid(frame);
     atomInfoTextBrowser->setText(
             "Name: " + a.name + "\n"
             + "Residue: " + a.residue + "\n"
             + "Position: (" + QString::number(f.positions[id].x) + ", " + QString::number(f.positions[id].y) + ", " +
             QString::number(f.positions[id].z) + ")\n"
-            + "Layer: " + QString::number(((l.layers.empty()) ? 0 : l.layers[id])) + "\n"
+            + "Layer: " + QString::number(((valid) ? layers.layer(frame, id) : 0)) + "\n"
             + "Residue Layer: " + QString::number(
                     m_data->getGroupLayer(a.groupID - 1, m_timeline->get(m_timeline->getActiveTracker())->get())) + "\n"
-            + "Max layer: " + QString::number(((l.layers.empty()) ? 0 : l.maxLayer)) + "\n"
+            + "Max layer: " + QString::number(((valid) ? layers.maxLayer(frame) : 0)) + "\n"
     );
 
 }
@@ -1295,9 +1450,103 @@ void AminoVisApp::openSettings(bool colorSettingsTop) {
     SettingsWidget settingsWindow(m_settings, m_colors, colorSettingsTop, this);
     connect(&settingsWindow, SIGNAL(onClose()), widget_timelineScreenshotSettingsArea, SLOT(updatePresets()));
     settingsWindow.exec();
+    //failed frames may be extracted with more scratch memory
+    m_failedFrames.clear();
+}
+
+extractionMetrics AminoVisApp::collectExtractionMetrics() const {
+    QList<extractionMetrics> all = m_finishedMetrics;
+    for (ExtractSurfaceThread *th: m_threads)
+        if (!th->isFinished()) all.push_back(th->getMetrics());
+    if (all.empty()) return extractionMetrics();
+    extractionMetrics metrics = all.first();
+    for (int i = 1; i < all.size(); i++) metrics.merge(all[i]);
+    return metrics;
+}
+
+void AminoVisApp::extractFrameLayers(int frame) {
+    if (!m_settings.value("SurfaceExtraction/OnDemand", true).toBool() || !*m_data || frame < 0 ||
+        frame >= m_data->getLayers().size() || m_data->getLayers().isValid(frame) || m_failedFrames.contains(frame))
+        return;
+    //requests while a frame is extracted are dropped, afterwards the views are reloaded and request their current frames
+    if (m_frameThread) return;
+
+    int set = m_data->getActiveLayerSet();
+    float probeRadius = m_data->getLayerSet(set).probeRadius;
+    if (probeRadius < 0) {
+        //nothing was extracted yet, changing the layer sets shows the views again, which may request this frame
+        probeRadius = (float) probeSizeDoubleSpinBox->value();
+        set = m_data->addLayerSet(probeRadius);
+        if (set < 0) return;
+        m_data->setActiveLayerSet(set);
+        if (m_frameThread || m_data->getLayers().isValid(frame)) return;
+    }
+
+    //a frame of the running extraction is taken out of its queue, so no thread of it extracts the frame at the same time,
+    //and extracted with its parameters instead, so its other layer sets and checkpoints get the frame as well
+    const bool batchFrame = m_extractionQueue && m_extractionQueue->contains(frame) && m_extractionLayerSets.contains(set);
+    if (batchFrame && !m_extractionQueue->take(frame)) return; //a thread of the extraction has the frame already
+    ExtractSurfaceThread *thread = (batchFrame) ? new ExtractSurfaceThread(m_data, frame, frame, m_extractionProbeRadii,
+                                                                      m_extractionLayerSets, this)
+                                           : new ExtractSurfaceThread(m_data, frame, frame, QVector<float>() << probeRadius,
+                                                                      QVector<int>() << set, this);
+    if (batchFrame) {
+        thread->setRegionOfInterest(m_extractionRoi);
+        thread->setCheckpoints(m_extractionCheckpoints);
+    }
+    thread->setScratchMemoryLimit((size_t) m_settings.value("SurfaceExtraction/ScratchMemoryMB", 256).toUInt() * 1024u * 1024u);
+    connect(thread, &QThread::finished, this, [this, thread, frame, set] {
+        thread->deleteLater();
+        if (m_frameThread != thread) return; //stopped
+        m_frameThread = nullptr;
+        //e.g. a frame that needs more scratch memory fails again, the views would request it over and over
+        if (thread->getMetrics().failedFrames || !m_data->getLayerSet(set).frames.isValid(frame)) {
+            m_failedFrames.insert(frame);
+        } else if (m_threads.empty()) {
+            //a running extraction builds them when it is done
+            m_data->updateLayerSummaries();
+            emit updateHeatMap();
+        }
+        //the views reload their layers and request the frames dropped while this one was extracted
+        emit updateGlLayers();
+    });
+    m_frameThread = thread;
+    //the viewed frame is done long before the frames of a batch extraction, which run with a low priority
+    thread->start(QThread::HighPriority);
+}
+
+void AminoVisApp::stopFrameExtraction() {
+    m_failedFrames.clear();
+    if (!m_frameThread) return;
+    m_frameThread->requestInterruption();
+    m_frameThread->wait();
+    m_frameThread = nullptr;
+}
+
+void AminoVisApp::resetExtractionQueue() {
+    m_extractionQueue.reset();
+    m_extractionProbeRadii.clear();
+    m_extractionLayerSets.clear();
+    m_extractionRoi = regionOfInterest();
+    m_extractionCheckpoints.clear();
+}
+
+void AminoVisApp::prioritizeExtraction() {
+    if (!m_extractionQueue) return;
+    //the active tracker first
+    const int active = m_timeline->getActiveTracker();
+    QVector<int> trackers;
+    if (active >= 0 && active < m_timeline->getSize()) trackers.push_back(m_timeline->getFrame(active));
+    for (int i = 0; i < m_timeline->getSize(); i++)
+        if (i != active) trackers.push_back(m_timeline->getFrame(i));
+    //the heatmap shows the frames from the current start to the end of the timeline, scrolling or zooming changes
+    //them after the extraction started, while the queue keeps the range it was started with
+    m_extractionQueue->prioritize(trackers, m_timeline->getStartFrame(), m_timeline->getEndFrame());
 }
 
 void AminoVisApp::stopThreads() {
+    stopFrameExtraction();
+    resetExtractionQueue();
     m_extractSurfaceTimer->stop();
     extractSurfaceLayersPushButton->setText("Start");
     for (ExtractSurfaceThread *th: m_threads) {
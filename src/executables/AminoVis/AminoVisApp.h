@@ -37,7 +37,9 @@
 #include <Atoms/Timeline.h>
 #include <ColorLibrary.h>
 #include <Atoms/ProteinSurface.h>
+#include <Atoms/ExtractionQueue.h>
 #include <QList>
+#include <QSet>
 #include <QMutex>
 #include <QSettings>
 #include "SurfaceLayersImageProvider.h"
@@ -88,6 +90,13 @@ public slots:
 	 * @param frame Starting frame for the widget.
 	 */
 	void addGlWidget(int frame = 0);
+
+	/*!
+	 * @brief Extracts the layers of a viewed frame without layers in the background, with a higher priority than
+	 * a running extraction. Requests while a frame is extracted are dropped, the views request their frames again afterwards.
+	 * The active layer set is used, or one for the current probe radius if nothing was extracted yet.
+	 */
+	void extractFrameLayers(int frame);
 	void removeGlWidget(RenderDockWidget* wd);
 
 	QImage createHeatmapImage();
@@ -112,6 +121,14 @@ signals:
 	void timelineScrollTo(const QModelIndex& row);
 private:
 	void stopThreads();
+	/// Stops the extraction of viewed frames and forgets the failed ones, must be called before the layer sets are replaced.
+	void stopFrameExtraction();
+	/// Drops the queue and the parameters of the running extraction.
+	void resetExtractionQueue();
+	/// Moves the frames around the trackers and in the visible heatmap range to the front of the running extraction.
+	void prioritizeExtraction();
+	/// Merges the metrics of the finished and running extraction threads, m_threadMutex must be locked.
+	extractionMetrics collectExtractionMetrics() const;
 
 	Atoms* m_data = nullptr; /// Main atom data, like name, position, layers, so. on.
 	Timeline* m_timeline = nullptr; /// Handles the timeline
@@ -130,6 +147,15 @@ private:
 	QList<ExtractSurfaceThread*> m_threads; /// Stores the threads during SAS layer extraction
 	QTimer* m_extractSurfaceTimer; /// Timer to update the heatmap images while they are build
 	QMutex m_threadMutex; /// Mutex gate used to organize data access
+	QList<extractionMetrics> m_finishedMetrics; /// Metrics of the finished threads of the current extraction
+	ExtractSurfaceThread* m_frameThread = nullptr; /// Extracts a viewed frame on demand, nullptr if idle
+	QSet<int> m_failedFrames; /// Frames that failed on demand, they aren't requested again until the parameters change
+	QSharedPointer<ExtractionQueue> m_extractionQueue; /// Frames of the running extraction, null if none
+	//the parameters of the running extraction, a viewed frame taken out of its queue is extracted with them
+	QVector<float> m_extractionProbeRadii;
+	QVector<int> m_extractionLayerSets;
+	regionOfInterest m_extractionRoi;
+	QVector<QSharedPointer<LayerCheckpoint>> m_extractionCheckpoints;
 
 	///heatmap screenshot settings
 	heatmapScreenshotSettings m_hss;
@@ -62,7 +62,7 @@ FrameContolWidget::FrameContolWidget(Tracker* frame, QWidget *parent): QFrame(pa
 
 	//set color
 	QPixmap pixmap(5, 24);
-	pixmap.fill(frame->getColor());
+	pixmap.fill(QColor(frame->getColor()));
 	colorLabel->setPixmap(pixmap);
 	//colorLabel->setText("1:");
 }
@@ -341,6 +341,8 @@ RenderDockWidget::RenderDockWidget(QSettings& settings, Atoms* data, Tracker* fr
 	if(!parent) return;
 	connect(parent, SIGNAL(updateGlLayers()), openGLWidget, SLOT(updateLayers()));
 	connect(parent, SIGNAL(reloadGlShaders()), openGLWidget, SLOT(onReloadShaders()));
+	//queued, the extraction may show the views again while the layers are still reloaded
+	connect(openGLWidget, SIGNAL(layersMissing(int)), parent, SLOT(extractFrameLayers(int)), Qt::QueuedConnection);
 
 	connect(m_styleComboBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged), this, [this](int index){
 		openGLWidget->setStyleMode(static_cast<GLRenderWidget::style>(index));
@@ -455,10 +455,10 @@ void GLRenderWidget::paintGL() {
                   ")";
             paintText(painter, 10, height() - 33, txt, 12);
 
-            const Atoms::layerFrame &frame = m_data->getLayer(m_frame->get());
-            if (frame.maxLayer > 0)
+            const LayerStore &layers = m_data->getLayers();
+            if (layers.maxLayer(m_frame->get()) > 0)
                 paintText(painter, 10, height() - 12, "Layer: " + QString::number(
-                        frame.layers[m_data->getHoveredAtom()], 10, 0), 12);
+                        layers.layer(m_frame->get(), m_data->getHoveredAtom())), 12);
 
             painter.end();
         } else {
@@ -470,8 +470,7 @@ void GLRenderWidget::paintGL() {
             QString txt = QString::number(atom.groupID) + ":" + m_data->getFullResidueName(atom.residue);
             if (!txt.isEmpty()) paintText(painter, 10, height() - 33, txt, 12);
 
-            const Atoms::layerFrame &frame = m_data->getLayer(m_frame->get());
-            if (frame.maxLayer > 0)
+            if (m_data->getLayers().maxLayer(m_frame->get()) > 0)
                 paintText(painter, 10, height() - 12, "Layer: " + QString::number(
                         m_data->getGroupLayer(m_data->getHoveredGroup() - 1, m_frame->get()), 10, 3), 12);
 
@@ -947,6 +946,10 @@ void GLRenderWidget::setCameraRotationY(float v) {
 void GLRenderWidget::reloadLayers(int frame) {
     if (!m_camera || frame < 0 || frame >= m_frame->getMaxFrame()) return;
 
+    if ((m_colorMode == LayerAtomColor || m_colorMode == LayerResidueColor) && frame < m_data->getLayers().size() &&
+        !m_data->getLayers().isValid(frame))
+        emit layersMissing(frame);
+
     if (m_styleMode == HelixStyle) {
         Q_ASSERT(m_data->getProteinStartIDs().size() == m_helix_color.size());
         if (m_colorMode == LayerResidueColor) {
@@ -1025,31 +1028,30 @@ void GLRenderWidget::reloadModel() {
 
         if (m_data->numberOfFrames()) {
             const TrajectoryStream::xtcFrame &frame = m_data->getFrame(m_frame->get());
-            const Atoms::layerFrame &layerframe = m_data->getLayer(m_frame->get());
             points->data = frame.positions;
 
-            if (layerframe.layers.empty()) {
-                for (int i = 0; i < frame.positions.size(); i++)
-                    layers->data.push_back(0.f);
-            } else
-                layers->data = layerframe.layers;
+            //the layers are widened to floats for the GPU
+            m_data->getLayers().fill(m_frame->get(), layers->data);
+            if (layers->data.empty()) layers->data.fill(0.f, frame.positions.size());
 
             for (const Atoms::atom &a: m_data->getAtoms()) {
-                colors->data.push_back(glm::vec3(a.color.redF(), a.color.greenF(), a.color.blueF()));
+                const QColor color = QColor::fromRgba(a.color);
+                colors->data.push_back(glm::vec3(color.redF(), color.greenF(), color.blueF()));
                 radius->data.push_back(a.radius);
                 int group = a.groupID & 0xFFFF;
-                if (a.residue == "HOH" || a.residue.toLower() == "water") group |= FLAG_IS_WATER; //is water
+                if (a.solvent) group |= FLAG_IS_WATER; //is water
                 if (a.name == "CA" || a.name == "C" || a.name == "N") group |= FLAG_IS_BACKBONE; //is backbone
                 groupID->data.push_back(group);
             }
         } else {
             for (const Atoms::atom &a: m_data->getAtoms()) {
                 points->data.push_back(a.position);
-                colors->data.push_back(glm::vec3(a.color.redF(), a.color.greenF(), a.color.blueF()));
+                const QColor color = QColor::fromRgba(a.color);
+                colors->data.push_back(glm::vec3(color.redF(), color.greenF(), color.blueF()));
                 radius->data.push_back(a.radius);
                 layers->data.push_back(0.f);
                 int group = a.groupID & 0xFFFF;
-                if (a.residue == "HOH" || a.residue.toLower() == "water") group |= FLAG_IS_WATER; //is water
+                if (a.solvent) group |= FLAG_IS_WATER; //is water
                 if (a.name == "CA" || a.name == "C" || a.name == "N") group |= FLAG_IS_BACKBONE; //is backbone
                 groupID->data.push_back(group);
             }
@@ -1255,7 +1257,7 @@ void GLRenderWidget::renderBall() {
             ("colors", *m_colorData)("selectedGroup", m_data->getSelectedGroup() + 1);
 
     if (m_data->numberOfFrames())
-        (*m_atomShader)("maxLayer", m_data->getLayer(m_frame->get()).maxLayer);
+        (*m_atomShader)("maxLayer", m_data->getLayers().maxLayer(m_frame->get()));
 
     if (m_data->numberOfAtroms())
         (*m_atomShader)("hoveredAtom", m_data->getHoveredAtom())("hoveredGroup", m_data->getHoveredGroup());
@@ -1274,7 +1276,7 @@ void GLRenderWidget::renderBallStik() {
             ("colors", *m_colorData);
 
     if (m_data->numberOfFrames())
-        (*m_atomShader)("maxLayer", m_data->getLayer(m_frame->get()).maxLayer);
+        (*m_atomShader)("maxLayer", m_data->getLayers().maxLayer(m_frame->get()));
 
     if (m_data->numberOfAtroms())
         (*m_atomShader)("hoveredAtom", m_data->getHoveredAtom())("hoveredGroup", m_data->getHoveredGroup());
@@ -1290,7 +1292,7 @@ void GLRenderWidget::renderBallStik() {
                                                                                                 m_filtersEnabled);
 
         if (m_data->numberOfFrames())
-            (*m_bondShader)("maxLayer", m_data->getLayer(m_frame->get()).maxLayer);
+            (*m_bondShader)("maxLayer", m_data->getLayers().maxLayer(m_frame->get()));
 
         if (m_data->numberOfAtroms())
             (*m_bondShader)("hoveredAtom", m_data->getHoveredAtom())("hoveredGroup", m_data->getHoveredGroup());
@@ -1312,7 +1314,7 @@ void GLRenderWidget::renderPill() {
             ("colors", *m_colorData);
 
     if (m_data->numberOfFrames())
-        (*m_atomShader)("maxLayer", m_data->getLayer(m_frame->get()).maxLayer);
+        (*m_atomShader)("maxLayer", m_data->getLayers().maxLayer(m_frame->get()));
 
     if (m_data->numberOfAtroms())
         (*m_atomShader)("hoveredAtom", m_data->getHoveredAtom())("hoveredGroup", m_data->getHoveredGroup());
@@ -1328,7 +1330,7 @@ void GLRenderWidget::renderPill() {
                 "applyFilters", m_filtersEnabled);
 
         if (m_data->numberOfFrames())
-            (*m_bondShader)("maxLayer", m_data->getLayer(m_frame->get()).maxLayer);
+            (*m_bondShader)("maxLayer", m_data->getLayers().maxLayer(m_frame->get()));
 
         if (m_data->numberOfAtroms())
             (*m_bondShader)("hoveredAtom", m_data->getHoveredAtom())("hoveredGroup", m_data->getHoveredGroup());
@@ -1350,7 +1352,7 @@ void GLRenderWidget::renderBackbone() {
             ("colors", *m_colorData);
 
     if (m_data->numberOfFrames())
-        (*m_atomShader)("maxLayer", m_data->getLayer(m_frame->get()).maxLayer);
+        (*m_atomShader)("maxLayer", m_data->getLayers().maxLayer(m_frame->get()));
 
     if (m_data->numberOfAtroms())
         (*m_atomShader)("hoveredAtom", m_data->getHoveredAtom())("hoveredGroup", m_data->getHoveredGroup());
@@ -1367,7 +1369,7 @@ void GLRenderWidget::renderBackbone() {
                 ("colors", *m_colorData);
 
         if (m_data->numberOfFrames())
-            (*m_bondShader)("maxLayer", m_data->getLayer(m_frame->get()).maxLayer);
+            (*m_bondShader)("maxLayer", m_data->getLayers().maxLayer(m_frame->get()));
 
         if (m_data->numberOfAtroms())
             (*m_bondShader)("hoveredAtom", m_data->getHoveredAtom())("hoveredGroup", m_data->getHoveredGroup());
@@ -1386,7 +1388,7 @@ void GLRenderWidget::renderHelix() {
                 ("scale", m_atomMasterScale)("cameraWorldPos", m_camera->getPosition())("colorMode", (int) m_colorMode);
 
         if (m_data->numberOfFrames())
-            (*m_helixShapeShader)("maxLayer", m_data->getLayer(m_frame->get()).maxLayer);
+            (*m_helixShapeShader)("maxLayer", m_data->getLayers().maxLayer(m_frame->get()));
 
         if (m_data->numberOfAtroms()) (*m_helixShapeShader)("hoveredGroup", m_data->getHoveredGroup());
         else (*m_helixShapeShader)("hoveredGroup", -1);
@@ -1410,7 +1412,7 @@ void GLRenderWidget::renderHeatscale(int width, int height, QPaintDevice *device
     if (!m_data->numberOfAtroms() || !m_data->numberOfFrames() || m_data->getLayers().size() <= m_frame->get() ||
         m_colorLib->p_layersColors.size() < 2)
         return;
-    int maxLayer = m_data->getLayer(m_frame->get()).maxLayer - 1;
+    int maxLayer = m_data->getLayers().maxLayer(m_frame->get()) - 1;
     if (maxLayer <= 0 || maxLayer >= m_colorLib->p_layersColors.size())
         maxLayer = m_colorLib->p_layersColors.size() - 1;
 
@@ -1647,7 +1649,7 @@ void GLRenderWidget::updateFilters() {
     int index = 0;
     for (const Atoms::atom &a: m_data->getAtoms()) {
         int flag = a.groupID & 0xFFFF;
-        if (a.residue == "HOH" || a.residue.toLower() == "water") flag |= FLAG_IS_WATER; //is water
+        if (a.solvent) flag |= FLAG_IS_WATER; //is water
         if (a.name == "CA" || a.name == "C" || a.name == "N") flag |= FLAG_IS_BACKBONE; //is backbone
 
         //qDebug()<<"LOOP atom: "<<a.groupID<<flag<<index;
@@ -209,6 +209,9 @@ signals:
 
     void cameraChanged();
 
+    /// Emitted when the layers of the viewed frame are shown but it has none yet, so they can be extracted on demand.
+    void layersMissing(int frame);
+
 private:
     void reloadLayers(int frame);
 
@@ -62,10 +62,7 @@ QImage SurfaceLayersImageProvider::requestImage(bool residue, int id, const Colo
 	if(residue){
 		if(id >= m_data->numberOfGroups()) return getBGImage(bgColor);
 		//ignore water
-		{
-			const QString groupName = m_data->getGroupName(id);
-			if(groupName == "HOH" || groupName.toLower() == "water") return getBGImage(bgColor);
-		}
+		if(m_data->getAtom(m_data->getGroupStartIDs()[id]).solvent) return getBGImage(bgColor);
 		QImage heatmap(requestedSize, QImage::Format_RGB32); //(0xffRRGGBB)
 		if(size) *size = QSize(requestedSize);
 		const int timeSteps =  m_timeline->getEndFrame() - m_timeline->getStartFrame();
@@ -73,9 +70,8 @@ QImage SurfaceLayersImageProvider::requestImage(bool residue, int id, const Colo
 		float currentFrame = m_timeline->getStartFrame();
 		for(int x = 0; x < requestedSize.width();){
 			const int currentFrameIndex = (int)currentFrame;
-			const Atoms::layerFrame& frame = m_data->getLayer(currentFrameIndex);
 			rawcolor c = {(unsigned char)bgColor.blue(), (unsigned char)bgColor.green(), (unsigned char)bgColor.red(), 0};
-			if(frame.maxLayer >= 0 && !frame.layers.empty()){
+			if(m_data->getLayers().isValid(currentFrameIndex)){
 				c = colors.getInterpolatedRawColor(m_data->getGroupLayer(id, currentFrameIndex));
 			}
 
@@ -93,10 +89,7 @@ QImage SurfaceLayersImageProvider::requestImage(bool residue, int id, const Colo
 	}else{
 		if(id >= m_data->numberOfAtroms()) return getBGImage(bgColor);
 		//ignore water
-		{
-			const QString& groupName = m_data->getAtom(id).residue;
-			if(groupName == "HOH" || groupName.toLower() == "water") return getBGImage(bgColor);
-		}
+		if(m_data->getAtom(id).solvent) return getBGImage(bgColor);
 
 		//qDebug()<<" Atom: "<<a;
 		QImage heatmap(requestedSize, QImage::Format_RGB32); //(0xffRRGGBB)
@@ -106,9 +99,8 @@ QImage SurfaceLayersImageProvider::requestImage(bool residue, int id, const Colo
 		float currentFrame = m_timeline->getStartFrame();
 		for(int x = 0; x < requestedSize.width();){
 			const int currentFrameIndex = (int)currentFrame;
-			const Atoms::layerFrame& frame = m_data->getLayer(currentFrameIndex);
 			rawcolor c = {(unsigned char)bgColor.blue(), (unsigned char)bgColor.green(), (unsigned char)bgColor.red(), 0};
-			if(frame.maxLayer >= 0 && !frame.layers.empty()){
+			if(m_data->getLayers().isValid(currentFrameIndex)){
 				c = colors.getInterpolatedRawColor(m_data->getAtomLayer(id, currentFrameIndex));//getResidueLayersColor(frame.layer[a]/(float)frame.maxLayer);
 			}
 
@@ -0,0 +1,427 @@
+/**
+ * @file   		main.cpp
+ * @author 		Vladimir Ageev (vladimir.agueev@progsys.de)
+ * @date   		15.03.2017
+ *
+ * @brief  		Headless surface layer extraction. Runs the same extraction as the GUI and writes the layers to a .bald or .csv file.
+ *
+ * Usage: AminoVisCLI [options] model trajectory [shards...]
+ *
+ * To distribute the extraction, each node writes the shard of its frame range with --shard <directory>,
+ * afterwards --merge combines all shards into one output file.
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QThread>
+#include <QSharedPointer>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QFile>
+#include <Atoms/Atoms.h>
+#include <Atoms/Timeline.h>
+#include <Atoms/ProteinSurface.h>
+#include <Atoms/LayerCheckpoint.h>
+#include <Util/ResourcePath.h>
+#include <Util/SystemMemory.h>
+
+#include <cstdio>
+#include <algorithm>
+
+namespace {
+
+/// Parses "first-last" or a single frame. An empty string selects all frames.
+bool parseFrameRange(const QString& str, int numberOfFrames, int& first, int& last){
+	first = 0;
+	last = numberOfFrames-1;
+	if(str.isEmpty()) return true;
+	const QStringList parts = str.split('-');
+	bool ok = parts.size() <= 2;
+	if(ok && !parts[0].isEmpty()) first = parts[0].toInt(&ok);
+	if(ok && parts.size() == 2 && !parts[1].isEmpty()) last = parts[1].toInt(&ok);
+	else if(ok && parts.size() == 1) last = first;
+	return ok && first >= 0 && first <= last && last < numberOfFrames;
+}
+
+/// With more than one probe radius the radius is appended to the file name, e.g. "out.bald" -> "out_1.40.bald".
+QString outputPath(const QString& path, float probeRadius, bool multipleRadii){
+	if(!multipleRadii) return path;
+	const QFileInfo info(path);
+	return info.dir().filePath(info.completeBaseName() + "_" + QString::number(probeRadius, 'f', 2) + "." + info.suffix());
+}
+
+/// Exports each layer set, one file per probe radius. @returns false if any file couldn't be written.
+bool writeLayerSets(Atoms& data, const QString& output, const QVector<float>& probeRadii, const QVector<int>& layerSets, bool atomMajor, bool compressed){
+	bool result = true;
+	for(int s = 0; s < probeRadii.size(); s++){
+		const QString path = outputPath(output, probeRadii[s], probeRadii.size() > 1);
+		data.setActiveLayerSet(layerSets[s]);
+		if(data.exportLayerData(path, probeRadii[s], atomMajor, compressed))
+			fprintf(stderr, "Written '%s'.\n", qPrintable(path));
+		else{
+			fprintf(stderr, "Failed to write '%s'.\n", qPrintable(path));
+			result = false;
+		}
+	}
+	return result;
+}
+
+/*!
+ * @brief Finishes the .bald files the extraction wrote in place. A file has one byte per layer, so if a frame was deeper
+ * than 255 layers the file is written again with two bytes per layer. @returns false if any file couldn't be written.
+ */
+bool finishMappedLayerSets(Atoms& data, const QString& output, const QVector<float>& probeRadii, const QVector<int>& layerSets){
+	bool result = true;
+	for(int s = 0; s < probeRadii.size(); s++){
+		const QString path = outputPath(output, probeRadii[s], probeRadii.size() > 1);
+		LayerStore& frames = data.getLayerSet(layerSets[s]).frames;
+		bool deep = false;
+		for(int f = 0; f < frames.size() && !deep; f++) deep = frames.isWide(f);
+		if(deep){
+			const QString widePath = path + ".wide";
+			const bool saved = frames.save(widePath, probeRadii[s], frames.layout());
+			frames.reset(0, 0);
+			if(!saved || !QFile::remove(path) || !QFile::rename(widePath, path)){
+				fprintf(stderr, "Failed to write '%s'.\n", qPrintable(path));
+				result = false;
+				continue;
+			}
+		}
+		fprintf(stderr, "Written '%s'.\n", qPrintable(path));
+	}
+	return result;
+}
+
+/// Exports the accessible surface area of each layer set, per atom into path and per residue into path with "_residues" appended.
+bool writeSASA(Atoms& data, const QString& path, const QVector<float>& probeRadii, const QVector<int>& layerSets){
+	bool result = true;
+	const QFileInfo info(path);
+	const QString residuePath = info.dir().filePath(info.completeBaseName() + "_residues." + info.suffix());
+	for(int s = 0; s < probeRadii.size(); s++){
+		const QString atomsFile = outputPath(path, probeRadii[s], probeRadii.size() > 1);
+		const QString residuesFile = outputPath(residuePath, probeRadii[s], probeRadii.size() > 1);
+		data.setActiveLayerSet(layerSets[s]);
+		if(data.exportSASA(atomsFile, false) && data.exportSASA(residuesFile, true))
+			fprintf(stderr, "Written '%s' and '%s'.\n", qPrintable(atomsFile), qPrintable(residuesFile));
+		else{
+			fprintf(stderr, "Failed to write '%s' or '%s'.\n", qPrintable(atomsFile), qPrintable(residuesFile));
+			result = false;
+		}
+	}
+	return result;
+}
+
+/// Writes the merged metrics and the metrics of each thread as JSON. @returns false if the file couldn't be written.
+bool writeMetrics(const QString& path, const extractionMetrics& merged, const QVector<extractionMetrics>& perThread){
+	QJsonArray threads;
+	for(const extractionMetrics& m: perThread) threads.append(m.toJson());
+	QJsonObject json = merged.toJson();
+	json["perThread"] = threads;
+
+	QFile file(path);
+	if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(QJsonDocument(json).toJson()) < 0){
+		fprintf(stderr, "Failed to write '%s'.\n", qPrintable(path));
+		return false;
+	}
+	fprintf(stderr, "Written '%s'.\n", qPrintable(path));
+	return true;
+}
+
+}
+
+int main(int argc, char *argv[]){
+	QCoreApplication a(argc, argv);
+	QCoreApplication::setApplicationName("AminoVisCLI");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Extracts the solvent accessible surface layers of every frame of a trajectory.");
+	parser.addHelpOption();
+	parser.addPositionalArgument("model", "The model file (.pdb or .gro).");
+	parser.addPositionalArgument("trajectory", "The trajectory file (.xtc).");
+	parser.addPositionalArgument("shards", "With --merge the shard files (.balc) to combine.", "[shards...]");
+	const QCommandLineOption probeOption(QStringList()<<"p"<<"probe",
+			"Probe radius, can be given multiple times or as a list separated by ';' or ','. Default is 1.4.", "radii");
+	const QCommandLineOption framesOption(QStringList()<<"f"<<"frames", "Frame range to extract, e.g. 0-99. Default are all frames.", "first-last");
+	const QCommandLineOption threadsOption(QStringList()<<"t"<<"threads", "Number of extraction threads. Default is the number of cores.", "n");
+	const QCommandLineOption outputOption(QStringList()<<"o"<<"output", "Output file, the suffix selects the format (.bald or .csv).", "path");
+	const QCommandLineOption mappedOption("mapped",
+			"Creates the .bald output before the extraction and writes each frame directly into it, so the layers don't have to fit into memory.");
+	const QCommandLineOption layoutOption("layout",
+			"Order of the layers in .bald files, 'frame' or 'atom'. Atom-major files are faster to browse over time in the GUI. Default is frame.",
+			"order", "frame");
+	const QCommandLineOption compressOption("compress",
+			"Writes chunked and compressed .bald files, which are a lot smaller but are decompressed into memory by the GUI instead of mapped.");
+	const QCommandLineOption scratchOption("scratch-mb", "Scratch memory per thread in MB. Default is 256.", "mb", "256");
+	const QCommandLineOption resumeOption(QStringList()<<"r"<<"resume", "Stores completed frames in checkpoints next to the trajectory and resumes from them.");
+	const QCommandLineOption shardOption(QStringList()<<"s"<<"shard",
+			"Writes the extracted frames as shards into the given directory instead of an output file. Existing shards are resumed.", "directory");
+	const QCommandLineOption mergeOption(QStringList()<<"m"<<"merge", "Merges the given shards into the output file instead of extracting.");
+	const QCommandLineOption sasaOption("sasa",
+			"Also computes the solvent accessible surface area and writes it per atom into the given .csv file and per residue into <file>_residues.csv.", "path");
+	const QCommandLineOption sasaPointsOption("sasa-points", "Number of points per atom used for the surface area. Default is 100.", "n", "100");
+	const QCommandLineOption solventOption("solvent",
+			"Residue names of the solvent, which is skipped by the extraction, separated by ';' or ','. Default is SOL,HOH,water.", "names");
+	const QCommandLineOption metricsOption("metrics",
+			"Writes throughput metrics of the extraction, merged and per thread, as JSON into the given file. "
+			"Also measures the time spent in the intersection and end point tests, which slows the extraction down a little.", "path");
+	const QCommandLineOption resourcesOption("resources", "Path to the resource folder.", "path");
+	parser.addOption(probeOption);
+	parser.addOption(framesOption);
+	parser.addOption(threadsOption);
+	parser.addOption(outputOption);
+	parser.addOption(mappedOption);
+	parser.addOption(layoutOption);
+	parser.addOption(compressOption);
+	parser.addOption(scratchOption);
+	parser.addOption(resumeOption);
+	parser.addOption(shardOption);
+	parser.addOption(mergeOption);
+	parser.addOption(sasaOption);
+	parser.addOption(sasaPointsOption);
+	parser.addOption(solventOption);
+	parser.addOption(metricsOption);
+	parser.addOption(resourcesOption);
+	parser.process(a);
+
+	const QStringList args = parser.positionalArguments();
+	const bool merge = parser.isSet(mergeOption);
+	const bool shard = parser.isSet(shardOption);
+	if(args.size() < 2 || (args.size() > 2) != merge || merge == shard || (!shard && !parser.isSet(outputOption))){
+		fprintf(stderr, "A model, a trajectory and either an output file, a shard directory or shards to merge are required.\n\n");
+		parser.showHelp(1);
+	}
+	const QString output = parser.value(outputOption);
+	const QString suffix = QFileInfo(output).suffix();
+	if(!shard && suffix != "bald" && suffix != "csv"){
+		fprintf(stderr, "Unknown output format '%s', use .bald or .csv.\n", qPrintable(suffix));
+		return 1;
+	}
+
+	const bool mapped = parser.isSet(mappedOption);
+	if(mapped && (shard || merge || suffix != "bald")){
+		fprintf(stderr, "Writing the layers in place needs a .bald output and can't be combined with shards.\n");
+		return 1;
+	}
+
+	const QString layout = parser.value(layoutOption);
+	const bool atomMajor = layout == "atom";
+	if((!atomMajor && layout != "frame") || (atomMajor && suffix != "bald")){
+		fprintf(stderr, "Invalid layout '%s', use frame or atom with a .bald output.\n", qPrintable(layout));
+		return 1;
+	}
+
+	const bool compressed = parser.isSet(compressOption);
+	if(compressed && (mapped || atomMajor || suffix != "bald")){
+		fprintf(stderr, "Compressed files need a .bald output, are always frame-major and can't be written in place.\n");
+		return 1;
+	}
+
+	//checkpoints and shards only store the layers
+	const bool sasa = parser.isSet(sasaOption);
+	const int sasaPoints = parser.value(sasaPointsOption).toInt();
+	if(sasa && (merge || shard || parser.isSet(resumeOption) || sasaPoints <= 0)){
+		fprintf(stderr, "The surface area needs a positive number of points and can't be combined with shards or checkpoints.\n");
+		return 1;
+	}
+
+	QVector<float> probeRadii;
+	for(const QString& value: parser.values(probeOption))
+		for(const QString& str: value.split(QRegExp(";|,"), QString::SkipEmptyParts)){
+			bool ok = false;
+			const float radius = str.trimmed().toFloat(&ok);
+			if(!ok || radius < 0){
+				fprintf(stderr, "Invalid probe radius '%s'.\n", qPrintable(str));
+				return 1;
+			}
+			if(!probeRadii.contains(radius)) probeRadii.push_back(radius);
+		}
+	if(probeRadii.empty()) probeRadii.push_back(1.4f);
+
+	{
+		//setup resource path
+		setConfigPath(QDir::homePath()+"/.config/aminoVis");
+		setResourcePath(parser.isSet(resourcesOption) ? parser.value(resourcesOption) : findResourcePath());
+	}
+
+	Atoms data(resourcePath());
+	Timeline timeline;
+	data.setData(&timeline, nullptr);
+	if(parser.isSet(solventOption))
+		data.setSolventResidues(parser.value(solventOption).split(QRegExp(";|,"), QString::SkipEmptyParts));
+	if(!data.open(args[0], args[1]) || data.numberOfFrames() <= 0){
+		fprintf(stderr, "Failed to open '%s' and '%s'.\n", qPrintable(args[0]), qPrintable(args[1]));
+		return 1;
+	}
+
+	if(merge){
+		//combine the shards of the same extraction, each probe radius into its own layer set
+		QVector<float> mergedRadii;
+		QVector<int> layerSets;
+		for(int i = 2; i < args.size(); i++){
+			LayerStore frames;
+			if(!frames.reset(data.numberOfAtroms(), data.numberOfFrames())){
+				fprintf(stderr, "Not enough memory to read '%s'.\n", qPrintable(args[i]));
+				return 1;
+			}
+			float radius;
+			QByteArray identity;
+			const int numberOfFrames = LayerCheckpoint::read(args[i], data.numberOfAtroms(), frames, radius, identity);
+			if(numberOfFrames < 0 || identity != LayerCheckpoint::identity(data, radius, regionOfInterest())){
+				fprintf(stderr, "'%s' is not a shard of this model and trajectory.\n", qPrintable(args[i]));
+				return 1;
+			}
+			if(!mergedRadii.contains(radius)){
+				const int set = data.addLayerSet(radius);
+				if(set < 0){
+					fprintf(stderr, "Not enough memory for the layers of probe radius %g.\n", radius);
+					return 1;
+				}
+				mergedRadii.push_back(radius);
+				layerSets.push_back(set);
+			}
+			data.getLayerSet(layerSets[mergedRadii.indexOf(radius)]).frames.merge(frames);
+			fprintf(stderr, "Read %d frames from '%s'.\n", numberOfFrames, qPrintable(args[i]));
+		}
+		for(int s = 0; s < mergedRadii.size(); s++){
+			const LayerStore& frames = data.getLayerSet(layerSets[s]).frames;
+			int missing = 0;
+			for(int f = 0; f < frames.size(); f++)
+				if(!frames.isValid(f)) missing++;
+			if(missing) fprintf(stderr, "Warning: %d frames of probe radius %.2f are missing in the shards.\n", missing, mergedRadii[s]);
+		}
+		return writeLayerSets(data, output, mergedRadii, layerSets, atomMajor, compressed) ? 0 : 1;
+	}
+
+	int first, last;
+	if(!parseFrameRange(parser.value(framesOption), data.numberOfFrames(), first, last)){
+		fprintf(stderr, "Invalid frame range '%s', the trajectory has %d frames.\n", qPrintable(parser.value(framesOption)), data.numberOfFrames());
+		return 1;
+	}
+	const int numberOfThreads = qBound(1, parser.isSet(threadsOption) ? parser.value(threadsOption).toInt() : QThread::idealThreadCount(), last-first+1);
+	const size_t scratchMemoryLimit = (size_t) parser.value(scratchOption).toUInt() * 1024u * 1024u;
+
+	//reject jobs that don't fit into memory before anything is allocated
+	const size_t neededMemory = estimateExtractionMemory(data.numberOfAtroms(), last-first+1, probeRadii.size(), numberOfThreads, scratchMemoryLimit, sasa, mapped);
+	const size_t availableMemory = availablePhysicalMemory();
+	if(availableMemory && neededMemory > availableMemory){
+		fprintf(stderr, "Not enough memory: the extraction needs %s, but only %s are available. Use fewer frames, probe radii or threads.\n",
+				qPrintable(formatBytes(neededMemory)), qPrintable(formatBytes(availableMemory)));
+		return 1;
+	}
+
+	QVector<int> layerSets;
+	for(float radius: probeRadii){
+		layerSets.push_back(data.addLayerSet(radius));
+		if(layerSets.last() < 0){
+			fprintf(stderr, "Not enough memory for the layers of probe radius %g.\n", radius);
+			return 1;
+		}
+	}
+
+	//the output files are created up front and mapped, the threads write each frame in place
+	if(mapped)
+		for(int s = 0; s < probeRadii.size(); s++){
+			const QString path = outputPath(output, probeRadii[s], probeRadii.size() > 1);
+			if(!data.getLayerSet(layerSets[s]).frames.create(path, data.numberOfAtroms(), data.numberOfFrames(), probeRadii[s],
+					(atomMajor) ? layerFileHeader::AtomMajor : layerFileHeader::FrameMajor)){
+				fprintf(stderr, "Failed to create '%s'.\n", qPrintable(path));
+				return 1;
+			}
+		}
+
+	//a shard is a checkpoint restricted to the frame range, tagged with model, trajectory, probe radius and range
+	QVector<QSharedPointer<LayerCheckpoint>> checkpoints;
+	if(shard || parser.isSet(resumeOption)){
+		for(int s = 0; s < probeRadii.size(); s++){
+			const QByteArray identity = LayerCheckpoint::identity(data, probeRadii[s], regionOfInterest());
+			const QString path = (shard) ? LayerCheckpoint::shardPath(parser.value(shardOption), data, probeRadii[s], identity, first, last)
+										 : LayerCheckpoint::defaultPath(data, probeRadii[s], identity);
+			QSharedPointer<LayerCheckpoint> checkpoint(new LayerCheckpoint());
+			if(!checkpoint->open(path, identity, probeRadii[s], data.numberOfAtroms(), data.getLayerSet(layerSets[s]).frames, first, last)){
+				if(shard){
+					fprintf(stderr, "Failed to create shard '%s'.\n", qPrintable(path));
+					return 1;
+				}
+				checkpoint.reset();
+			}
+			else if(shard)
+				fprintf(stderr, "Writing shard '%s'.\n", qPrintable(path));
+			checkpoints.push_back(checkpoint);
+		}
+	}
+
+	fprintf(stderr, "Extracting frames %d-%d of %d atoms with %d threads.\n", first, last, data.numberOfAtroms(), numberOfThreads);
+	QElapsedTimer timer;
+	timer.start();
+
+	//each thread receives a consecutive window of frames
+	QVector<ExtractSurfaceThread*> threads;
+	const int step = (last-first)/numberOfThreads + 1;
+	for(int start = first; start <= last; start += step){
+		ExtractSurfaceThread* thread = new ExtractSurfaceThread(&data, start, qMin(start+step-1, last), probeRadii, layerSets);
+		thread->setScratchMemoryLimit(scratchMemoryLimit);
+		thread->setCheckpoints(checkpoints);
+		if(sasa) thread->setSASAPoints(sasaPoints);
+		thread->setPhaseTiming(parser.isSet(metricsOption));
+		threads.push_back(thread);
+		thread->start();
+	}
+
+	for(;;){
+		bool finished = true;
+		float totalProgress = 0;
+		for(ExtractSurfaceThread* th: threads){
+			finished &= th->isFinished();
+			totalProgress += (th->isFinished()) ? 1 : th->getProgress();
+		}
+		fprintf(stderr, "\rProgress: %5.1f%%", 100*totalProgress/threads.size());
+		if(finished) break;
+		for(ExtractSurfaceThread* th: threads)
+			if(!th->isFinished()){
+				th->wait(1000);
+				break;
+			}
+	}
+	fprintf(stderr, "\nFinished in %lld ms.\n", (long long) timer.elapsed());
+	QVector<extractionMetrics> perThread;
+	for(ExtractSurfaceThread* th: threads) perThread.push_back(th->getMetrics());
+	qDeleteAll(threads);
+	extractionMetrics metrics = perThread.first();
+	for(int i = 1; i < perThread.size(); i++) metrics.merge(perThread[i]);
+	fprintf(stderr, "%.2f frames/s, %.0f atoms/s, %.1f peel iterations per frame, %.0f%% thread utilisation.\n",
+			metrics.framesPerSecond(), metrics.atomsPerSecond(),
+			(metrics.frames) ? metrics.peelIterations/(double)metrics.frames : 0.0, 100*metrics.utilisation());
+	if(metrics.failedFrames)
+		fprintf(stderr, "Warning: %d frames needed more than %s MB of scratch memory and are invalid, raise --%s.\n",
+				metrics.failedFrames, qPrintable(parser.value(scratchOption)), qPrintable(scratchOption.names().first()));
+	bool metricsWritten = !parser.isSet(metricsOption) || writeMetrics(parser.value(metricsOption), metrics, perThread);
+
+	if(shard) return metricsWritten ? 0 : 1;
+	bool written = ((mapped) ? finishMappedLayerSets(data, output, probeRadii, layerSets) : writeLayerSets(data, output, probeRadii, layerSets, atomMajor, compressed)) &&
+				   metricsWritten;
+	if(sasa) written = writeSASA(data, parser.value(sasaOption), probeRadii, layerSets) && written;
+	return written ? 0 : 1;
+}
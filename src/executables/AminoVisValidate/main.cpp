@@ -0,0 +1,529 @@
+/**
+ * @file   		main.cpp
+ * @author 		Vladimir Ageev (vladimir.agueev@progsys.de)
+ * @date   		15.03.2017
+ *
+ * @brief  		Validates the precision and determinism of the surface extraction and measures its speed.
+ *
+ * Usage: AminoVisValidate [options] model trajectory
+ *        AminoVisValidate [options] --synthetic atoms
+ *
+ * Each frame is extracted the way the extraction threads do it, with a context reused across frames,
+ * and checked against:
+ * - a second extraction with a fresh context, which has to be bitwise identical,
+ * - a golden file written by a trusted build (--golden, created with --write-golden),
+ * - a double precision brute force reference of the accessible area, which also checks that
+ *   every atom with accessible area is classified as surface (layer 0).
+ * Per frame the mismatch counts and timings are printed, the exit code is 1 if any check failed.
+ *
+ * With --formats the extracted frames are also repeated to a longer trajectory, which is written and read again
+ * as chunked .bald file and as .csv file, and the range summaries are compared with a scan of the frames.
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QDir>
+#include <QMap>
+#include <QTextStream>
+#include <QSharedPointer>
+#include <QTemporaryDir>
+#include <Atoms/Atoms.h>
+#include <Atoms/Timeline.h>
+#include <Atoms/ProteinSurface.h>
+#include <Atoms/LayerRanges.h>
+#include <Util/ResourcePath.h>
+
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <limits>
+#include <algorithm>
+
+namespace {
+
+/// Parses "first-last" or a single frame. An empty string selects all frames.
+bool parseFrameRange(const QString& str, int numberOfFrames, int& first, int& last){
+	first = 0;
+	last = numberOfFrames-1;
+	if(str.isEmpty()) return true;
+	const QStringList parts = str.split('-');
+	bool ok = parts.size() <= 2;
+	if(ok && !parts[0].isEmpty()) first = parts[0].toInt(&ok);
+	if(ok && parts.size() == 2 && !parts[1].isEmpty()) last = parts[1].toInt(&ok);
+	else if(ok && parts.size() == 1) last = first;
+	return ok && first >= 0 && first <= last && last < numberOfFrames;
+}
+
+/// Uniform value in [-1, 1]. Only the raw output of the mersenne twister is defined by the standard, so it is converted by hand.
+inline float uniform(std::mt19937& rng){
+	return (float)(rng()/4294967295.0*2.0 - 1.0);
+}
+
+/*!
+ * @brief A synthetic globular protein, so the extraction can be validated without any input files.
+ * The atoms are placed on a jittered lattice inside a ball, each frame moves them slightly.
+ * The structure only depends on the number of atoms and the frame, so it is the same on every platform.
+ */
+class SyntheticProtein{
+public:
+	explicit SyntheticProtein(int numberOfAtoms){
+		static const char* elements[] = {"C", "N", "O", "S"};
+		static const float radii[] = {1.7f, 1.55f, 1.52f, 1.8f};
+		const float spacing = 1.5f;
+		const float ballRadius = std::cbrt(numberOfAtoms*3.f/(4.f*3.14159265f))*spacing + spacing;
+		const int cells = (int)std::ceil(ballRadius/spacing);
+		std::mt19937 rng(42);
+		for(int x = -cells; x <= cells; x++)
+			for(int y = -cells; y <= cells; y++)
+				for(int z = -cells; z <= cells; z++){
+					const glm::vec3 position(glm::vec3(x, y, z)*spacing);
+					const glm::vec3 jitter(uniform(rng), uniform(rng), uniform(rng));
+					if(glm::length(position) > ballRadius || m_model.size() >= numberOfAtoms) continue;
+					const int element = m_model.size() % 4;
+					m_model.push_back({elements[element], elements[element], "SYN", (unsigned int)m_model.size()/8, 0,
+									   position + jitter*0.2f, 0, radii[element], false});
+				}
+	}
+
+	inline const QVector<Atoms::atom>& getAtoms() const { return m_model; }
+
+	TrajectoryStream::xtcFrame getFrame(int index) const{
+		TrajectoryStream::xtcFrame frame;
+		frame.index = index;
+		frame.time = index;
+		frame.precision = 1000;
+		std::mt19937 rng(index+1);
+		glm::vec3 min(std::numeric_limits<float>::max()), max(-std::numeric_limits<float>::max());
+		for(const Atoms::atom& a: m_model){
+			const glm::vec3 jitter(uniform(rng), uniform(rng), uniform(rng));
+			frame.positions.push_back(a.position + jitter*0.1f*(float)(index > 0));
+			min = glm::min(min, frame.positions.last());
+			max = glm::max(max, frame.positions.last());
+		}
+		frame.box.min = min;
+		frame.box.max = max;
+		return frame;
+	}
+private:
+	QVector<Atoms::atom> m_model;
+};
+
+/*!
+ * @brief Golden layers stored as text, one line per frame: frame index, max layer and the layer of each atom.
+ * Text keeps the files reviewable when they are updated.
+ */
+bool writeGolden(const QString& path, float probeRadius, int numberOfAtoms, const QVector<int>& frames, const QVector<Atoms::layerFrame>& layers){
+	QFile file(path);
+	if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+	QTextStream out(&file);
+	out<<"# AminoVis golden layers, atoms "<<numberOfAtoms<<" probe "<<QString::number(probeRadius, 'f', 2)<<"\n";
+	for(int f = 0; f < frames.size(); f++){
+		out<<frames[f]<<" "<<layers[f].maxLayer;
+		for(float l: layers[f].layers) out<<" "<<(int)l;
+		out<<"\n";
+	}
+	return out.status() == QTextStream::Ok;
+}
+
+/// Reads a golden file into frame index -> layers. @returns false if the file can't be read or belongs to another model.
+bool readGolden(const QString& path, int numberOfAtoms, QMap<int, Atoms::layerFrame>& golden){
+	QFile file(path);
+	if(!file.open(QIODevice::ReadOnly | QIODevice::Text)) return false;
+	QTextStream in(&file);
+	while(!in.atEnd()){
+		const QString line = in.readLine();
+		if(line.startsWith('#') || line.trimmed().isEmpty()) continue;
+		const QStringList values = line.split(' ', QString::SkipEmptyParts);
+		if(values.size() != numberOfAtoms+2) return false;
+		Atoms::layerFrame& frame = golden[values[0].toInt()];
+		frame.maxLayer = values[1].toInt();
+		frame.layers.resize(numberOfAtoms);
+		for(int i = 0; i < numberOfAtoms; i++) frame.layers[i] = values[i+2].toInt();
+	}
+	return true;
+}
+
+/// Result of the double precision area reference of one frame.
+struct areaCheck{
+	int mismatches = 0; /// Atoms whose area differs by more than one sphere point
+	double maxError = 0; /// Largest difference in square Angstroms
+	int notSurface = 0; /// Atoms with accessible area that are not in layer 0
+};
+
+/*!
+ * @brief Recomputes the accessible area of each atom in double precision with a brute force test of the sphere points.
+ * Points exactly on the border of another sphere may flip between float and double,
+ * so a difference of one point is tolerated.
+ */
+areaCheck checkArea(const QVector<Atoms::atom>& model, const TrajectoryStream::xtcFrame& frame, const Atoms::layerFrame& layerframe,
+					float probeRadius, const QVector<glm::vec3>& spherePoints){
+	areaCheck result;
+	if(layerframe.sasa.size() != model.size()) return result;
+	QVector<int> solute;
+	QVector<float> cutoffs(model.size(), 0.f);
+	float maxAtomRadius = 0;
+	for(int i = 0; i < model.size(); i++)
+		if(!model[i].solvent){
+			solute.push_back(i);
+			maxAtomRadius = glm::max(maxAtomRadius, model[i].radius);
+		}
+	NeighbourList neighbours;
+	neighbours.update(frame.positions, frame.box, solute, cutoffs);
+
+	for(int i: solute){
+		const glm::dvec3 center(frame.positions[i]);
+		const double radius = model[i].radius + (double)probeRadius;
+		QVector<int> candidates;
+		neighbours.forEachInRadius(frame.positions, frame.positions[i], radius + maxAtomRadius + probeRadius + 0.01f, [&](int j){
+			if(j != i) candidates.push_back(j);
+		});
+		int accessible = 0;
+		for(const glm::vec3& point: spherePoints){
+			const glm::dvec3 p(center + glm::dvec3(point)*radius);
+			bool covered = false;
+			for(int j: candidates){
+				const glm::dvec3 d(p - glm::dvec3(frame.positions[j]));
+				const double r = model[j].radius + (double)probeRadius;
+				if(glm::dot(d, d) < r*r){
+					covered = true;
+					break;
+				}
+			}
+			if(!covered) accessible++;
+		}
+		const double pointArea = 4.0*3.14159265358979*radius*radius/spherePoints.size();
+		const double error = std::fabs(accessible*pointArea - layerframe.sasa[i]);
+		result.maxError = std::max(result.maxError, error);
+		if(error > pointArea*1.001) result.mismatches++;
+		if(accessible > 0 && layerframe.layers[i] != 0) result.notSurface++;
+	}
+	return result;
+}
+
+/// @returns The number of atoms whose layer differs, or all atoms if the max layers differ.
+int countMismatches(const Atoms::layerFrame& a, const Atoms::layerFrame& b){
+	if(a.maxLayer != b.maxLayer || a.layers.size() != b.layers.size()) return qMax(a.layers.size(), b.layers.size());
+	int mismatches = 0;
+	for(int i = 0; i < a.layers.size(); i++)
+		if(a.layers[i] != b.layers[i] || (!a.sasa.empty() && a.sasa[i] != b.sasa[i])) mismatches++;
+	return mismatches;
+}
+
+/*!
+ * @brief Repeats the extracted frames to numberOfFrames frames, so the chunks of the files and the blocks of the
+ * range summaries are filled. Every 13th frame is invalid and every 101st is deeper than 255 layers.
+ */
+LayerStore repeatFrames(const QVector<Atoms::layerFrame>& frames, int numberOfAtoms, int numberOfFrames){
+	LayerStore layers;
+	if(frames.empty() || !layers.reset(numberOfAtoms, numberOfFrames)) return layers;
+	QVector<float> wide;
+	for(int f = 0; f < numberOfFrames; f++){
+		const Atoms::layerFrame& frame = frames[(f*7) % frames.size()];
+		if(f % 13 == 0 || frame.maxLayer < 0) continue;
+		if(f % 101 == 50){
+			wide = frame.layers;
+			for(float& l: wide) l += 256;
+			layers.setFrame(f, frame.maxLayer + 256, wide);
+		}else layers.setFrame(f, frame.maxLayer, frame.layers);
+	}
+	return layers;
+}
+
+/// @returns The number of frames whose max layer (or only validity, if maxLayers is false) or layers differ.
+int compareLayers(const LayerStore& a, const LayerStore& b, bool maxLayers = true){
+	if(a.numberOfAtoms() != b.numberOfAtoms() || a.numberOfFrames() != b.numberOfFrames()) return qMax(a.numberOfFrames(), b.numberOfFrames());
+	int mismatches = 0;
+	for(int f = 0; f < a.numberOfFrames(); f++){
+		bool equal = (maxLayers) ? a.maxLayer(f) == b.maxLayer(f) : a.isValid(f) == b.isValid(f);
+		for(int i = 0; i < a.numberOfAtoms() && equal && a.isValid(f); i++) equal = a.layer(f, i) == b.layer(f, i);
+		if(!equal) mismatches++;
+	}
+	return mismatches;
+}
+
+/*!
+ * @brief Packs the XOR of neighbouring frames like the chunked files do, and unpacks it again.
+ * @returns The number of frames that don't unpack to the same bytes or whose truncated runs aren't detected.
+ */
+int checkRuns(const LayerStore& layers){
+	int mismatches = 0;
+	std::vector<char> previous, current, packed;
+	std::vector<unsigned char> delta, unpacked;
+	for(int f = 0; f < layers.numberOfFrames(); f++){
+		current.clear();
+		if(layers.isValid(f)) layers.encode(f, current);
+		delta.assign(current.size(), 0);
+		for(size_t i = 0; i < current.size(); i++) delta[i] = current[i] ^ ((i < previous.size()) ? previous[i] : 0);
+		packed.clear();
+		packRuns(delta.data(), delta.size(), packed);
+		unpacked.assign(delta.size(), 0);
+		const unsigned char* in = reinterpret_cast<const unsigned char*>(packed.data());
+		const unsigned char* end = in + packed.size();
+		if(!unpackRuns(in, end, unpacked.data(), unpacked.size()) || in != end || unpacked != delta) mismatches++;
+		in = reinterpret_cast<const unsigned char*>(packed.data());
+		if(!delta.empty() && unpackRuns(in, end - 1, unpacked.data(), unpacked.size())) mismatches++;
+		previous.swap(current);
+	}
+	return mismatches;
+}
+
+/// Saves the layers chunked and loads them again, all frames and a part of them. @returns The number of differing frames.
+int checkChunked(const LayerStore& layers, const QString& path){
+	float probeRadius = 0;
+	LayerStore loaded;
+	if(!layers.save(path, 1.4f, layerFileHeader::FrameMajor, layerFileHeader::Chunked) || !loaded.load(path, probeRadius) ||
+			probeRadius != 1.4f)
+		return layers.numberOfFrames();
+	int mismatches = compareLayers(layers, loaded);
+	//only the requested frames of a partial load are valid
+	const int first = layers.numberOfFrames()/3, last = first + 100;
+	if(!loaded.load(path, probeRadius, first, last)) return mismatches + 1;
+	for(int f = 0; f < layers.numberOfFrames(); f++){
+		if(f < first || f > last){
+			if(loaded.isValid(f)) mismatches++;
+			continue;
+		}
+		bool equal = layers.maxLayer(f) == loaded.maxLayer(f);
+		for(int i = 0; i < layers.numberOfAtoms() && equal && layers.isValid(f); i++) equal = layers.layer(f, i) == loaded.layer(f, i);
+		if(!equal) mismatches++;
+	}
+	return mismatches;
+}
+
+/// Writes the layers as .csv file and reads them again. @returns The number of differing frames.
+int checkCsv(const LayerStore& layers, const QString& path){
+	QStringList columns;
+	for(int i = 0; i < layers.numberOfAtoms(); i++) columns << QString("A%1").arg(i);
+	QFile out(path);
+	if(!out.open(QIODevice::WriteOnly) || !layers.writeCsv(out, columns)) return layers.numberOfFrames();
+	out.close();
+	LayerStore read;
+	QFile in(path);
+	if(!in.open(QIODevice::ReadOnly) || !read.reset(layers.numberOfAtoms(), layers.numberOfFrames())) return layers.numberOfFrames();
+	read.readCsv(in);
+	//the csv files only have the layers, the max layer is read back as the largest of them
+	return compareLayers(layers, read, false);
+}
+
+/// Compares range queries of random atoms and frame ranges with a scan of the frames. @returns The number of differing queries.
+int checkRanges(const LayerStore& layers, int queries){
+	std::vector<char> valid(layers.numberOfFrames());
+	for(int f = 0; f < layers.numberOfFrames(); f++) valid[f] = layers.isValid(f);
+	LayerRanges ranges;
+	ranges.build(layers.numberOfAtoms(), valid, [&](int f, QVector<float>& out){ layers.fill(f, out); });
+	std::mt19937 rng(7);
+	int mismatches = 0;
+	for(int q = 0; q < queries; q++){
+		const int atom = rng() % layers.numberOfAtoms();
+		int first = rng() % (layers.numberOfFrames() + 1);
+		int last = rng() % (layers.numberOfFrames() + 1);
+		if(first > last) std::swap(first, last);
+		if(q % 10 == 0){
+			first = 0;
+			last = layers.numberOfFrames();
+		}
+		const LayerRanges::range range = ranges.query(atom, first, last, [&](int f){ return (float) layers.layer(f, atom); });
+		LayerRanges::range scan;
+		for(int f = first; f < last; f++)
+			if(layers.isValid(f)) scan.add(layers.layer(f, atom));
+		//the block sums are floats, so the mean may differ slightly
+		if(range.frames != scan.frames || range.min != scan.min || range.max != scan.max ||
+				std::fabs(range.mean() - scan.mean()) > 1e-3f*std::max(1.f, scan.mean()))
+			mismatches++;
+	}
+	return mismatches;
+}
+
+}
+
+int main(int argc, char *argv[]){
+	QCoreApplication a(argc, argv);
+	QCoreApplication::setApplicationName("AminoVisValidate");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Validates the precision and determinism of the surface extraction and measures its speed.");
+	parser.addHelpOption();
+	parser.addPositionalArgument("model", "The model file (.pdb or .gro).", "[model]");
+	parser.addPositionalArgument("trajectory", "The trajectory file (.xtc).", "[trajectory]");
+	const QCommandLineOption syntheticOption("synthetic", "Validates a generated protein with the given number of atoms instead of a model and trajectory.", "atoms");
+	const QCommandLineOption probeOption(QStringList()<<"p"<<"probe", "Probe radius. Default is 1.4.", "radius", "1.4");
+	const QCommandLineOption framesOption(QStringList()<<"f"<<"frames",
+			"Frame range to validate, e.g. 0-99. Default are all frames of the trajectory or 0-9 for a synthetic protein.", "first-last");
+	const QCommandLineOption goldenOption(QStringList()<<"g"<<"golden", "Compares the layers with the given golden file.", "path");
+	const QCommandLineOption writeGoldenOption("write-golden", "Writes the extracted layers as golden file.", "path");
+	const QCommandLineOption sasaPointsOption("sasa-points", "Number of points per atom for the area reference, 0 disables it. Default is 100.", "n", "100");
+	const QCommandLineOption scratchOption("scratch-mb", "Scratch memory of the extraction in MB. Default is 256.", "mb", "256");
+	const QCommandLineOption resourcesOption("resources", "Path to the resource folder.", "path");
+	const QCommandLineOption formatsOption("formats",
+			"Also writes and reads the extracted frames as chunked .bald and as .csv file and checks the range summaries.");
+	parser.addOption(syntheticOption);
+	parser.addOption(probeOption);
+	parser.addOption(framesOption);
+	parser.addOption(goldenOption);
+	parser.addOption(writeGoldenOption);
+	parser.addOption(sasaPointsOption);
+	parser.addOption(scratchOption);
+	parser.addOption(resourcesOption);
+	parser.addOption(formatsOption);
+	parser.process(a);
+
+	const QStringList args = parser.positionalArguments();
+	const bool synthetic = parser.isSet(syntheticOption);
+	if((synthetic) ? !args.empty() : args.size() != 2){
+		fprintf(stderr, "Either a model and a trajectory or --synthetic are required.\n\n");
+		parser.showHelp(1);
+	}
+	bool ok = false;
+	const float probeRadius = parser.value(probeOption).toFloat(&ok);
+	if(!ok || probeRadius < 0){
+		fprintf(stderr, "Invalid probe radius '%s'.\n", qPrintable(parser.value(probeOption)));
+		return 1;
+	}
+	const int sasaPoints = qMax(0, parser.value(sasaPointsOption).toInt());
+	const size_t scratchMemoryLimit = (size_t) parser.value(scratchOption).toUInt() * 1024u * 1024u;
+
+	//input
+	QSharedPointer<SyntheticProtein> protein;
+	QSharedPointer<Atoms> data;
+	QSharedPointer<TrajectoryStream> stream;
+	Timeline timeline;
+	int numberOfFrames;
+	if(synthetic){
+		const int numberOfAtoms = parser.value(syntheticOption).toInt();
+		if(numberOfAtoms <= 0){
+			fprintf(stderr, "Invalid number of atoms '%s'.\n", qPrintable(parser.value(syntheticOption)));
+			return 1;
+		}
+		protein.reset(new SyntheticProtein(numberOfAtoms));
+		numberOfFrames = (parser.isSet(framesOption)) ? std::numeric_limits<int>::max() : 10;
+	}else{
+		setConfigPath(QDir::homePath()+"/.config/aminoVis");
+		setResourcePath(parser.isSet(resourcesOption) ? parser.value(resourcesOption) : findResourcePath());
+		data.reset(new Atoms(resourcePath()));
+		data->setData(&timeline, nullptr);
+		if(!data->open(args[0], args[1]) || data->numberOfFrames() <= 0){
+			fprintf(stderr, "Failed to open '%s' and '%s'.\n", qPrintable(args[0]), qPrintable(args[1]));
+			return 1;
+		}
+		stream.reset(new TrajectoryStream(nullptr, data->numberOfAtroms(), &data->getOffsets(), data->getStream().getFileName()));
+		numberOfFrames = data->numberOfFrames();
+	}
+	const QVector<Atoms::atom>& model = (synthetic) ? protein->getAtoms() : data->getAtoms();
+
+	int first, last;
+	if(!parseFrameRange(parser.value(framesOption), numberOfFrames, first, last)){
+		fprintf(stderr, "Invalid frame range '%s'.\n", qPrintable(parser.value(framesOption)));
+		return 1;
+	}
+
+	QMap<int, Atoms::layerFrame> golden;
+	if(parser.isSet(goldenOption) && !readGolden(parser.value(goldenOption), model.size(), golden)){
+		fprintf(stderr, "'%s' is not a golden file of a model with %d atoms.\n", qPrintable(parser.value(goldenOption)), model.size());
+		return 1;
+	}
+
+	fprintf(stderr, "Validating frames %d-%d of %d atoms with probe radius %.2f.\n", first, last, model.size(), probeRadius);
+	printf("%8s %8s %9s %10s %10s %10s %10s %10s %10s\n",
+		   "frame", "maxLayer", "time[ms]", "fresh[ms]", "nondeterm", "golden", "area", "areaErr", "notSurface");
+
+	ExtractionContext context(scratchMemoryLimit);
+	QVector<int> frames;
+	QVector<Atoms::layerFrame> results;
+	double totalTime = 0;
+	int failedFrames = 0;
+	for(int f = first; f <= last; f++){
+		const TrajectoryStream::xtcFrame frame = (synthetic) ? protein->getFrame(f) : stream->getFrame(f);
+
+		//like the extraction threads, the context is reused for the following frames
+		Atoms::layerFrame layerframe;
+		QElapsedTimer timer;
+		timer.start();
+		const bool extracted = extractSurface(model, frame, QVector<float>()<<probeRadius, QVector<Atoms::layerFrame*>()<<&layerframe, context,
+											  regionOfInterest(), sasaPoints);
+		const double time = timer.nsecsElapsed()/1000000.0;
+		totalTime += time;
+
+		//the result may not depend on the previous frames
+		Atoms::layerFrame freshframe;
+		ExtractionContext freshContext(scratchMemoryLimit);
+		timer.restart();
+		extractSurface(model, frame, QVector<float>()<<probeRadius, QVector<Atoms::layerFrame*>()<<&freshframe, freshContext,
+					   regionOfInterest(), sasaPoints);
+		const double freshTime = timer.nsecsElapsed()/1000000.0;
+		const int nondeterministic = countMismatches(layerframe, freshframe);
+
+		int goldenMismatches = 0;
+		if(!golden.empty()){
+			auto it = golden.find(f);
+			if(it == golden.end()) goldenMismatches = -1;
+			else{
+				Atoms::layerFrame layersOnly = layerframe;
+				layersOnly.sasa.clear();
+				goldenMismatches = countMismatches(layersOnly, it.value());
+			}
+		}
+
+		areaCheck area;
+		if(sasaPoints > 0) area = checkArea(model, frame, layerframe, probeRadius, context.getSpherePoints(sasaPoints));
+
+		printf("%8d %8d %9.1f %10.1f %10d %10d %10d %10.4f %10d\n", f, layerframe.maxLayer, time, freshTime,
+			   nondeterministic, goldenMismatches, area.mismatches, area.maxError, area.notSurface);
+		fflush(stdout);
+		if(!extracted || nondeterministic || goldenMismatches || area.mismatches || area.notSurface) failedFrames++;
+
+		frames.push_back(f);
+		layerframe.sasa.clear();
+		results.push_back(layerframe);
+	}
+
+	const int count = last-first+1;
+	printf("%d of %d frames passed, average extraction time %.1f ms.\n", count-failedFrames, count, totalTime/count);
+
+	int formatMismatches = 0;
+	if(parser.isSet(formatsOption)){
+		//several chunks and summary blocks with invalid and wide frames
+		const LayerStore layers = repeatFrames(results, model.size(), 4099);
+		QTemporaryDir dir;
+		if(layers.empty() || !dir.isValid()){
+			fprintf(stderr, "Failed to prepare the file format checks.\n");
+			return 1;
+		}
+		const int runs = checkRuns(layers);
+		const int chunked = checkChunked(layers, dir.filePath("layers.bald"));
+		const int csv = checkCsv(layers, dir.filePath("layers.csv"));
+		const int ranges = checkRanges(layers, 1000);
+		printf("Formats of %d frames: runs %d, chunked %d, csv %d, range queries %d mismatches.\n",
+			   layers.numberOfFrames(), runs, chunked, csv, ranges);
+		formatMismatches = runs + chunked + csv + ranges;
+	}
+	if(parser.isSet(writeGoldenOption)){
+		if(!writeGolden(parser.value(writeGoldenOption), probeRadius, model.size(), frames, results)){
+			fprintf(stderr, "Failed to write '%s'.\n", qPrintable(parser.value(writeGoldenOption)));
+			return 1;
+		}
+		fprintf(stderr, "Written '%s'.\n", qPrintable(parser.value(writeGoldenOption)));
+	}
+	return (failedFrames || formatMismatches) ? 1 : 0;
+}
@@ -33,14 +33,43 @@
 #include <QDataStream>
 #include <QXmlStreamReader>
 
-#include <QMessageBox>
-#include <QApplication>
-
 #include <Atoms/Timeline.h>
 #include <Atoms/FilterAtoms.h>
 #include <Atoms/FilterNode.h>
 #include <Atoms/FilterDefinitions.h>
+#include <Atoms/LayerCheckpoint.h>
+#include <Atoms/LayerBytes.h>
 #include <fstream>
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+Atoms::ErrorHandler errorHandler = nullptr;
+
+/// Passes the error to the handler the GUI installed, headless applications only log it.
+void criticalError(const QString& title, const QString& text){
+    if(errorHandler) errorHandler(title, text);
+    else qCritical().noquote() << title << ":" << text;
+}
+
+/// CPK color of elements missing in the color table.
+const quint32 unknownElementColor = 0xffd985f5;
+
+/// Parses a #rrggbb color to 0xAARRGGBB, the layout of QRgb.
+quint32 parseColor(const QString& name){
+    bool ok = false;
+    const quint32 rgb = (name.size() == 7 && name.startsWith('#'))? name.mid(1).toUInt(&ok, 16) : 0;
+    return ok? 0xff000000u | rgb : 0xffffffffu;
+}
+
+/// Memory the residue statistics of the extraction threads may take before they are merged.
+const size_t maxStatisticsPartsBytes = 64u * 1024u * 1024u;
+
+/// Probe radii closer than this are the same, in Angstrom. An absolute tolerance, so a radius of 0 matches itself.
+const float probeRadiusEpsilon = 1e-4f;
+
+}
 
 void Atoms::readAltanativePDBNames(const QString &file) {
     m_alternativeResidueNames.clear();
@@ -58,9 +87,7 @@ void Atoms::readAltanativePDBNames(const QString &file) {
 
             // error handling
             if (xml.hasError()) {
-                QMessageBox::critical(nullptr,
-                                      "XML Parse Error", "File: " + file + "\nError:" + xml.errorString(),
-                                      QMessageBox::Ok);
+                criticalError("XML Parse Error", "File: " + file + "\nError:" + xml.errorString());
                 return;
             }
 
@@ -84,11 +111,9 @@ void Atoms::readAltanativePDBNames(const QString &file) {
                     }
                     //error handling
                     if (residueName.isEmpty()) {
-                        QMessageBox::critical(nullptr,
-                                              "XML Parse Error",
-                                              "File: " + file + "\nError: Residue name not defined at " +
-                                              QString::number(xml.lineNumber()) + "!",
-                                              QMessageBox::Ok);
+                        criticalError("XML Parse Error",
+                                      "File: " + file + "\nError: Residue name not defined at " +
+                                      QString::number(xml.lineNumber()) + "!");
                         return;
                     }
                     //store data
@@ -113,20 +138,16 @@ void Atoms::readAltanativePDBNames(const QString &file) {
                     }
                     //error handling
                     if (residueName.isEmpty()) {
-                        QMessageBox::critical(nullptr,
-                                              "XML Parse Error",
-                                              "File: " + file + "\nError: Residue must have a 'name' attribute, at  " +
-                                              QString::number(xml.lineNumber()) + "!",
-                                              QMessageBox::Ok);
+                        criticalError("XML Parse Error",
+                                      "File: " + file + "\nError: Residue must have a 'name' attribute, at  " +
+                                      QString::number(xml.lineNumber()) + "!");
                         return;
                     }
 
                     if (name.isEmpty()) {
-                        QMessageBox::critical(nullptr,
-                                              "XML Parse Error",
-                                              "File: " + file + "\nError: Atom tag must have a 'name' attribute, at " +
-                                              QString::number(xml.lineNumber()) + "!",
-                                              QMessageBox::Ok);
+                        criticalError("XML Parse Error",
+                                      "File: " + file + "\nError: Atom tag must have a 'name' attribute, at " +
+                                      QString::number(xml.lineNumber()) + "!");
                         return;
                     }
 
@@ -157,9 +178,7 @@ void Atoms::readBonds(const QString &file) {
 
             // error handling
             if (xml.hasError()) {
-                QMessageBox::critical(nullptr,
-                                      "XML Parse Error", "File: " + file + "\nError:" + xml.errorString(),
-                                      QMessageBox::Ok);
+                criticalError("XML Parse Error", "File: " + file + "\nError:" + xml.errorString());
                 return;
             }
 
@@ -175,11 +194,9 @@ void Atoms::readBonds(const QString &file) {
                     }
                     //error handling
                     if (residueName.isEmpty()) {
-                        QMessageBox::critical(nullptr,
-                                              "XML Parse Error",
-                                              "File: " + file + "\nError: Residue must have a 'name' attribute, at " +
-                                              QString::number(xml.lineNumber()) + "!",
-                                              QMessageBox::Ok);
+                        criticalError("XML Parse Error",
+                                      "File: " + file + "\nError: Residue must have a 'name' attribute, at " +
+                                      QString::number(xml.lineNumber()) + "!");
                         return;
                     }
 
@@ -198,20 +215,16 @@ void Atoms::readBonds(const QString &file) {
                     }
                     //error handling
                     if (residueName.isEmpty()) {
-                        QMessageBox::critical(nullptr,
-                                              "XML Parse Error", "File: " + file +
-                                                                 "\nError: 'Bond' tag must be inside 'Residue' tag at  " +
-                                                                 QString::number(xml.lineNumber()) + "!",
-                                              QMessageBox::Ok);
+                        criticalError("XML Parse Error", "File: " + file +
+                                      "\nError: 'Bond' tag must be inside 'Residue' tag at  " +
+                                      QString::number(xml.lineNumber()) + "!");
                         return;
                     }
 
                     if (from.isEmpty() || from.isEmpty()) {
-                        QMessageBox::critical(nullptr,
-                                              "XML Parse Error", "File: " + file +
-                                                                 "\nError: Bond tag must have a 'from' and 'to' attribute, at " +
-                                                                 QString::number(xml.lineNumber()) + "!",
-                                              QMessageBox::Ok);
+                        criticalError("XML Parse Error", "File: " + file +
+                                      "\nError: Bond tag must have a 'from' and 'to' attribute, at " +
+                                      QString::number(xml.lineNumber()) + "!");
                         return;
                     }
 
@@ -239,9 +252,7 @@ void Atoms::readFullNames(const QString &file) {
 
             // error handling
             if (xml.hasError()) {
-                QMessageBox::critical(nullptr,
-                                      "XML Parse Error", "File: " + file + "\nError:" + xml.errorString(),
-                                      QMessageBox::Ok);
+                criticalError("XML Parse Error", "File: " + file + "\nError:" + xml.errorString());
                 return;
             }
 
@@ -261,11 +272,9 @@ void Atoms::readFullNames(const QString &file) {
                     }
 
                     if (shortName.isEmpty() || name.isEmpty()) {
-                        QMessageBox::critical(nullptr,
-                                              "XML Parse Error", "File: " + file +
-                                                                 "\nError: Residue tag must have a 'short' and 'name' attribute, at " +
-                                                                 QString::number(xml.lineNumber()) + "!",
-                                              QMessageBox::Ok);
+                        criticalError("XML Parse Error", "File: " + file +
+                                      "\nError: Residue tag must have a 'short' and 'name' attribute, at " +
+                                      QString::number(xml.lineNumber()) + "!");
                         return;
                     }
 
@@ -290,9 +299,7 @@ void Atoms::readElementColorsAndVdW(const QString &file) {
 
             // error handling
             if (xml.hasError()) {
-                QMessageBox::critical(nullptr,
-                                      "XML Parse Error", "File: " + file + "\nError:" + xml.errorString(),
-                                      QMessageBox::Ok);
+                criticalError("XML Parse Error", "File: " + file + "\nError:" + xml.errorString());
                 return;
             }
 
@@ -315,14 +322,12 @@ void Atoms::readElementColorsAndVdW(const QString &file) {
                     }
 
                     if (name.isEmpty()) {
-                        QMessageBox::critical(nullptr,
-                                              "XML Parse Error", "File: " + file +
-                                                                 "\nError: Element tag must have a 'name' attribute, at " +
-                                                                 QString::number(xml.lineNumber()) + "!",
-                                              QMessageBox::Ok);
+                        criticalError("XML Parse Error", "File: " + file +
+                                      "\nError: Element tag must have a 'name' attribute, at " +
+                                      QString::number(xml.lineNumber()) + "!");
                         return;
                     }
-                    m_elemetColorsAndVdW[name] = {QColor(color), vdw / ((float) 100)};
+                    m_elemetColorsAndVdW[name] = {parseColor(color), vdw / ((float) 100)};
                 }
             }
         } //while loop
@@ -356,6 +361,7 @@ void Atoms::completeModel() {
             if (it3 != it2.value().end()) a.name = it3.value();
         }
     }
+    updateSolvent();
 
     //build bounds
     //https://github.com/mdtraj/mdtraj/blob/74ea04dfc6c356cb1c5cd3c2b8944f9be745cefa/mdtraj/core/topology.py#L790
@@ -406,6 +412,21 @@ void Atoms::completeModel() {
     emit onModelDataChanged();
 }
 
+void Atoms::setSolventResidues(const QStringList &residues) {
+    m_solventResidues = residues;
+    if (m_model.empty()) return;
+    updateSolvent();
+    emit onModelDataChanged();
+}
+
+void Atoms::updateSolvent() {
+    for (atom &a: m_model)
+        a.solvent = m_solventResidues.contains(a.residue, Qt::CaseInsensitive);
+    m_waterCount = 0;
+    for (int start: m_groupStartIDs)
+        if (m_model[start].solvent) m_waterCount++;
+}
+
 Atoms::Atoms(const QString &resourcePath, QObject *parent) : QAbstractItemModel(parent), m_trajectoryStream(this) {
     readAltanativePDBNames(resourcePath + "/data/pdbNames.xml");
     readBonds(resourcePath + "/data/residues.xml");
@@ -413,6 +434,10 @@ Atoms::Atoms(const QString &resourcePath, QObject *parent) : QAbstractItemModel(
     readElementColorsAndVdW(resourcePath + "/data/cpkAndVdW.xml");
 }
 
+void Atoms::setErrorHandler(ErrorHandler handler) {
+    errorHandler = handler;
+}
+
 void Atoms::setData(Timeline *timeline, FilterAtomsListModel *filters) {
     m_timeline = timeline;
     m_filterAtomsListModel = filters;
@@ -442,7 +467,7 @@ bool Atoms::openPBD(const QString &path) {
     QAbstractItemModel::beginResetModel();
     clear();
     QAbstractItemModel::endResetModel();
-    QApplication::processEvents();
+    QCoreApplication::processEvents();
     QAbstractItemModel::beginResetModel();
 
     bool modelMode = false; //are we inside a model TAG
@@ -454,7 +479,7 @@ bool Atoms::openPBD(const QString &path) {
     unsigned int protainID = 0;
     unsigned int currentProtainID = 9999999;
     while (!in.atEnd()) {
-        QApplication::processEvents();
+        QCoreApplication::processEvents();
 
         QString line = in.readLine().trimmed();
         line_number++;
@@ -466,7 +491,7 @@ bool Atoms::openPBD(const QString &path) {
         if (line.startsWith("MODEL")) { //model tag start
             modelMode = true;
             m_model.clear();
-            m_layers.clear();
+            resetLayerSets(0);
             m_groupStartIDs.clear();
             m_proteinStartIDs.clear();
             continue;
@@ -518,8 +543,8 @@ bool Atoms::openPBD(const QString &path) {
                 return false;
             }
 
-            QPair<QColor, float> atomInfo = m_elemetColorsAndVdW.value(parameters[parameters.size() - 1],
-                                                                       {QColor("#d985f5"), 1});
+            QPair<quint32, float> atomInfo = m_elemetColorsAndVdW.value(parameters[parameters.size() - 1],
+                                                                        {unknownElementColor, 1});
 
             //make group ID always increase and unique
             const unsigned int readGroupID = parameters[5].toUInt();
@@ -532,14 +557,11 @@ bool Atoms::openPBD(const QString &path) {
                     {
                             parameters[2], parameters[parameters.size() - 1], parameters[3], groupID, protainID,
                             glm::vec3(parameters[6].toFloat(), parameters[7].toFloat(), parameters[8].toFloat()),
-                            atomInfo.first, atomInfo.second
+                            atomInfo.first, atomInfo.second, false
                     });
             if (currentGroup != (int) m_model.last().groupID) {
                 m_groupStartIDs.push_back(m_model.size() - 1);
                 currentGroup = (int) m_model.last().groupID;
-                if (m_model.last().residue == "SOL" || m_model.last().residue == "HOH" ||
-                    m_model.last().residue.toLower() == "water")
-                    m_waterCount++;
             }
             if (currentProtainID != protainID) {
                 m_proteinStartIDs.push_back(m_model.size() - 1);
@@ -571,7 +593,7 @@ bool Atoms::openGRO(const QString &path) {
     QAbstractItemModel::beginResetModel();
     clear();
     QAbstractItemModel::endResetModel();
-    QApplication::processEvents();
+    QCoreApplication::processEvents();
     QAbstractItemModel::beginResetModel();
 
     QTextStream in(&file);
@@ -583,7 +605,7 @@ bool Atoms::openGRO(const QString &path) {
 
     m_proteinStartIDs.push_back(0);
     while (line_number < size && !in.atEnd()) {
-        QApplication::processEvents();
+        QCoreApplication::processEvents();
         const QString line = in.readLine();
         if (line.isEmpty()) continue;
         if (line.size() != 68) {
@@ -601,7 +623,7 @@ bool Atoms::openGRO(const QString &path) {
                                         line.mid(36, 8).trimmed()};
 
         const QString element = parameters[2].left(1);
-        const QPair<QColor, float> atomInfo = m_elemetColorsAndVdW.value(element, {QColor("#d985f5"), 1});
+        const QPair<quint32, float> atomInfo = m_elemetColorsAndVdW.value(element, {unknownElementColor, 1});
 
         bool ok;
         const unsigned int groupID = parameters[0].toUInt(&ok);
@@ -615,16 +637,12 @@ bool Atoms::openGRO(const QString &path) {
                         parameters[2], element, parameters[1], groupID, 0,
                         glm::vec3(parameters[4].toFloat() * 10.f, parameters[5].toFloat() * 10.f,
                                   parameters[6].toFloat() * 10.f),
-                        atomInfo.first, atomInfo.second
+                        atomInfo.first, atomInfo.second, false
                 });
 
         if (groupID != currentGroupID) {
             m_groupStartIDs.push_back(m_model.size() - 1);
             currentGroupID = groupID;
-            if (m_model.last().residue == "SOL" || m_model.last().residue == "HOH" ||
-                m_model.last().residue.toLower() == "water") {
-                m_waterCount++;
-            }
         }
     }
 
@@ -664,7 +682,7 @@ bool Atoms::openXTC(const QString &path) {
     }
 
 
-    m_layers.clear();
+    resetLayerSets(0);
     m_frameOffsets.clear();
 
     //reading each frame offset
@@ -673,7 +691,7 @@ bool Atoms::openXTC(const QString &path) {
         QDataStream stream(&file);
 
         while (!stream.atEnd()) {
-            QApplication::processEvents();
+            QCoreApplication::processEvents();
             int magic;
             stream >> magic;
             if (magic != 1995) break;
@@ -690,7 +708,12 @@ bool Atoms::openXTC(const QString &path) {
     }
     file.close();
 
-    m_layers.resize(m_frameOffsets.size());
+    if (!resetLayerSets(m_frameOffsets.size())) {
+        QAbstractItemModel::endResetModel();
+        clear();
+        qDebug() << "[ERROR]: Not enough memory for the layers of" << m_frameOffsets.size() << "frames!";
+        return false;
+    }
     if (m_frameOffsets.empty() || !m_trajectoryStream.open(path, numberOfAtroms, &m_frameOffsets)) {
         QAbstractItemModel::endResetModel();
         clear();
@@ -708,120 +731,156 @@ bool Atoms::open(const QString &modelPath, const QString &xtcPath) {
     return openModel(modelPath) && openXTC(xtcPath);
 }
 
-bool Atoms::exportLayerData(const QString &path, float sasRadius) const {
-    if (m_layers.empty() || path.isEmpty()) return false;
+bool Atoms::exportLayerData(const QString &path, float sasRadius, bool atomMajor, bool compressed) const {
+    const LayerStore &frames = getLayers();
+    if (frames.empty() || path.isEmpty()) return false;
     QFileInfo info(path);
     if (info.suffix() == "bald") {
-        auto stream = std::fstream(path.toStdString(), std::ios::out | std::ios::binary);
-        if (stream.is_open()) {
-            unsigned int magicNumber = 1111575620;
-            unsigned int numAtoms = m_model.size();
-            unsigned int numLayers = m_layers.size();
-            stream.write(reinterpret_cast<char *>(&magicNumber), sizeof(magicNumber));
-            stream.write(reinterpret_cast<char *>(&numAtoms), sizeof(numAtoms));
-            stream.write(reinterpret_cast<char *>(&numLayers), sizeof(numLayers));
-            stream.write(reinterpret_cast<char *>(&sasRadius), sizeof(sasRadius));
-            for (const layerFrame &frame: m_layers) {
-                unsigned int maxLayer = frame.maxLayer;
-                stream.write(reinterpret_cast<char *>(&maxLayer), sizeof(maxLayer));
-                if (frame.maxLayer != -1) {
-                    std::vector<char> layers;
-                    layers.reserve(m_model.size());
-                    for (float l: frame.layers) layers.push_back((char) l); //reduce each layer to one char
-                    stream.write((char *) layers.data(), m_model.size());
-                }
-            }
-            return true;
-        }
-        stream.close();
+        //version 2, raw files can be mapped on import
+        return frames.save(path, sasRadius, (atomMajor) ? layerFileHeader::AtomMajor : layerFileHeader::FrameMajor,
+                           (compressed) ? layerFileHeader::Chunked : layerFileHeader::Raw);
     } else if (info.suffix() == "csv") {
         QFile file(path);
         if (file.open(QIODevice::WriteOnly)) {
-            QTextStream stream(&file);
+            QStringList columns;
             for (const atom &a: m_model)
-                stream << a.name << ",";
-            stream << endl;
-            for (const layerFrame &frame: m_layers) {
-                if (frame.maxLayer == -1) {
-                    for (int i = 0; i < m_model.size(); i++)
-                        stream << ",";
-                } else {
-                    for (float f: frame.layers)
-                        stream << f << ",";
-                }
-                stream << endl;
-            }
+                columns << a.name;
+            const bool written = frames.writeCsv(file, columns);
             file.close();
-            return true;
+            return written;
         }
     }
     return false;
 }
 
+bool Atoms::exportSASA(const QString &path, bool perResidue) const {
+    const LayerStore &frames = getLayers();
+    if (path.isEmpty() || !frames.hasSASA())
+        return false;
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    QTextStream stream(&file);
+    if (perResidue) {
+        for (int g = 0; g < numberOfGroups(); g++)
+            stream << getGroupName(g) << m_model[m_groupStartIDs[g]].groupID << ",";
+    } else {
+        for (const atom &a: m_model)
+            stream << a.name << ",";
+    }
+    stream << endl;
+    for (int f = 0; f < frames.size(); f++) {
+        const int columns = (perResidue) ? numberOfGroups() : m_model.size();
+        for (int i = 0; i < columns; i++) {
+            if (!frames.sasa(f).empty())
+                stream << ((perResidue) ? getGroupSASA(i, f) : frames.sasa(f)[i]);
+            stream << ",";
+        }
+        stream << endl;
+    }
+    file.close();
+    return true;
+}
+
 bool Atoms::importLayerData(const QString &path, float &sasRadiusOut) {
-    if (m_layers.empty() || path.isEmpty()) return false;
+    if (getLayers().empty() || path.isEmpty()) return false;
     QFileInfo info(path);
     if (info.suffix() == "bald") {
+        layerFileHeader header;
+        if (LayerStore::readHeader(path, header)) {
+            //raw files of version 2 are mapped, only the viewed frames are read from disk
+            LayerStore frames;
+            frames.setGroups(m_groupStartIDs);
+            const bool loaded = (header.compression == layerFileHeader::Raw) ? frames.map(path, sasRadiusOut)
+                                                                              : frames.load(path, sasRadiusOut);
+            if (!loaded) return false;
+            if (frames.numberOfAtoms() != m_model.size() || frames.numberOfFrames() != getLayers().size()) {
+                qDebug() << "[importLayerData:" << __LINE__
+                         << "]: Number of atoms or frames is not equal to the loaded data!" << "(" << frames.numberOfAtoms()
+                         << "!=" << m_model.size() << " || " << frames.numberOfFrames() << "!=" << getLayers().size() << ")";
+                return false;
+            }
+            const int set = addLayerSet(sasRadiusOut);
+            if (set < 0) return false;
+            m_layerSets[set].frames = std::move(frames);
+            clearResidueStatistics(set);
+            setActiveLayerSet(set);
+            return true;
+        }
         auto stream = std::ifstream(path.toStdString(), std::ios::in | std::ios::binary);
         if (stream.is_open()) {
-            int magicNumber, numAtoms, numFrames;
+            //version 1, all fields are 32 bit and the max layer of an invalid frame is -1
+            quint32 magicNumber = 0, numAtoms = 0, numFrames = 0;
             stream.read(reinterpret_cast<char *>(&magicNumber), sizeof(magicNumber));
             stream.read(reinterpret_cast<char *>(&numAtoms), sizeof(numAtoms));
             stream.read(reinterpret_cast<char *>(&numFrames), sizeof(numFrames));
             stream.read(reinterpret_cast<char *>(&sasRadiusOut), sizeof(sasRadiusOut));
 
-            if (magicNumber != 1111575620 || numAtoms <= 0 || numFrames <= 0 || sasRadiusOut <= 0) {
+            if (!stream || magicNumber != layerFileMagicV1 || numAtoms == 0 || numFrames == 0 || sasRadiusOut <= 0) {
                 qDebug() << "[importLayerData:" << __LINE__ << "]: Header invalid!";
                 return false;
             }
-            if (numAtoms != m_model.size() || numFrames != m_layers.size()) {
+            if (numAtoms != (quint32) m_model.size() || numFrames != (quint32) getLayers().size()) {
                 qDebug() << "[importLayerData:" << __LINE__
                          << "]: Number of atoms or frames is not equal to the loaded data!" << "(" << numAtoms << "!="
-                         << m_model.size() << " || " << numFrames << "!=" << m_layers.size() << ")";
+                         << m_model.size() << " || " << numFrames << "!=" << getLayers().size() << ")";
                 return false;
             }
 
-            for (layerFrame &frame: m_layers) {
-                unsigned int maxLayer;
+            //the data is imported as the layer set of its probe radius
+            const int set = addLayerSet(sasRadiusOut);
+            if (set < 0) return false;
+            LayerStore &frames = m_layerSets[set].frames;
+            std::vector<char> layers;
+            for (int f = 0; f < frames.size(); f++) {
+                qint32 maxLayer = -1;
                 stream.read(reinterpret_cast<char *>(&maxLayer), sizeof(maxLayer));
-                frame.maxLayer = maxLayer;
-                frame.layers.clear();
-                if (frame.maxLayer != -1) {
-                    std::vector<char> layers(m_model.size());
-                    stream.read((char *) layers.data(), m_model.size());
-                    frame.layers.reserve(m_model.size());
-                    frame.layers = QVector<float>(layers.begin(), layers.end());
+                if (maxLayer >= 0) {
+                    layers.resize(m_model.size() * bytesPerLayer(maxLayer));
+                    stream.read((char *) layers.data(), layers.size());
+                }
+                if (!stream || maxLayer > 65535) {
+                    qDebug() << "[importLayerData:" << __LINE__ << "]: File ends or is damaged at frame " << f << "!";
+                    frames.invalidate(f);
+                    break;
                 }
+                frames.decode(f, maxLayer, layers.data()); //stored as is, the store has the same byte layout
             }
+            clearResidueStatistics(set);
+            setActiveLayerSet(set);
 
             return true;
         }
     } else if (info.suffix() == "csv") {
         QFile file(path);
         if (file.open(QIODevice::ReadOnly)) {
-            QTextStream stream(&file);
-            stream.readLine();//skipline
-            auto it = m_layers.begin();
             sasRadiusOut = 1.0f;
-            while (!stream.atEnd() && it != m_layers.end()) {
-                QString line = stream.readLine();
-                float maxLayer = -1;
-                const QStringList list = line.split(QRegExp(",|;"), QString::SkipEmptyParts);
-                it->layers.clear();
-                if (list.size() == m_model.size()) {
-                    it->layers.reserve(m_model.size());
-                    for (const QString &str: list) {
-                        const float v = str.toFloat();
-                        it->layers.push_back(v);
-                        if (v > maxLayer) maxLayer = v;
-                    }
-                }
-                it->maxLayer = maxLayer;
-                it++;
-            }
+            const int set = addLayerSet(sasRadiusOut);
+            if (set < 0) return false;
+            m_layerSets[set].frames.readCsv(file);
+            clearResidueStatistics(set);
+            setActiveLayerSet(set);
 
             return true;
         }
+    } else if (info.suffix() == "balc") {
+        //shards are merged into the layer set of their probe radius
+        LayerStore frames;
+        QByteArray identity;
+        if (!frames.reset(m_model.size(), getLayers().size()) ||
+            LayerCheckpoint::read(path, m_model.size(), frames, sasRadiusOut, identity) < 0)
+            return false;
+        //only the whole model of this trajectory can be merged, like the --merge option of the CLI
+        if (identity != LayerCheckpoint::identity(*this, sasRadiusOut, regionOfInterest())) {
+            criticalError("Import Error", "File: " + path + "\nIt was not extracted from the whole model and this trajectory.");
+            return false;
+        }
+        const int set = addLayerSet(sasRadiusOut);
+        if (set < 0) return false;
+        m_layerSets[set].frames.merge(frames);
+        clearResidueStatistics(set);
+        setActiveLayerSet(set);
+
+        return true;
     }
 
     return false;
@@ -884,20 +943,263 @@ const TrajectoryStream::xtcFrame &Atoms::getCurrentFrame() const {
     return m_trajectoryStream.getCurrentFrame();
 }
 
-Atoms::layerFrame &Atoms::getLayer(unsigned int i) {
-    return m_layers[i];
+LayerStore &Atoms::getLayers() {
+    return m_layerSets[m_activeLayerSet].frames;
 }
 
-const Atoms::layerFrame &Atoms::getLayer(unsigned int i) const {
-    return m_layers[i];
+const LayerStore &Atoms::getLayers() const {
+    return m_layerSets[m_activeLayerSet].frames;
 }
 
-QVector<Atoms::layerFrame> &Atoms::getLayers() {
-    return m_layers;
+bool Atoms::buildLayerColumns() {
+    layerSet &set = m_layerSets[m_activeLayerSet];
+    if (set.frames.isMapped() || set.frames.layout() == layerFileHeader::AtomMajor || !set.frames.anyValid()) {
+        set.columns = LayerStore();
+        return false;
+    }
+    if (set.columns.empty() || set.columns.revision() != set.frames.revision())
+        set.columns = set.frames.transposed();
+    return !set.columns.empty();
+}
+
+const LayerStore &Atoms::getLayerColumns() const {
+    const layerSet &set = m_layerSets[m_activeLayerSet];
+    //an outdated copy is ignored until it is built again
+    if (!set.columns.empty() && set.columns.revision() == set.frames.revision())
+        return set.columns;
+    return set.frames;
+}
+
+bool Atoms::buildLayerRanges() {
+    layerSet &set = m_layerSets[m_activeLayerSet];
+    const LayerStore &frames = set.frames;
+    if (!frames.anyValid()) {
+        set.atomRanges.clear();
+        set.groupRanges.clear();
+        return false;
+    }
+    if (!set.atomRanges.empty() && set.rangesRevision == frames.revision()) return true;
+
+    std::vector<char> valid(frames.size()), groupValid(frames.size());
+    for (int f = 0; f < frames.size(); f++) {
+        valid[f] = frames.isValid(f);
+        groupValid[f] = frames.maxLayer(f) > 0; //like getGroupLayerAvarage
+    }
+    set.atomRanges.build(numberOfAtroms(), valid, [&frames](int frame, QVector<float> &values) {
+        frames.fill(frame, values);
+    });
+    set.groupRanges.build(numberOfGroups(), groupValid, [this, &frames](int frame, QVector<float> &values) {
+        values.resize(numberOfGroups());
+        for (int groupIndex = 0; groupIndex < numberOfGroups(); groupIndex++)
+            values[groupIndex] = frames.groupAverage(frame, groupIndex);
+    });
+    set.rangesRevision = frames.revision();
+    return true;
+}
+
+LayerRanges::range Atoms::getAtomLayerRange(int atomIndex, int first, int last) const {
+    const layerSet &set = m_layerSets[m_activeLayerSet];
+    const LayerStore &layers = getLayerColumns();
+    LayerRanges::range range;
+    if (atomIndex < 0 || atomIndex >= numberOfAtroms()) return range;
+    auto value = [&layers, atomIndex](int frame) { return (float) layers.layer(frame, atomIndex); };
+    if (!set.atomRanges.empty() && set.rangesRevision == set.frames.revision())
+        return set.atomRanges.query(atomIndex, first, last, value);
+    for (int f = qMax(first, 0); f < qMin(last, layers.size()); f++)
+        if (layers.isValid(f)) range.add(value(f));
+    return range;
+}
+
+LayerRanges::range Atoms::getGroupLayerRange(int groupIndex, int first, int last) const {
+    const layerSet &set = m_layerSets[m_activeLayerSet];
+    LayerRanges::range range;
+    if (groupIndex < 0 || groupIndex >= numberOfGroups()) return range;
+    auto value = [this, groupIndex](int frame) { return getGroupLayerAvarage(groupIndex, frame); };
+    if (!set.groupRanges.empty() && set.rangesRevision == set.frames.revision())
+        return set.groupRanges.query(groupIndex, first, last, value);
+    for (int f = qMax(first, 0); f < qMin(last, getLayers().size()); f++) {
+        const float v = value(f);
+        if (v >= 0) range.add(v);
+    }
+    return range;
+}
+
+void Atoms::updateLayerSummaries() {
+    layerSet &set = m_layerSets[m_activeLayerSet];
+    const LayerStore &frames = set.frames;
+    //the revisions only grow, so the frames written since a copy was made have a later revision than the copy
+    auto writtenSince = [&frames](quint64 revision) {
+        std::vector<int> written;
+        for (int f = 0; f < frames.size(); f++)
+            if (frames.revision(f) > revision) written.push_back(f);
+        return written;
+    };
+
+    const std::vector<int> newColumns = (set.columns.empty()) ? std::vector<int>() : writtenSince(set.columns.revision());
+    if (!set.columns.empty() && set.columns.size() == frames.size() &&
+        std::all_of(newColumns.begin(), newColumns.end(), [&set](int f) {
+            return set.frames.isValid(f) && !set.columns.isValid(f);
+        }))
+        set.columns.copyFrames(frames, newColumns);
+    else
+        buildLayerColumns();
+
+    const std::vector<int> newRanges = (set.atomRanges.empty()) ? std::vector<int>() : writtenSince(set.rangesRevision);
+    if (!set.atomRanges.empty() && set.atomRanges.numberOfFrames() == frames.size() &&
+        std::all_of(newRanges.begin(), newRanges.end(), [&set](int f) {
+            return set.frames.isValid(f) && !set.atomRanges.isValid(f);
+        })) {
+        QVector<float> values;
+        for (int f: newRanges) {
+            frames.fill(f, values);
+            set.atomRanges.addFrame(f, values);
+            if (frames.maxLayer(f) <= 0) continue; //like getGroupLayerAvarage
+            values.resize(numberOfGroups());
+            for (int groupIndex = 0; groupIndex < numberOfGroups(); groupIndex++)
+                values[groupIndex] = frames.groupAverage(f, groupIndex);
+            set.groupRanges.addFrame(f, values);
+        }
+        set.rangesRevision = frames.revision();
+    } else
+        buildLayerRanges();
+
+    buildResidueStatistics();
+}
+
+void Atoms::addResidueStatistics(int set, const ResidueStatistics &part) {
+    if (part.empty()) return;
+    QMutexLocker locker(&m_statisticsMutex);
+    if (set < 0 || set >= m_layerSets.size()) return;
+    QList<ResidueStatistics> &parts = m_layerSets[set].statisticsParts;
+    for (int i = parts.size() - 1; i >= 0; i--)
+        if (parts[i].overlaps(part)) parts.removeAt(i);
+    //neighbouring blocks of the threads are merged right away, so there are only a few parts, merging into the
+    //part before doesn't keep a copy of the part, so the thread can reuse its memory
+    int left = -1, right = -1;
+    for (int i = 0; i < parts.size(); i++) {
+        if (parts[i].lastFrame() + 1 == part.firstFrame()) left = i;
+        else if (part.lastFrame() + 1 == parts[i].firstFrame()) right = i;
+    }
+    if (left >= 0) {
+        parts[left].merge(part);
+        if (right >= 0) {
+            parts[left].merge(parts[right]);
+            parts.removeAt(right);
+        }
+    } else if (right >= 0) {
+        ResidueStatistics joined = part;
+        joined.merge(parts[right]);
+        parts[right] = std::move(joined);
+    } else
+        parts.push_back(part);
+    //too many separate parts are dropped, buildResidueStatistics() reads the frames instead
+    if ((size_t) parts.size() * numberOfGroups() * sizeof(ResidueStatistics::residue) > maxStatisticsPartsBytes)
+        parts.clear();
+}
+
+bool Atoms::buildResidueStatistics() {
+    layerSet &set = m_layerSets[m_activeLayerSet];
+    const LayerStore &frames = set.frames;
+    QList<ResidueStatistics> parts;
+    {
+        QMutexLocker locker(&m_statisticsMutex);
+        parts.swap(set.statisticsParts);
+    }
+    if (!frames.anyValid()) {
+        set.statistics = ResidueStatistics();
+        return false;
+    }
+    if (!set.statistics.empty() && set.statisticsRevision == frames.revision() && parts.empty()) return true;
+
+    int valid = 0;
+    for (int f = 0; f < frames.size(); f++)
+        if (frames.isValid(f)) valid++;
+    //the earlier statistics are kept if no thread extracted their frames again
+    if (!set.statistics.empty() && std::none_of(parts.begin(), parts.end(), [&set](const ResidueStatistics &part) {
+            return part.overlaps(set.statistics);
+        }))
+        parts.push_back(set.statistics);
+    ResidueStatistics statistics = ResidueStatistics::merged(parts);
+    if (statistics.numberOfFrames() != valid || statistics.numberOfGroups() != numberOfGroups()) {
+        statistics = ResidueStatistics(m_groupStartIDs, m_model.size());
+        QVector<float> layers;
+        for (int f = 0; f < frames.size(); f++) {
+            if (!frames.isValid(f)) continue;
+            frames.fill(f, layers);
+            statistics.addFrame(f, frames.maxLayer(f), layers);
+        }
+    }
+    set.statistics = std::move(statistics);
+    set.statisticsRevision = frames.revision();
+    return true;
+}
+
+ResidueStatistics::residue Atoms::getGroupStatistics(int groupIndex) const {
+    return m_layerSets[m_activeLayerSet].statistics.get(groupIndex);
+}
+
+void Atoms::clearResidueStatistics(int set) {
+    QMutexLocker locker(&m_statisticsMutex);
+    m_layerSets[set].statisticsParts.clear();
+    m_layerSets[set].statistics = ResidueStatistics();
 }
 
-const QVector<Atoms::layerFrame> &Atoms::getLayers() const {
-    return m_layers;
+int Atoms::numberOfLayerSets() const {
+    return m_layerSets.size();
+}
+
+int Atoms::getActiveLayerSet() const {
+    return m_activeLayerSet;
+}
+
+void Atoms::setActiveLayerSet(int set) {
+    if (set < 0 || set >= m_layerSets.size() || set == m_activeLayerSet) return;
+    m_activeLayerSet = set;
+    emit onLayerSetsChanged();
+}
+
+Atoms::layerSet &Atoms::getLayerSet(int set) {
+    return m_layerSets[set];
+}
+
+const Atoms::layerSet &Atoms::getLayerSet(int set) const {
+    return m_layerSets[set];
+}
+
+int Atoms::addLayerSet(float probeRadius) {
+    for (int i = 0; i < m_layerSets.size(); i++)
+        if (m_layerSets[i].probeRadius >= 0 && qAbs(m_layerSets[i].probeRadius - probeRadius) < probeRadiusEpsilon) return i;
+
+    //reuse a set that was never extracted
+    for (int i = 0; i < m_layerSets.size(); i++) {
+        layerSet &set = m_layerSets[i];
+        if (set.probeRadius < 0 && !set.frames.anyValid()) {
+            set.probeRadius = probeRadius;
+            emit onLayerSetsChanged();
+            return i;
+        }
+    }
+
+    layerSet set;
+    set.probeRadius = probeRadius;
+    set.frames.setGroups(m_groupStartIDs);
+    if (!set.frames.reset(m_model.size(), m_frameOffsets.size())) {
+        qDebug() << "[addLayerSet:" << __LINE__ << "]: Not enough memory for the layers of probe radius" << probeRadius << "!";
+        return -1;
+    }
+    m_layerSets.push_back(std::move(set));
+    emit onLayerSetsChanged();
+    return m_layerSets.size() - 1;
+}
+
+bool Atoms::resetLayerSets(int frames) {
+    m_layerSets.resize(1);
+    m_layerSets[0] = layerSet();
+    m_layerSets[0].frames.setGroups(m_groupStartIDs);
+    const bool allocated = m_layerSets[0].frames.reset(m_model.size(), frames);
+    m_activeLayerSet = 0;
+    emit onLayerSetsChanged();
+    return allocated;
 }
 
 const QString &Atoms::getHeader() const {
@@ -935,9 +1237,8 @@ int Atoms::getAtomsInGroup(int groupIndex) const {
 }
 
 float Atoms::getAtomLayer(int atomIndex, int frame, bool applyFilters, bool isTimeline) const {
-    const Atoms::layerFrame &layerframe = getLayer(frame);
-    if (frame < 0 || frame >= m_layers.size()) return 1.f;
-    if (layerframe.maxLayer <= 0 || layerframe.layers.empty()) return -1.f;
+    if (frame < 0 || frame >= getLayers().size()) return 1.f;
+    if (getLayers().maxLayer(frame) <= 0) return -1.f;
 
     float value = 0;
     bool found = false;
@@ -972,21 +1273,26 @@ float Atoms::getAtomLayer(int atomIndex, int frame, bool applyFilters, bool isTi
         }
     }
     if (found) return value;
-    else return layerframe.layers[atomIndex];
+    else return ((isTimeline) ? getLayerColumns() : getLayers()).layer(frame, atomIndex);
 }
 
 float Atoms::getGroupLayerAvarage(int groupIndex, int frame) const {
-    if (frame < 0 || frame >= m_layers.size()) {
-        //qDebug()<<"["<<__LINE__<<":getGroupLayerAvarage]: frame out of bounds! ("<<frame<<", "<<m_layers.size()<<")";
+    if (frame < 0 || frame >= getLayers().size()) {
+        //qDebug()<<"["<<__LINE__<<":getGroupLayerAvarage]: frame out of bounds! ("<<frame<<", "<<getLayers().size()<<")";
         return -1;
     }
-    if (groupIndex < 0 || groupIndex >= numberOfGroups())
+    if (groupIndex < 0 || groupIndex >= numberOfGroups() || getLayers().maxLayer(frame) <= 0)
         return -1;
+    return getLayers().groupAverage(frame, groupIndex);
+}
 
-    const Atoms::layerFrame &layerframe = getLayer(frame);
-    if (layerframe.maxLayer > 0)
-        return getGroupLayerAvarage(groupIndex, layerframe);
-    return -1;
+float Atoms::getGroupSASA(int groupIndex, int frame) const {
+    if (frame < 0 || frame >= getLayers().size() || groupIndex < 0 || groupIndex >= numberOfGroups())
+        return -1;
+    const QVector<float> &sasa = getLayers().sasa(frame);
+    if (sasa.empty()) return -1;
+    const int end = (groupIndex == m_groupStartIDs.size() - 1) ? m_model.size() : m_groupStartIDs[groupIndex + 1];
+    return std::accumulate(sasa.begin() + m_groupStartIDs[groupIndex], sasa.begin() + end, 0.f);
 }
 
 float Atoms::getGroupLayer(int groupIndex, int frame, bool applyFilters, bool isTimeline) const {
@@ -1027,31 +1333,17 @@ float Atoms::getGroupLayer(int groupIndex, int frame, bool applyFilters, bool is
     else return getGroupLayerAvarage(groupIndex, frame);
 }
 
-float Atoms::getGroupLayerAvarage(int groupIndex, const Atoms::layerFrame &frame) const {
-    QVector<float>::const_iterator end = frame.layers.begin() +
-                                         ((groupIndex == m_groupStartIDs.size() - 1) ? m_model.size() : m_groupStartIDs[
-                                                 groupIndex + 1]);
-    QVector<float>::const_iterator start = frame.layers.begin() + m_groupStartIDs[groupIndex];
-    float avarage = 0;
-    for (auto it = start; it < end; it++) {
-        avarage += *it;
-    }
-    avarage /= end - start;
-
-    //avarage = floor((avarage+0.25f)/0.5f)*0.5f;
-
-    return avarage;
-}
-
-void Atoms::fillGroupLayerAvarage(QVector<float> &avarages, const Atoms::layerFrame &frame) const {
+void Atoms::fillGroupLayerAvarage(QVector<float> &avarages, int frame) const {
     avarages.fill(0.f, numberOfAtroms());
+    const LayerStore &layers = getLayers();
+    if (frame < 0 || frame >= layers.size() || layers.maxLayer(frame) <= 0) return;
 
     for (int groupIndex = 0; groupIndex < m_groupStartIDs.size(); groupIndex++) {
         QVector<float>::iterator end = avarages.begin() +
                                        ((groupIndex == m_groupStartIDs.size() - 1) ? m_model.size() : m_groupStartIDs[
                                                groupIndex + 1]);
 
-        const float avarage = (frame.maxLayer > 0) ? getGroupLayerAvarage(groupIndex, frame) : 0;
+        const float avarage = layers.groupAverage(frame, groupIndex);
         for (auto it = avarages.begin() + m_groupStartIDs[groupIndex]; it < end; it++) {
             *it = avarage;
         }
@@ -1075,7 +1367,7 @@ void Atoms::fillGroupLayer(QVector<float> &avarages, int frame, bool applyFilter
 
 void Atoms::fillAtomLayer(QVector<float> &atomLayers, int frame, bool applyFilters, bool isTimeline) const {
     if (!applyFilters) {
-        atomLayers = getLayer(frame).layers;
+        getLayers().fill(frame, atomLayers);
         return;
     }
     atomLayers.fill(0.f, numberOfAtroms());
@@ -1203,7 +1495,7 @@ void Atoms::clear() {
     m_title.clear();
     m_model.clear();
     m_frameOffsets.clear();
-    m_layers.clear();
+    resetLayerSets(0);
     m_bonds.clear();
     m_groupStartIDs.clear();
     m_proteinStartIDs.clear();
@@ -32,15 +32,19 @@
 #include <QObject>
 #include <QAbstractItemModel>
 #include <QString>
+#include <QStringList>
 #include <QVector>
 #include <QList>
-#include <QColor>
 #include <QDebug>
 #include <glm/glm.hpp>
 #include <Util/AABB.h>
 #include <Atoms/TrajectoryStream.h>
+#include <Atoms/LayerStore.h>
+#include <Atoms/LayerRanges.h>
+#include <Atoms/ResidueStatistics.h>
 
 #include <xdrfile_xtc.h>
+#include <QMutex>
 #include <limits>
 
 class Timeline;
@@ -74,13 +78,29 @@ public:
         unsigned int groupID; /// The residue ID.
         unsigned int proteinID;
         glm::vec3 position; /// Orthogonal position in Angstroms.
-        QColor color;
+        quint32 color; /// CPK color as 0xAARRGGBB (the layout of QRgb)
         float radius;
+        bool solvent; /// True if the residue is part of the solvent, see setSolventResidues()
     };
 
+    /// The layers of one frame while it is extracted or transferred, the layer sets store them compactly in a LayerStore.
     struct layerFrame {
         int maxLayer = -1;
         QVector<float> layers;
+        QVector<float> sasa; /// Solvent accessible surface area of each atom in square Angstroms, empty if not computed
+    };
+
+    /// The layers of all frames extracted with one probe radius.
+    struct layerSet {
+        float probeRadius = -1.f; /// Probe radius used for the extraction, negative if unknown
+        LayerStore frames; /// Also keeps the average layer of each residue per frame, see LayerStore::setGroups
+        LayerStore columns; /// Atom-major copy of frames for reading atoms over time, empty if not built
+        LayerRanges atomRanges; /// Summaries of the layer of each atom over time, empty if not built
+        LayerRanges groupRanges; /// Summaries of the average layer of each residue over time, empty if not built
+        quint64 rangesRevision = 0; /// Revision of frames the summaries were built from
+        QList<ResidueStatistics> statisticsParts; /// Statistics of the frame ranges of the extraction threads, not merged yet
+        ResidueStatistics statistics; /// Statistics of each residue over all valid frames, empty if not built
+        quint64 statisticsRevision = 0; /// Revision of frames the statistics were built from
     };
 
     /// Custom roles for QML data access
@@ -96,6 +116,15 @@ public:
 
     Atoms(const QString &resourcePath = "resources", QObject *parent = nullptr);
 
+    /// Shows an error the user has to see, e.g. a message box in the GUI.
+    typedef void (*ErrorHandler)(const QString &title, const QString &text);
+
+    /*!
+     * @brief Sets the handler of errors while reading the resource and layer files.
+     * The library only depends on QtCore, without a handler the errors are logged with qCritical.
+     */
+    static void setErrorHandler(ErrorHandler handler);
+
     void setData(Timeline *timeline, FilterAtomsListModel *filters);
 
     /*!
@@ -138,11 +167,29 @@ public:
 
     /*!
      * @brief Can export the atom layer data as .bin (binary format) or as .csv (Comma-separated values).
+     * .bald files are written in version 2 (see layerFileHeader), which can be mapped on import.
+     * @param atomMajor If true, a .bald file stores the frames of each atom next to each other, which is faster
+     * for reading atoms over time, e.g., in the timeline, than for rendering frames.
+     * @param compressed If true, a .bald file is chunked and compressed, which is a lot smaller but can't be mapped.
+     * Compressed files are always frame-major.
      */
-    Q_INVOKABLE bool exportLayerData(const QString &path, float sasRadius = 1.0) const;
+    Q_INVOKABLE bool exportLayerData(const QString &path, float sasRadius = 1.0, bool atomMajor = false, bool compressed = false) const;
+    /*!
+     * @brief Exports the solvent accessible surface area of each frame as .csv (Comma-separated values).
+     * @param perResidue If true, one column per residue with the summed area of its atoms, otherwise one column per atom.
+     * @returns false if no area was computed or the file can't be written.
+     */
+    bool exportSASA(const QString &path, bool perResidue) const;
     /*!
      * @brief Can import the exported atom layer data as .bin (binary format) or as .csv (Comma-separated values).
+     * A raw .bald file of version 2 is memory mapped instead of read, so it doesn't have to fit into memory,
+     * a compressed one is decompressed into memory.
+     * Frames extracted afterwards are only kept in memory, the file isn't changed.
+     * A checkpoint or shard (.balc) only replaces the frames it contains, so importing
+     * all shards of a distributed extraction one after another merges them,
+     * it is rejected if it was extracted from another model, trajectory or a region of interest.
      * @see exportLayerData
+     * @see LayerCheckpoint
      */
     Q_INVOKABLE bool importLayerData(const QString &path, float &sasRadiusOut);
 
@@ -175,16 +222,101 @@ public:
 
     const TrajectoryStream::xtcFrame &getCurrentFrame() const;
 
-    Atoms::layerFrame &getLayer(unsigned int i);
+    /// @returns The layers of all frames of the active layer set.
+    LayerStore &getLayers();
+
+    const LayerStore &getLayers() const;
 
-    const Atoms::layerFrame &getLayer(unsigned int i) const;
+    /*!
+     * @brief Builds an atom-major copy of the active layer set, so the frames of an atom are next to each other in memory.
+     * The copy needs as much memory as the layers, so it isn't built for mapped layers.
+     * @returns false if the copy wasn't built.
+     * @see getLayerColumns
+     */
+    bool buildLayerColumns();
 
-    QVector<Atoms::layerFrame> &getLayers();
+    /*!
+     * @returns The active layers in atom-major order, if they are stored like that or buildLayerColumns() was called
+     * since the last change, otherwise getLayers(). Used to read one atom or residue over many frames.
+     */
+    const LayerStore &getLayerColumns() const;
 
-    const QVector<Atoms::layerFrame> &getLayers() const;
+    /*!
+     * @brief Builds summaries of the active layer set over time, so the min, max and mean layer of an atom or residue
+     * over a frame range don't have to read every frame. Reads all frames once.
+     * @returns false if there are no layers.
+     * @see getAtomLayerRange
+     */
+    bool buildLayerRanges();
+
+    /*!
+     * @brief Min, max and mean layer of an atom over the frames first to last-1, invalid frames are skipped.
+     * Uses the summaries of buildLayerRanges() if they are up to date, otherwise reads every frame.
+     */
+    LayerRanges::range getAtomLayerRange(int atomIndex, int first, int last) const;
+
+    /// Like getAtomLayerRange for the average layer of a residue, frames where getGroupLayerAvarage is -1 are skipped.
+    LayerRanges::range getGroupLayerRange(int groupIndex, int first, int last) const;
+
+    /*!
+     * @brief Hands the statistics of the frames an extraction thread accumulated to a layer set, they are merged by
+     * buildResidueStatistics(). Parts of the same frames as an earlier part replace it, parts of neighbouring frames
+     * are merged. Can be called from any thread.
+     */
+    void addResidueStatistics(int set, const ResidueStatistics &part);
+
+    /*!
+     * @brief Builds the mean depth, variance, fraction of time on the surface and surface transitions of each residue
+     * for the active layer set. Merges the parts of the extraction threads if they cover all valid frames,
+     * otherwise reads all frames once.
+     * @returns false if there are no layers.
+     * @see getGroupStatistics
+     */
+    bool buildResidueStatistics();
+
+    /// @returns The statistics of a residue as of the last buildResidueStatistics(), with 0 frames if they weren't built.
+    ResidueStatistics::residue getGroupStatistics(int groupIndex) const;
+
+    /*!
+     * @brief Brings the copies and summaries of the active layer set up to date after single frames were extracted.
+     * Frames that were invalid before are added to the atom-major copy and the range summaries, which are only built
+     * again if other frames changed. The residue statistics are built again, their frames have to be added in order.
+     */
+    void updateLayerSummaries();
+
+    /*!
+     * @brief Each probe radius has its own set of layers, only the active set is seen by getLayers().
+     * Once a trajectory is loaded there is always at least one set.
+     */
+    int numberOfLayerSets() const;
+
+    int getActiveLayerSet() const;
+
+    /// Switches the layers seen by getLayers(), without recomputing anything.
+    void setActiveLayerSet(int set);
+
+    Atoms::layerSet &getLayerSet(int set);
+
+    const Atoms::layerSet &getLayerSet(int set) const;
+
+    /*!
+     * @brief Finds the layer set of the given probe radius, or creates an empty one.
+     * An unused set without a probe radius is reused.
+     * @returns Index of the layer set, -1 if there isn't enough memory for its layers.
+     */
+    int addLayerSet(float probeRadius);
 
     inline int getWaterCount() const { return m_waterCount; }
 
+    /*!
+     * @brief Sets the residue names that are treated as solvent (case insensitive), by default SOL, HOH and water.
+     * The solvent flag of each atom is computed once when a model is loaded or the names change.
+     * Solvent atoms are skipped by the surface extraction.
+     */
+    void setSolventResidues(const QStringList &residues);
+
+    inline const QStringList &getSolventResidues() const { return m_solventResidues; }
+
     inline const QVector<unsigned int> &getOffsets() const { return m_frameOffsets; };
 
     inline const TrajectoryStream &getStream() const { return m_trajectoryStream; };
@@ -208,16 +340,19 @@ public:
     Q_INVOKABLE int getAtomsInGroup(int groupindex) const;
 
 
-    ///@returns filtered result from the atoms
+    ///@returns filtered result from the atoms, the timeline reads the layers from getLayerColumns()
     Q_INVOKABLE float getAtomLayer(int atomIndex, int frame, bool applyFilters = true, bool isTimeline = true) const;
 
+    /// @returns The average layer of a residue in a frame of the active layer set, computed when the frame was written.
+    /// -1 if the frame has no layers.
     Q_INVOKABLE float getGroupLayerAvarage(int groupIndex, int frame) const;
 
-    Q_INVOKABLE float getGroupLayer(int groupIndex, int frame, bool applyFilters = true, bool isTimeline = true) const;
+    ///@returns the solvent accessible surface area of a group, or -1 if it wasn't computed for the frame
+    Q_INVOKABLE float getGroupSASA(int groupIndex, int frame) const;
 
-    float getGroupLayerAvarage(int groupIndex, const Atoms::layerFrame &frame) const;
+    Q_INVOKABLE float getGroupLayer(int groupIndex, int frame, bool applyFilters = true, bool isTimeline = true) const;
 
-    void fillGroupLayerAvarage(QVector<float> &avarage, const Atoms::layerFrame &frame) const;
+    void fillGroupLayerAvarage(QVector<float> &avarage, int frame) const;
 
     void fillGroupLayer(QVector<float> &avarage, int frame, bool applyFilters = true, bool isTimeline = true) const;
 
@@ -281,6 +416,9 @@ signals:
 
     void onFramesChanged();
 
+    /// Emitted if a layer set was added or the active layer set changed.
+    void onLayerSetsChanged();
+
     void hoveredChanged();
 
     void selectionChanged();
@@ -298,11 +436,14 @@ private:
     QMap<QString, QString> m_residuesFullName; /// The full names of the residues (residue abbreviation, full name)
     void readFullNames(const QString &file);
 
-    QMap<QString, QPair<QColor, float>> m_elemetColorsAndVdW; /// Stores a CPK color and Van-der-Waals-Radius for each element
+    QMap<QString, QPair<quint32, float>> m_elemetColorsAndVdW; /// Stores a CPK color and Van-der-Waals-Radius for each element
     void readElementColorsAndVdW(const QString &file);
 
     void completeModel();
 
+    /// Computes the solvent flag of each atom and counts the solvent residues.
+    void updateSolvent();
+
     //links
     Timeline *m_timeline = nullptr;
     FilterAtomsListModel *m_filterAtomsListModel = nullptr;
@@ -315,11 +456,21 @@ private:
     QVector<int> m_proteinStartIDs; /// Contains the index of the first atom of a protein
     QVector<bund> m_bonds;
     int m_waterCount = 0;
+    QStringList m_solventResidues = QStringList() << "SOL" << "HOH" << "water";
 
     //Streaming frames
     QVector<unsigned int> m_frameOffsets;
     TrajectoryStream m_trajectoryStream;
-    QVector<Atoms::layerFrame> m_layers;
+    QVector<Atoms::layerSet> m_layerSets = QVector<Atoms::layerSet>(1);
+    int m_activeLayerSet = 0;
+    QMutex m_statisticsMutex; /// Guards the statistics parts of the layer sets, they are added by the extraction threads
+
+    /// Drops the statistics of a layer set whose frames were replaced.
+    void clearResidueStatistics(int set);
+
+    /// Removes all layer sets, leaving one empty set with the given number of frames.
+    /// @returns false if there isn't enough memory for the layers, the set then has no frames.
+    bool resetLayerSets(int frames);
     //QList<xtcFrame> m_frames;
 
     //selection
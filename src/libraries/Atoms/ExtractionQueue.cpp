@@ -0,0 +1,127 @@
+/*
+ * ExtractionQueue.cpp
+ *
+ *  Created on: 04.05.2017
+ *      Author: Vladimir Ageev
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#include <Atoms/ExtractionQueue.h>
+#include <QMutexLocker>
+#include <QtGlobal>
+
+ExtractionQueue::ExtractionQueue(int firstFrame, int lastFrame):
+    m_firstFrame(firstFrame), m_lastFrame(qMax(lastFrame, firstFrame - 1)), m_taken(numberOfFrames(), 0), m_remaining(numberOfFrames()){
+    std::vector<char> queued(m_taken);
+    queueRange(m_firstFrame, m_lastFrame, queued);
+}
+
+ExtractionQueue::~ExtractionQueue(){}
+
+void ExtractionQueue::prioritize(const QVector<int>& trackers, int visibleFirst, int visibleLast){
+    QMutexLocker locker(&m_mutex);
+    m_order.clear();
+    m_position = 0;
+    std::vector<char> queued(m_taken);
+
+    //the viewed frames, starting at the tracker
+    for(int tracker: trackers){
+        queueRange(tracker, tracker + trackerFrames, queued);
+        queueRange(tracker - trackerFrames, tracker - 1, queued);
+    }
+
+    //the visible range from coarse to fine
+    visibleFirst = qMax(visibleFirst, m_firstFrame);
+    visibleLast = qMin(visibleLast, m_lastFrame);
+    for(int stride = coarseStride; stride >= finestStride; stride /= 2){
+        for(int f = visibleFirst; f <= visibleLast; f += stride){
+            char& q = queued[f - m_firstFrame];
+            if(q) continue;
+            q = 1;
+            block b;
+            b.first = b.last = f;
+            m_order.push_back(b);
+        }
+    }
+    queueRange(visibleFirst, visibleLast, queued);
+
+    queueRange(m_firstFrame, m_lastFrame, queued);
+}
+
+bool ExtractionQueue::next(block& out){
+    QMutexLocker locker(&m_mutex);
+    while(m_position < m_order.size()){
+        //frames taken since the order was built are skipped, the block is split at them
+        block& b = m_order[m_position];
+        while(b.first <= b.last && m_taken[b.first - m_firstFrame]) b.first++;
+        if(b.first > b.last){
+            m_position++;
+            continue;
+        }
+        out.first = out.last = b.first;
+        while(out.last < b.last && !m_taken[out.last + 1 - m_firstFrame]) out.last++;
+        b.first = out.last + 1;
+        if(b.first > b.last) m_position++;
+        for(int f = out.first; f <= out.last; f++) m_taken[f - m_firstFrame] = 1;
+        m_remaining -= out.last - out.first + 1;
+        return true;
+    }
+    return false;
+}
+
+bool ExtractionQueue::take(int frame){
+    QMutexLocker locker(&m_mutex);
+    if(frame < m_firstFrame || frame > m_lastFrame || m_taken[frame - m_firstFrame]) return false;
+    m_taken[frame - m_firstFrame] = 1;
+    m_remaining--;
+    return true;
+}
+
+int ExtractionQueue::remainingFrames() const{
+    QMutexLocker locker(&m_mutex);
+    return m_remaining;
+}
+
+float ExtractionQueue::getProgress() const{
+    QMutexLocker locker(&m_mutex);
+    return (numberOfFrames() > 0) ? 1.f - m_remaining/(float)numberOfFrames() : 1.f;
+}
+
+void ExtractionQueue::queueRange(int first, int last, std::vector<char>& queued){
+    first = qMax(first, m_firstFrame);
+    last = qMin(last, m_lastFrame);
+    for(int f = first; f <= last;){
+        if(queued[f - m_firstFrame]){
+            f++;
+            continue;
+        }
+        //consecutive frames that aren't queued yet
+        block b;
+        b.first = f;
+        while(f <= last && f - b.first < blockFrames && !queued[f - m_firstFrame]){
+            queued[f - m_firstFrame] = 1;
+            f++;
+        }
+        b.last = f - 1;
+        m_order.push_back(b);
+    }
+}
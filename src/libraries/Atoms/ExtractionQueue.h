@@ -0,0 +1,100 @@
+/**
+ * @file   		ExtractionQueue.h
+ * @author 		Vladimir Ageev
+ * @date   		04.05.2017
+ *
+ * @brief  		The frames of an extraction shared by its threads, in the order the user needs them.
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#ifndef LIBRARIES_ATOMS_EXTRACTIONQUEUE_H_
+#define LIBRARIES_ATOMS_EXTRACTIONQUEUE_H_
+
+#include <QVector>
+#include <QMutex>
+#include <vector>
+
+/*!
+ * @brief Hands out the frames of an extraction to its threads, the ones the user looks at first.
+ *
+ * The order is, see prioritize():
+ * 1. the frames around each tracker, the active tracker first,
+ * 2. every coarseStride-th frame of the visible range, then every half of that down to finestStride,
+ *    so the heatmap fills in at a coarse resolution first,
+ * 3. the remaining frames of the visible range and
+ * 4. all other frames.
+ * Consecutive frames are handed out in blocks of up to blockFrames frames, so the threads can keep the
+ * residue statistics (see ResidueStatistics) of a block instead of single frames.
+ * The order can be changed while the threads run, frames already handed out are not handed out again.
+ */
+class ExtractionQueue {
+public:
+	/// The frames first to last.
+	struct block {
+		int first = 0;
+		int last = -1;
+	};
+
+	static const int blockFrames = 16;
+	static const int trackerFrames = 32; /// Frames after and before each tracker extracted first
+	static const int coarseStride = 64;
+	static const int finestStride = 8;
+
+	/// Queues the frames firstFrame to lastFrame in increasing order.
+	ExtractionQueue(int firstFrame, int lastFrame);
+	virtual ~ExtractionQueue();
+
+	/*!
+	 * @brief Orders the frames that weren't handed out yet.
+	 * @param trackers The frame of each tracker, the most important first.
+	 * @param visibleFirst,visibleLast The range of frames shown in the heatmap.
+	 */
+	void prioritize(const QVector<int>& trackers, int visibleFirst, int visibleLast);
+
+	/// Takes the next block of frames. @returns false if all frames were handed out. Can be called from any thread.
+	bool next(block& out);
+
+	/// Takes a single frame out of the order, for a thread outside the queue. @returns false if it was handed out already.
+	bool take(int frame);
+
+	inline int numberOfFrames() const { return m_lastFrame - m_firstFrame + 1; }
+	/// @returns true if the frame is one of the queued frames, handed out or not.
+	inline bool contains(int frame) const { return frame >= m_firstFrame && frame <= m_lastFrame; }
+	/// @returns The number of frames not handed out yet.
+	int remainingFrames() const;
+	/// @returns The fraction of the frames handed out, between 0 and 1.
+	float getProgress() const;
+
+private:
+	/// Appends the frames first to last that aren't queued yet in blocks.
+	void queueRange(int first, int last, std::vector<char>& queued);
+
+	mutable QMutex m_mutex;
+	int m_firstFrame;
+	int m_lastFrame;
+	std::vector<char> m_taken; /// Non zero for each frame handed out
+	int m_remaining = 0;
+	QVector<block> m_order; /// The blocks in the order they are handed out
+	int m_position = 0; /// Next block of m_order
+};
+
+#endif /* LIBRARIES_ATOMS_EXTRACTIONQUEUE_H_ */
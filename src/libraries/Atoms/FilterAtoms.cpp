@@ -27,8 +27,6 @@
 
 #include <Atoms/FilterAtoms.h>
 #include <FilterDefinitions.h>
-#include <QApplication>
-#include <QClipboard>
 
 
 FilterAtomsListModel::FilterAtomsListModel(Atoms* atomsListModel, Timeline* timeline, QObject *parent ): QSortFilterProxyModel(parent), m_data(atomsListModel), m_timeline(timeline){
@@ -44,6 +42,7 @@ FilterAtomsListModel::FilterAtomsListModel(Atoms* atomsListModel, Timeline* time
 	m_registredVariables.push_back(new Atom::AtomResidueName());
     m_registredVariables.push_back(new Atom::MaxAtomLayer());
     m_registredVariables.push_back(new Atom::MinAtomLayer());
+	m_registredVariables.push_back(new Atom::MeanAtomLayer());
 	m_registredVariables.push_back(new Atom::IsSide());
 	m_registredVariables.push_back(new Atom::IsBackbone());
 	m_registredVariables.push_back(new Atom::SelectedAtomIndex());
@@ -53,6 +52,11 @@ FilterAtomsListModel::FilterAtomsListModel(Atoms* atomsListModel, Timeline* time
 	m_registredVariables.push_back(new Atom::ResidueName());
 	m_registredVariables.push_back(new Atom::MaxResidueLayer());
 	m_registredVariables.push_back(new Atom::MinResidueLayer());
+	m_registredVariables.push_back(new Atom::MeanResidueLayer());
+	m_registredVariables.push_back(new Atom::ResidueMeanDepth());
+	m_registredVariables.push_back(new Atom::ResidueDepthVariance());
+	m_registredVariables.push_back(new Atom::ResidueSurfaceFraction());
+	m_registredVariables.push_back(new Atom::ResidueSurfaceTransitions());
 
 
 	//====== FUNCTIONS ======
@@ -401,7 +405,7 @@ void FilterAtomsListModel::disableRenderView(int index, bool value){
 
 void FilterAtomsListModel::clipboard(int index){
 	if(index < 0 || index >= m_filters.size())  return;
-	QApplication::clipboard()->setText(m_filters[index]->display(), QClipboard::Clipboard);
+	emit copyToClipboard(m_filters[index]->display());
 }
 
 void FilterAtomsListModel::setEnabled(bool enable){
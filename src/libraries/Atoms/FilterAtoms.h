@@ -135,6 +135,7 @@ public slots:
 	Q_INVOKABLE void disableRenderView(int index, bool value);
 	/*!
 	 * @brief Copies a filters display value (which is equal to it's argument) to the clipboard.
+	 * The clipboard belongs to the GUI, it is set by a slot connected to copyToClipboard.
 	 * @param index The index of the filter
 	 */
 	Q_INVOKABLE void clipboard(int index);
@@ -149,6 +150,8 @@ signals:
 	void filterHasChanged();
 	void disableTimelineChanged();
 	void disableRenderViewChanged();
+	/// Send out when the text of a filter should be copied to the clipboard.
+	void copyToClipboard(const QString& text);
 protected:
 	bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const;
 	void updateRefrechTriggers(int triggers);
@@ -479,13 +479,8 @@ public:
 	int neededConnects() const final { return  FILTER_NODE_CONNECT_STARTFRAME_CHANGE | FILTER_NODE_CONNECT_ENDFRAME_CHANGE; };
 	QVariant call(bool isAtom, int index, const QString& , QObject*, Atoms* data, Timeline* timeline, Variables&) const final{
 		if(!isAtom || !data->numberOfAtroms()) return QVariant();
-		float max = 0;
-		for(int i = timeline->getStartFrame(); i < timeline->getEndFrame(); i++){
-			const float layer = data->getLayer(i).layers[index-1];
-			if(layer > max) max = layer;
-		}
-		return QVariant::fromValue<double>(max);
-
+		const LayerRanges::range range = data->getAtomLayerRange(index-1, timeline->getStartFrame(), timeline->getEndFrame());
+		return QVariant::fromValue<double>(qMax(range.max, 0.f));
 	}
 	QString display() const final{ return "MaxAtomLayer";} //"ResidueIndex"
 
@@ -506,12 +501,8 @@ public:
 	int neededConnects() const final { return  FILTER_NODE_CONNECT_STARTFRAME_CHANGE | FILTER_NODE_CONNECT_ENDFRAME_CHANGE; };
 	QVariant call(bool isAtom, int index, const QString&, QObject*, Atoms* data, Timeline* timeline, Variables&) const final{
 		if(!isAtom || !data->numberOfAtroms()) return QVariant();
-		float min = std::numeric_limits<float>::max();
-		for(int i = timeline->getStartFrame(); i < timeline->getEndFrame(); i++){
-			const float layer = data->getLayer(i).layers[index-1];
-			if(layer < min) min = layer;
-		}
-		return QVariant::fromValue<double>(min);
+		const LayerRanges::range range = data->getAtomLayerRange(index-1, timeline->getStartFrame(), timeline->getEndFrame());
+		return QVariant::fromValue<double>(range.min);
 	}
 	QString display() const final{ return "MinAtomLayer";} //"ResidueIndex"
 
@@ -520,6 +511,28 @@ public:
 
 	FilterVariable* createVar() const final { return new MinAtomLayer(); }
 };
+/*!
+ * @ingroup Filter
+ */
+class MeanAtomLayer: public FilterVariable{
+public:
+	MeanAtomLayer(){}
+	virtual ~MeanAtomLayer(){}
+
+	bool isValid() const final{return true;}
+	int neededConnects() const final { return  FILTER_NODE_CONNECT_STARTFRAME_CHANGE | FILTER_NODE_CONNECT_ENDFRAME_CHANGE; };
+	QVariant call(bool isAtom, int index, const QString&, QObject*, Atoms* data, Timeline* timeline, Variables&) const final{
+		if(!isAtom || !data->numberOfAtroms()) return QVariant();
+		const LayerRanges::range range = data->getAtomLayerRange(index-1, timeline->getStartFrame(), timeline->getEndFrame());
+		return QVariant::fromValue<double>(range.mean());
+	}
+	QString display() const final{ return "MeanAtomLayer";}
+
+	const QStringList getArguments() const final{ return {"meanatomlayer", "meanal"}; }
+	const QString getDiscription() const final{ return "Returns the mean atom layer between the set start and end frame of the current processed atom."; }
+
+	FilterVariable* createVar() const final { return new MeanAtomLayer(); }
+};
 /*!
  * @ingroup Filter
  */
@@ -666,12 +679,8 @@ public:
 	QVariant call(bool isAtom, int index, const QString& name, QObject*, Atoms* data, Timeline* timeline, Variables&) const final{
 		if(!isAtom){
 			if(name == "HOH") return QVariant();
-			float maxRL = 0;
-			for(int i = timeline->getStartFrame(); i < timeline->getEndFrame(); i++){
-				const float v = data->getGroupLayerAvarage(index-1, i);
-				if(v > maxRL) maxRL = v;
-			}
-			return QVariant::fromValue<double>(maxRL);
+			const LayerRanges::range range = data->getGroupLayerRange(index-1, timeline->getStartFrame(), timeline->getEndFrame());
+			return QVariant::fromValue<double>(qMax(range.max, 0.f));
 		}
 		return QVariant();
 	}
@@ -695,12 +704,8 @@ public:
 	QVariant call(bool isAtom, int index, const QString& name, QObject*, Atoms* data, Timeline* timeline, Variables&) const final{
 		if(!isAtom){
 			if(name == "HOH") return QVariant();
-			float minRL = 9999;
-			for(int i = timeline->getStartFrame(); i < timeline->getEndFrame(); i++){
-				const float v = data->getGroupLayerAvarage(index-1, i);
-				if(v < minRL) minRL = v;
-			}
-			return QVariant::fromValue<double>(minRL);
+			const LayerRanges::range range = data->getGroupLayerRange(index-1, timeline->getStartFrame(), timeline->getEndFrame());
+			return QVariant::fromValue<double>(qMin(range.min, 9999.f));
 		}
 		return QVariant();
 	}
@@ -711,6 +716,131 @@ public:
 
 	FilterVariable* createVar() const final { return new MinResidueLayer(); }
 };
+/*!
+ * @ingroup Filter
+ */
+class MeanResidueLayer: public FilterVariable{
+public:
+	MeanResidueLayer(){}
+	virtual ~MeanResidueLayer(){}
+
+	bool isValid() const final{return true;}
+	int neededConnects() const final { return  FILTER_NODE_CONNECT_STARTFRAME_CHANGE | FILTER_NODE_CONNECT_ENDFRAME_CHANGE; };
+	QVariant call(bool isAtom, int index, const QString& name, QObject*, Atoms* data, Timeline* timeline, Variables&) const final{
+		if(!isAtom){
+			if(name == "HOH") return QVariant();
+			const LayerRanges::range range = data->getGroupLayerRange(index-1, timeline->getStartFrame(), timeline->getEndFrame());
+			return QVariant::fromValue<double>(range.mean());
+		}
+		return QVariant();
+	}
+	QString display() const final{ return "MeanResidueLayer";}
+
+	const QStringList getArguments() const final{ return {"meanresiduelayer", "meanrl"}; }
+	const QString getDiscription() const final{ return "Returns the mean residue layer between the set start and end frame of the current processed residue."; }
+
+	FilterVariable* createVar() const final { return new MeanResidueLayer(); }
+};
+/*!
+ * @ingroup Filter
+ */
+class ResidueMeanDepth: public FilterVariable{
+public:
+	ResidueMeanDepth(){}
+	virtual ~ResidueMeanDepth(){}
+
+	bool isValid() const final{return true;}
+	QVariant call(bool isAtom, int index, const QString& name, QObject*, Atoms* data, Timeline*, Variables&) const final{
+		if(!isAtom){
+			if(name == "HOH") return QVariant();
+			const ResidueStatistics::residue statistics = data->getGroupStatistics(index-1);
+			if(!statistics.frames) return QVariant();
+			return QVariant::fromValue<double>(statistics.mean);
+		}
+		return QVariant();
+	}
+	QString display() const final{ return "ResidueMeanDepth";}
+
+	const QStringList getArguments() const final{ return {"residuemeandepth", "rmd"}; }
+	const QString getDiscription() const final{ return "Returns the mean layer of the current processed residue over all extracted frames."; }
+
+	FilterVariable* createVar() const final { return new ResidueMeanDepth(); }
+};
+/*!
+ * @ingroup Filter
+ */
+class ResidueDepthVariance: public FilterVariable{
+public:
+	ResidueDepthVariance(){}
+	virtual ~ResidueDepthVariance(){}
+
+	bool isValid() const final{return true;}
+	QVariant call(bool isAtom, int index, const QString& name, QObject*, Atoms* data, Timeline*, Variables&) const final{
+		if(!isAtom){
+			if(name == "HOH") return QVariant();
+			const ResidueStatistics::residue statistics = data->getGroupStatistics(index-1);
+			if(!statistics.frames) return QVariant();
+			return QVariant::fromValue<double>(statistics.variance());
+		}
+		return QVariant();
+	}
+	QString display() const final{ return "ResidueDepthVariance";}
+
+	const QStringList getArguments() const final{ return {"residuedepthvariance", "rdv"}; }
+	const QString getDiscription() const final{ return "Returns the variance of the layer of the current processed residue over all extracted frames."; }
+
+	FilterVariable* createVar() const final { return new ResidueDepthVariance(); }
+};
+/*!
+ * @ingroup Filter
+ */
+class ResidueSurfaceFraction: public FilterVariable{
+public:
+	ResidueSurfaceFraction(){}
+	virtual ~ResidueSurfaceFraction(){}
+
+	bool isValid() const final{return true;}
+	QVariant call(bool isAtom, int index, const QString& name, QObject*, Atoms* data, Timeline*, Variables&) const final{
+		if(!isAtom){
+			if(name == "HOH") return QVariant();
+			const ResidueStatistics::residue statistics = data->getGroupStatistics(index-1);
+			if(!statistics.frames) return QVariant();
+			return QVariant::fromValue<double>(statistics.surfaceFraction());
+		}
+		return QVariant();
+	}
+	QString display() const final{ return "ResidueSurfaceFraction";}
+
+	const QStringList getArguments() const final{ return {"residuesurfacefraction", "rsf"}; }
+	const QString getDiscription() const final{ return "Returns the fraction of the extracted frames in which the current processed residue has an atom on the surface (layer 0)."; }
+
+	FilterVariable* createVar() const final { return new ResidueSurfaceFraction(); }
+};
+/*!
+ * @ingroup Filter
+ */
+class ResidueSurfaceTransitions: public FilterVariable{
+public:
+	ResidueSurfaceTransitions(){}
+	virtual ~ResidueSurfaceTransitions(){}
+
+	bool isValid() const final{return true;}
+	QVariant call(bool isAtom, int index, const QString& name, QObject*, Atoms* data, Timeline*, Variables&) const final{
+		if(!isAtom){
+			if(name == "HOH") return QVariant();
+			const ResidueStatistics::residue statistics = data->getGroupStatistics(index-1);
+			if(!statistics.frames) return QVariant();
+			return QVariant::fromValue<int>(statistics.transitions);
+		}
+		return QVariant();
+	}
+	QString display() const final{ return "ResidueSurfaceTransitions";}
+
+	const QStringList getArguments() const final{ return {"residuesurfacetransitions", "rst"}; }
+	const QString getDiscription() const final{ return "Returns how often the current processed residue came to or left the surface over all extracted frames."; }
+
+	FilterVariable* createVar() const final { return new ResidueSurfaceTransitions(); }
+};
 
 //=========== Functions =============
 /*!
@@ -0,0 +1,248 @@
+/**
+ * @file   		LayerBytes.h
+ * @author 		Vladimir Ageev
+ * @date   		04.05.2017
+ *
+ * @brief  		The byte representation of the layers of one frame, shared by the .bald and .balc files,
+ *              and the header of the mapped .bald files.
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#ifndef LIBRARIES_ATOMS_LAYERBYTES_H_
+#define LIBRARIES_ATOMS_LAYERBYTES_H_
+
+#include <QVector>
+#include <QtGlobal>
+#include <vector>
+#include <cstring>
+
+/*!
+ * @brief Bytes used per atom by a frame with the given max layer.
+ * Nearly all frames fit into one unsigned byte per atom. Deeper frames, like large
+ * membranes or capsids, use two bytes, so the depth is not limited by the file formats.
+ * The max layer is stored in front of each frame, so the reader knows the width.
+ */
+inline int bytesPerLayer(int maxLayer){
+	return (maxLayer > 255) ? 2 : 1;
+}
+
+/// Appends the layers of a frame with the given max layer to out, in little endian.
+inline void encodeLayers(const QVector<float>& layers, int maxLayer, std::vector<char>& out){
+	const int bytes = bytesPerLayer(maxLayer);
+	out.reserve(out.size() + layers.size()*bytes);
+	for(float l: layers){
+		const unsigned int layer = (unsigned int) l;
+		out.push_back((char)(layer & 0xFF));
+		if(bytes == 2) out.push_back((char)((layer >> 8) & 0xFF));
+	}
+}
+
+/// Reads numberOfAtoms layers written by encodeLayers.
+inline void decodeLayers(const char* data, int numberOfAtoms, int maxLayer, QVector<float>& layers){
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+	layers.resize(numberOfAtoms);
+	if(bytesPerLayer(maxLayer) == 1){
+		for(int i = 0; i < numberOfAtoms; i++) layers[i] = bytes[i];
+	}else{
+		for(int i = 0; i < numberOfAtoms; i++) layers[i] = bytes[2*i] | (bytes[2*i+1] << 8);
+	}
+}
+
+/// Magic number of the first .bald version ("DLAB"), a flat list of frames.
+const quint32 layerFileMagicV1 = 1111575620;
+/// Magic number of .bald files starting with a layerFileHeader ("BAL2").
+const quint32 layerFileMagic = 0x324C4142;
+
+/// Entry of the chunk index of a compressed .bald file.
+struct layerChunk {
+	quint64 offset = 0; /// Position of the chunk in the file
+	quint32 size = 0; /// Compressed size in bytes
+	quint32 checksum = 0; /// layerChecksum() of the compressed bytes
+};
+static_assert(sizeof(layerChunk) == 16, "A chunk index entry must be 16 bytes.");
+
+/*!
+ * @brief Header of a .bald file of version 2.
+ *
+ * File layout:
+ * - The header.
+ * - Frame table: the max layer of each frame as qint32 at frameTableOffset, -1 if the frame wasn't extracted.
+ *
+ * Raw files, which can be memory mapped (see LayerStore):
+ * - Layers: numberOfAtoms x numberOfFrames layers of bytesPerLayer bytes each at dataOffset, which is
+ *   aligned to 4096 bytes. Frame-major files store all atoms of a frame next to each other,
+ *   atom-major files all frames of an atom. The layers of invalid frames are ignored.
+ *
+ * Chunked files, always frame-major:
+ * - Chunk index: a layerChunk for each framesPerChunk frames at chunkIndexOffset.
+ * - Chunks: starting at dataOffset. Each frame of a chunk is XOR'ed with the previous frame of the chunk,
+ *   the first one with zeros, and packed with packRuns(). Layers rarely change between frames,
+ *   so the XOR is mostly zero and packs into a few bytes. Any chunk can be read on its own.
+ *
+ * All values are little endian. Unlike the per frame width of version 1 the width is fixed for the
+ * whole file, so each layer has a fixed position and can be written in place.
+ */
+struct layerFileHeader {
+	enum Layout : quint32 { FrameMajor = 0, AtomMajor = 1 };
+	enum Compression : quint32 { Raw = 0, Chunked = 1 };
+
+	quint32 magicNumber = layerFileMagic;
+	quint32 version = 2;
+	quint32 numberOfAtoms = 0;
+	quint32 numberOfFrames = 0;
+	float probeRadius = -1.f;
+	quint32 layout = FrameMajor;
+	quint32 bytesPerLayer = 1;
+	quint32 compression = Raw; /// Only raw files can be mapped
+	quint64 frameTableOffset = 0;
+	quint64 dataOffset = 0;
+	quint32 framesPerChunk = 0; /// Only used by chunked files
+	quint32 reserved = 0;
+	quint64 chunkIndexOffset = 0; /// Only used by chunked files
+
+	/*!
+	 * @brief Places the frame table behind the header. For raw files the layers follow on the next page,
+	 * for chunked files the chunk index and the chunks follow directly.
+	 */
+	void computeOffsets(){
+		frameTableOffset = sizeof(layerFileHeader);
+		const quint64 frameTableEnd = frameTableOffset + (quint64)numberOfFrames*sizeof(qint32);
+		if(compression == Chunked){
+			chunkIndexOffset = frameTableEnd;
+			dataOffset = chunkIndexOffset + (quint64)numberOfChunks()*sizeof(layerChunk);
+		}else
+			dataOffset = (frameTableEnd + 4095) & ~(quint64)4095;
+	}
+
+	/// @returns The size of a raw file.
+	quint64 fileSize() const {
+		return dataOffset + (quint64)numberOfAtoms*numberOfFrames*bytesPerLayer;
+	}
+
+	inline int numberOfChunks() const {
+		return (framesPerChunk) ? (numberOfFrames + framesPerChunk - 1)/framesPerChunk : 0;
+	}
+
+	/// @returns true if the header describes a file this version can read.
+	bool isValid() const {
+		if(magicNumber != layerFileMagic || version != 2 || numberOfAtoms == 0 || numberOfFrames == 0 ||
+				(layout != FrameMajor && layout != AtomMajor) || (bytesPerLayer != 1 && bytesPerLayer != 2) ||
+				frameTableOffset < sizeof(layerFileHeader))
+			return false;
+		const quint64 frameTableEnd = frameTableOffset + (quint64)numberOfFrames*sizeof(qint32);
+		if(compression == Raw) return dataOffset >= frameTableEnd;
+		return compression == Chunked && layout == FrameMajor && framesPerChunk > 0 && chunkIndexOffset >= frameTableEnd &&
+				dataOffset >= chunkIndexOffset + (quint64)numberOfChunks()*sizeof(layerChunk);
+	}
+};
+static_assert(sizeof(layerFileHeader) == 64, "The layer file header must be 64 bytes.");
+
+/// CRC-32 (IEEE) of the given bytes, used to detect damaged chunks.
+inline quint32 layerChecksum(const char* data, size_t size){
+	struct crcTable {
+		quint32 values[256];
+		crcTable(){
+			for(quint32 i = 0; i < 256; i++){
+				quint32 c = i;
+				for(int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				values[i] = c;
+			}
+		}
+	};
+	static const crcTable table;
+	quint32 crc = 0xFFFFFFFFu;
+	for(size_t i = 0; i < size; i++) crc = table.values[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFFu;
+}
+
+/// Appends v as unsigned LEB128, seven bits per byte.
+inline void writeVarint(quint64 v, std::vector<char>& out){
+	while(v >= 0x80){
+		out.push_back((char)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((char)v);
+}
+
+/// Reads a value written by writeVarint. @returns false if the input ends before the value.
+inline bool readVarint(const unsigned char*& in, const unsigned char* end, quint64& v){
+	v = 0;
+	for(int shift = 0; in < end && shift < 64; shift += 7){
+		const unsigned char byte = *in++;
+		v |= (quint64)(byte & 0x7F) << shift;
+		if(!(byte & 0x80)) return true;
+	}
+	return false;
+}
+
+/*!
+ * @brief Run length encoding for the mostly zero XOR of two frames.
+ * A varint with the length shifted left by one starts each token. An odd one is a run, followed by
+ * the repeated byte, an even one is followed by the given number of literal bytes.
+ * Runs of any length take a few bytes, so an unchanged frame of a million atoms packs into four bytes.
+ */
+inline void packRuns(const unsigned char* data, size_t size, std::vector<char>& out){
+	size_t literal = 0; //start of the pending literal bytes
+	size_t i = 0;
+	while(i < size){
+		size_t run = 1;
+		while(i + run < size && data[i + run] == data[i]) run++;
+		//short runs are cheaper as part of the literal
+		if(run >= 4){
+			if(literal < i){
+				writeVarint((quint64)(i - literal) << 1, out);
+				out.insert(out.end(), data + literal, data + i);
+			}
+			writeVarint(((quint64)run << 1) | 1, out);
+			out.push_back((char)data[i]);
+			literal = i + run;
+		}
+		i += run;
+	}
+	if(literal < size){
+		writeVarint((quint64)(size - literal) << 1, out);
+		out.insert(out.end(), data + literal, data + size);
+	}
+}
+
+/// Unpacks exactly size bytes written by packRuns. @returns false if the input is damaged.
+inline bool unpackRuns(const unsigned char*& in, const unsigned char* end, unsigned char* out, size_t size){
+	size_t written = 0;
+	while(written < size){
+		quint64 token;
+		if(!readVarint(in, end, token)) return false;
+		const quint64 length = token >> 1;
+		if(length > size - written) return false;
+		if(token & 1){
+			if(in >= end) return false;
+			std::memset(out + written, *in++, length);
+		}else{
+			if((quint64)(end - in) < length) return false;
+			std::memcpy(out + written, in, length);
+			in += length;
+		}
+		written += length;
+	}
+	return true;
+}
+
+#endif /* LIBRARIES_ATOMS_LAYERBYTES_H_ */
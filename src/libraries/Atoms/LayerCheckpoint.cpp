@@ -0,0 +1,269 @@
+/*
+ * LayerCheckpoint.cpp
+ *
+ *  Created on: 04.05.2017
+ *      Author: Vladimir Ageev
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#include <Atoms/LayerCheckpoint.h>
+#include <Atoms/LayerBytes.h>
+
+#include <QFileInfo>
+#include <QDir>
+#include <QCryptographicHash>
+#include <QDebug>
+
+#include <vector>
+#include <algorithm>
+
+#define CHECKPOINT_MAGIC_NUMBER 1111575619
+#define CHECKPOINT_VERSION 2
+
+namespace {
+
+struct checkpointHeader{
+    unsigned int magicNumber;
+    unsigned int version;
+    unsigned int numAtoms;
+    unsigned int numFrames;
+    float probeRadius;
+    char identity[16];
+    int firstFrame;
+    int lastFrame;
+};
+
+/// Reads the header and checks that it belongs to a trajectory with the given number of atoms and frames.
+bool readHeader(QFile& file, checkpointHeader& header, int numberOfAtoms, int numberOfFrames){
+    return file.read(reinterpret_cast<char*>(&header), sizeof(header)) == sizeof(header) &&
+           header.magicNumber == CHECKPOINT_MAGIC_NUMBER && header.version == CHECKPOINT_VERSION &&
+           header.numAtoms == (unsigned int) numberOfAtoms && header.numFrames == (unsigned int) numberOfFrames;
+}
+
+/*!
+ * @brief Reads the bitmap following the header and loads all complete records of done frames.
+ * @param done Receives the frames that are marked as done and have a complete record.
+ * @param end Receives the end of the last complete record.
+ */
+bool readRecords(QFile& file, int numberOfAtoms, LayerStore& frames, QBitArray& done, qint64& end){
+    const QByteArray bitmap = file.read((frames.size()+7)/8);
+    if(bitmap.size() != (frames.size()+7)/8) return false;
+    QBitArray marked(frames.size());
+    for(int i = 0; i < frames.size(); i++)
+        if(bitmap[i/8] & (1 << (i%8))) marked.setBit(i);
+
+    //later records of the same frame win
+    done = QBitArray(frames.size());
+    std::vector<char> layers;
+    int record[2];
+    end = file.pos();
+    while(file.read(reinterpret_cast<char*>(record), sizeof(record)) == sizeof(record)){
+        layers.resize(numberOfAtoms*bytesPerLayer(record[1]));
+        if(file.read(layers.data(), layers.size()) != (qint64) layers.size()) break; //incomplete record at the end
+        end = file.pos();
+        const int frame = record[0];
+        if(frame < 0 || frame >= frames.size() || !marked.testBit(frame)) continue;
+        frames.decode(frame, record[1], layers.data());
+        done.setBit(frame);
+    }
+    //frames marked as done without a complete record are not done
+    return true;
+}
+
+}
+
+LayerCheckpoint::LayerCheckpoint(){}
+
+LayerCheckpoint::~LayerCheckpoint(){
+    close();
+}
+
+bool LayerCheckpoint::open(const QString& path, const QByteArray& identity, float probeRadius, int numberOfAtoms, LayerStore& frames,
+        int firstFrame, int lastFrame){
+    QMutexLocker locker(&m_mutex);
+    if(m_file.isOpen()) m_file.close();
+    m_file.setFileName(path);
+    m_numberOfAtoms = numberOfAtoms;
+
+    if(m_file.exists() && m_file.open(QIODevice::ReadWrite)){
+        if(load(identity, probeRadius, numberOfAtoms, frames)){
+            qDebug()<<__LINE__<<": Resuming from checkpoint"<<path<<"with"<<m_done.count(true)<<"of"<<frames.size()<<"frames done.";
+            return true;
+        }
+        qDebug()<<__LINE__<<": Checkpoint"<<path<<"belongs to a different extraction, starting over.";
+        m_file.close();
+    }
+    if(!m_file.open(QIODevice::ReadWrite | QIODevice::Truncate)){
+        qDebug()<<__LINE__<<": Failed to create checkpoint"<<path<<":"<<m_file.errorString();
+        return false;
+    }
+    return create(identity, probeRadius, numberOfAtoms, frames.size(), firstFrame, (lastFrame < 0) ? frames.size()-1 : lastFrame);
+}
+
+void LayerCheckpoint::close(){
+    QMutexLocker locker(&m_mutex);
+    if(m_file.isOpen()) m_file.close();
+}
+
+bool LayerCheckpoint::isOpen() const{
+    QMutexLocker locker(&m_mutex);
+    return m_file.isOpen();
+}
+
+bool LayerCheckpoint::isDone(int frame) const{
+    QMutexLocker locker(&m_mutex);
+    return frame >= 0 && frame < m_done.size() && m_done.testBit(frame);
+}
+
+int LayerCheckpoint::numberOfDoneFrames() const{
+    QMutexLocker locker(&m_mutex);
+    return m_done.count(true);
+}
+
+bool LayerCheckpoint::append(int frame, const Atoms::layerFrame& layerframe){
+    if(layerframe.maxLayer == -1 || layerframe.layers.size() != m_numberOfAtoms) return false;
+    std::vector<char> layers;
+    encodeLayers(layerframe.layers, layerframe.maxLayer, layers); //like .bald
+
+    QMutexLocker locker(&m_mutex);
+    if(!m_file.isOpen() || frame < 0 || frame >= m_done.size()) return false;
+
+    //first the record
+    const int record[2] = {frame, layerframe.maxLayer};
+    if(!m_file.seek(m_file.size()) ||
+       m_file.write(reinterpret_cast<const char*>(record), sizeof(record)) != sizeof(record) ||
+       m_file.write(layers.data(), layers.size()) != (qint64) layers.size() ||
+       !m_file.flush()){
+        qDebug()<<__LINE__<<": Failed to write frame"<<frame<<"to checkpoint:"<<m_file.errorString();
+        return false;
+    }
+
+    //then mark it as done
+    m_done.setBit(frame);
+    char bits = 0;
+    const int first = (frame/8)*8;
+    for(int i = first; i < first+8 && i < m_done.size(); i++)
+        if(m_done.testBit(i)) bits |= (1 << (i - first));
+    if(!m_file.seek(m_bitmapOffset + frame/8) || m_file.write(&bits, 1) != 1 || !m_file.flush()){
+        qDebug()<<__LINE__<<": Failed to mark frame"<<frame<<"in checkpoint:"<<m_file.errorString();
+        return false;
+    }
+    return true;
+}
+
+QByteArray LayerCheckpoint::identity(const Atoms& data, float probeRadius, const regionOfInterest& roi){
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    //model
+    for(const Atoms::atom& a: data.getAtoms()){
+        hash.addData(a.name.toUtf8());
+        hash.addData(a.residue.toUtf8());
+        hash.addData(reinterpret_cast<const char*>(&a.radius), sizeof(a.radius));
+        hash.addData(a.solvent ? "S" : "-", 1);
+    }
+    //trajectory
+    const QFileInfo trajectory(data.getStream().getFileName());
+    const qint64 trajectorySize = trajectory.size();
+    const int numFrames = data.numberOfFrames();
+    hash.addData(trajectory.fileName().toUtf8());
+    hash.addData(reinterpret_cast<const char*>(&trajectorySize), sizeof(trajectorySize));
+    hash.addData(reinterpret_cast<const char*>(&numFrames), sizeof(numFrames));
+    //parameters
+    hash.addData(reinterpret_cast<const char*>(&probeRadius), sizeof(probeRadius));
+    if(!roi.empty()){
+        hash.addData(reinterpret_cast<const char*>(&roi.exactLayers), sizeof(roi.exactLayers));
+        hash.addData(reinterpret_cast<const char*>(roi.atoms.constData()), roi.atoms.size()*sizeof(int));
+    }
+    return hash.result();
+}
+
+QString LayerCheckpoint::defaultPath(const Atoms& data, float probeRadius, const QByteArray& identity){
+    const QFileInfo trajectory(data.getStream().getFileName());
+    return trajectory.absoluteDir().filePath(trajectory.completeBaseName() + "_" + QString::number(probeRadius, 'f', 2) + "_" +
+                                             QString(identity.toHex().left(8)) + ".balc");
+}
+
+QString LayerCheckpoint::shardPath(const QString& directory, const Atoms& data, float probeRadius, const QByteArray& identity, int firstFrame, int lastFrame){
+    const QFileInfo trajectory(data.getStream().getFileName());
+    return QDir(directory).filePath(trajectory.completeBaseName() + "_" + QString::number(probeRadius, 'f', 2) + "_" +
+                                    QString(identity.toHex().left(8)) + "_" + QString::number(firstFrame) + "-" + QString::number(lastFrame) + ".balc");
+}
+
+int LayerCheckpoint::read(const QString& path, int numberOfAtoms, LayerStore& frames, float& probeRadiusOut, QByteArray& identityOut){
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)){
+        qDebug()<<__LINE__<<": Failed to open"<<path<<":"<<file.errorString();
+        return -1;
+    }
+    //read into a copy, so an invalid file leaves the frames untouched
+    LayerStore loaded;
+    if(!loaded.reset(numberOfAtoms, frames.size())) return -1;
+    checkpointHeader header;
+    QBitArray done;
+    qint64 end;
+    if(!readHeader(file, header, numberOfAtoms, frames.size()) || !readRecords(file, numberOfAtoms, loaded, done, end)){
+        qDebug()<<__LINE__<<": "<<path<<"is not a valid layer checkpoint for"<<numberOfAtoms<<"atoms and"<<frames.size()<<"frames.";
+        return -1;
+    }
+    probeRadiusOut = header.probeRadius;
+    identityOut = QByteArray(header.identity, 16);
+    frames.merge(loaded); //only the done frames are valid
+    return done.count(true);
+}
+
+bool LayerCheckpoint::create(const QByteArray& identity, float probeRadius, int numberOfAtoms, int numberOfFrames, int firstFrame, int lastFrame){
+    checkpointHeader header;
+    header.magicNumber = CHECKPOINT_MAGIC_NUMBER;
+    header.version = CHECKPOINT_VERSION;
+    header.numAtoms = numberOfAtoms;
+    header.numFrames = numberOfFrames;
+    header.probeRadius = probeRadius;
+    std::fill(header.identity, header.identity+16, 0);
+    std::copy(identity.begin(), identity.begin() + qMin(identity.size(), 16), header.identity);
+    header.firstFrame = firstFrame;
+    header.lastFrame = lastFrame;
+
+    m_done = QBitArray(numberOfFrames);
+    m_bitmapOffset = sizeof(header);
+    const QByteArray bitmap((numberOfFrames+7)/8, 0);
+    if(m_file.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header) ||
+       m_file.write(bitmap) != bitmap.size() || !m_file.flush()){
+        qDebug()<<__LINE__<<": Failed to write checkpoint header:"<<m_file.errorString();
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+bool LayerCheckpoint::load(const QByteArray& identity, float probeRadius, int numberOfAtoms, LayerStore& frames){
+    checkpointHeader header;
+    if(!readHeader(m_file, header, numberOfAtoms, frames.size()) ||
+       header.probeRadius != probeRadius || QByteArray(header.identity, 16) != identity.left(16))
+        return false;
+
+    m_bitmapOffset = sizeof(header);
+    qint64 end;
+    if(!readRecords(m_file, numberOfAtoms, frames, m_done, end)) return false;
+
+    //cut off an incomplete record, so new records are appended at a record boundary
+    if(end != m_file.size() && !m_file.resize(end)) return false;
+    return true;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file   		LayerCheckpoint.h
+ * @author 		Vladimir Ageev
+ * @date   		04.05.2017
+ *
+ * @brief  		Persists extracted layers frame by frame, so an interrupted extraction can be resumed
+ *              and a trajectory can be extracted in shards on several machines.
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#ifndef LIBRARIES_ATOMS_LAYERCHECKPOINT_H_
+#define LIBRARIES_ATOMS_LAYERCHECKPOINT_H_
+
+#include <Atoms/Atoms.h>
+#include <Atoms/ProteinSurface.h>
+#include <QFile>
+#include <QMutex>
+#include <QBitArray>
+#include <QByteArray>
+
+/*!
+ * @brief An append-only file of extracted layer frames with a bitmap of the completed frames.
+ *
+ * File layout (.balc):
+ * - Header: magic number, version, number of atoms, number of frames, probe radius,
+ *   a 16 byte identity of model, trajectory and extraction parameters and the frame range
+ *   the file is responsible for.
+ * - Bitmap: one bit per frame, set once the frame is completely written.
+ * - Records: frame index, max layer and the layers of each atom (see LayerBytes.h), appended in completion order.
+ *
+ * A record is flushed before its bit is set, so a crash can only lose the frame that
+ * was being written. Frames without a set bit are extracted again on resume.
+ * A shard is a checkpoint restricted to a frame range. Shards of the same extraction share
+ * the identity and are combined with read() or Atoms::importLayerData.
+ * All methods are thread safe.
+ */
+class LayerCheckpoint {
+public:
+	LayerCheckpoint();
+	virtual ~LayerCheckpoint();
+
+	/*!
+	 * @brief Opens the checkpoint file for the given extraction or creates a new one.
+	 * If the file exists and matches the identity, all completed frames are loaded into frames.
+	 * Otherwise the file is recreated.
+	 * @param frames The layer frames of the layer set belonging to this checkpoint.
+	 * @param firstFrame,lastFrame The frame range the file is responsible for, -1 for the last frame of the trajectory.
+	 * @returns false if the file can't be opened or created.
+	 */
+	bool open(const QString& path, const QByteArray& identity, float probeRadius, int numberOfAtoms, LayerStore& frames,
+			int firstFrame = 0, int lastFrame = -1);
+
+	void close();
+
+	bool isOpen() const;
+
+	/// @returns true if the given frame is stored in the checkpoint.
+	bool isDone(int frame) const;
+
+	int numberOfDoneFrames() const;
+
+	/*!
+	 * @brief Appends a completed frame. Invalid frames (maxLayer -1) are ignored.
+	 * @returns false if writing failed.
+	 */
+	bool append(int frame, const Atoms::layerFrame& layerframe);
+
+	/*!
+	 * @brief Identity of model, trajectory and extraction parameters.
+	 * Restarting an extraction only resumes a checkpoint with the same identity.
+	 */
+	static QByteArray identity(const Atoms& data, float probeRadius, const regionOfInterest& roi);
+
+	/// @returns The default checkpoint path, next to the trajectory file.
+	static QString defaultPath(const Atoms& data, float probeRadius, const QByteArray& identity);
+
+	/// @returns The path of the shard covering the frames firstFrame to lastFrame inside the given directory.
+	static QString shardPath(const QString& directory, const Atoms& data, float probeRadius, const QByteArray& identity, int firstFrame, int lastFrame);
+
+	/*!
+	 * @brief Reads the completed frames of a checkpoint or shard without modifying the file.
+	 * Frames that are not stored in the file are left untouched, so several shards can be read into the same frames.
+	 * @param frames Must have the number of frames of the trajectory.
+	 * @param probeRadiusOut,identityOut The probe radius and identity the file was extracted with.
+	 * @returns the number of read frames or -1 if the file is invalid or doesn't match the number of atoms or frames.
+	 */
+	static int read(const QString& path, int numberOfAtoms, LayerStore& frames, float& probeRadiusOut, QByteArray& identityOut);
+
+private:
+	bool create(const QByteArray& identity, float probeRadius, int numberOfAtoms, int numberOfFrames, int firstFrame, int lastFrame);
+	bool load(const QByteArray& identity, float probeRadius, int numberOfAtoms, LayerStore& frames);
+
+	mutable QMutex m_mutex;
+	QFile m_file;
+	QBitArray m_done;
+	int m_numberOfAtoms = 0;
+	qint64 m_bitmapOffset = 0;
+};
+
+#endif /* LIBRARIES_ATOMS_LAYERCHECKPOINT_H_ */
@@ -0,0 +1,192 @@
+/**
+ * @file   		LayerRanges.h
+ * @author 		Vladimir Ageev
+ * @date   		04.05.2017
+ *
+ * @brief  		Summaries of values over time, like the layer of each atom, for fast range queries.
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#ifndef LIBRARIES_ATOMS_LAYERRANGES_H_
+#define LIBRARIES_ATOMS_LAYERRANGES_H_
+
+#include <QVector>
+#include <QtGlobal>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+/*!
+ * @brief Answers the min, max and mean of a value over a range of frames for many items, like the layer of each atom.
+ *
+ * The frames are summarised in blocks of blockSize frames, blockSize of those blocks in the next level and so on,
+ * until one block covers all frames. A query combines the largest blocks inside the range and only reads the frames
+ * at its ends that don't fill a block, so it reads at most 2*blockSize values per level instead of every frame.
+ * The summaries take 12 bytes per item and block, about a fifth of the layers of an atom.
+ *
+ * The summaries of a block are stored next to each other for all items, so they are built frame by frame.
+ * Invalid frames are skipped by the summaries and all queries.
+ */
+class LayerRanges {
+public:
+	/// Min, max and sum of the valid frames of a range.
+	struct range {
+		float min = std::numeric_limits<float>::max();
+		float max = std::numeric_limits<float>::lowest();
+		double sum = 0;
+		int frames = 0; /// Number of valid frames
+
+		inline void add(float v){
+			min = std::min(min, v);
+			max = std::max(max, v);
+			sum += v;
+			frames++;
+		}
+		/// @returns The mean of the valid frames, 0 if there are none.
+		inline float mean() const { return (frames) ? sum/frames : 0.f; }
+	};
+
+	static const int blockSize = 64;
+
+	inline void clear(){
+		m_numberOfItems = 0;
+		m_levels.clear();
+		m_valid.clear();
+		m_validBefore.clear();
+	}
+	inline bool empty() const { return m_valid.empty(); }
+	inline int numberOfItems() const { return m_numberOfItems; }
+	inline int numberOfFrames() const { return m_valid.size(); }
+	inline bool isValid(int frame) const { return m_valid[frame]; }
+
+	/*!
+	 * @brief Builds the summaries, replacing the current ones.
+	 * @param valid Non zero for each frame with values.
+	 * @param values Called as values(frame, QVector<float>& out) for each valid frame in order, out must get a value per item.
+	 */
+	template<typename Values>
+	void build(int numberOfItems, const std::vector<char>& valid, const Values& values){
+		clear();
+		if(numberOfItems <= 0 || valid.empty()) return;
+		m_numberOfItems = numberOfItems;
+		m_valid = valid;
+		m_validBefore.assign(valid.size() + 1, 0);
+		for(size_t f = 0; f < valid.size(); f++) m_validBefore[f + 1] = m_validBefore[f] + ((valid[f]) ? 1 : 0);
+
+		int blocks = (numberOfFrames() + blockSize - 1)/blockSize;
+		m_levels.push_back(std::vector<summary>((size_t)blocks*numberOfItems));
+		QVector<float> frameValues;
+		for(int f = 0; f < numberOfFrames(); f++){
+			if(!valid[f]) continue;
+			values(f, frameValues);
+			summary* block = m_levels[0].data() + (size_t)(f/blockSize)*numberOfItems;
+			for(int i = 0; i < numberOfItems && i < frameValues.size(); i++) block[i].add(frameValues[i]);
+		}
+		//each level merges blockSize blocks of the level below
+		while(blocks > 1){
+			const int upper = (blocks + blockSize - 1)/blockSize;
+			std::vector<summary> level((size_t)upper*numberOfItems);
+			const std::vector<summary>& lower = m_levels.back();
+			for(int b = 0; b < blocks; b++){
+				summary* to = level.data() + (size_t)(b/blockSize)*numberOfItems;
+				const summary* from = lower.data() + (size_t)b*numberOfItems;
+				for(int i = 0; i < numberOfItems; i++) to[i].add(from[i]);
+			}
+			m_levels.push_back(std::move(level));
+			blocks = upper;
+		}
+	}
+
+	/*!
+	 * @brief Adds a frame that was invalid when the summaries were built, like a frame extracted afterwards.
+	 * Updates the block of each level that contains the frame, valid frames are ignored.
+	 * @param values A value per item.
+	 */
+	void addFrame(int frame, const QVector<float>& values){
+		if(frame < 0 || frame >= numberOfFrames() || m_valid[frame]) return;
+		m_valid[frame] = 1;
+		for(size_t f = frame + 1; f < m_validBefore.size(); f++) m_validBefore[f]++;
+		size_t block = frame/blockSize;
+		for(std::vector<summary>& level: m_levels){
+			summary* items = level.data() + block*m_numberOfItems;
+			for(int i = 0; i < m_numberOfItems && i < values.size(); i++) items[i].add(values[i]);
+			block /= blockSize;
+		}
+	}
+
+	/*!
+	 * @brief Min, max and mean of an item over the frames first to last-1.
+	 * @param value Called as value(frame) for the valid frames at the ends of the range that don't fill a block.
+	 */
+	template<typename Value>
+	range query(int item, int first, int last, const Value& value) const {
+		range result;
+		if(item < 0 || item >= m_numberOfItems) return result;
+		first = qMax(first, 0);
+		last = qMin(last, numberOfFrames());
+		for(int f = first; f < last;){
+			//the largest block starting at f that ends inside the range
+			int level = -1;
+			int size = 1;
+			while(level + 1 < (int)m_levels.size() && f % (size*blockSize) == 0 && f + size*blockSize <= last){
+				level++;
+				size *= blockSize;
+			}
+			if(level < 0){
+				if(m_valid[f]) result.add(value(f));
+			}else{
+				const summary& s = m_levels[level][(size_t)(f/size)*m_numberOfItems + item];
+				result.min = std::min(result.min, s.min);
+				result.max = std::max(result.max, s.max);
+				result.sum += s.sum;
+			}
+			f += size;
+		}
+		result.frames = (first < last) ? m_validBefore[last] - m_validBefore[first] : 0;
+		return result;
+	}
+
+private:
+	struct summary {
+		float min = std::numeric_limits<float>::max();
+		float max = std::numeric_limits<float>::lowest();
+		float sum = 0;
+
+		inline void add(float v){
+			min = std::min(min, v);
+			max = std::max(max, v);
+			sum += v;
+		}
+		inline void add(const summary& other){
+			min = std::min(min, other.min);
+			max = std::max(max, other.max);
+			sum += other.sum;
+		}
+	};
+
+	int m_numberOfItems = 0;
+	std::vector<std::vector<summary>> m_levels; /// Summaries of each level, block by block and item by item
+	std::vector<char> m_valid;
+	std::vector<int> m_validBefore; /// Number of valid frames before each frame
+};
+
+#endif /* LIBRARIES_ATOMS_LAYERRANGES_H_ */
@@ -0,0 +1,762 @@
+/*
+ * LayerStore.cpp
+ *
+ *  Created on: 04.05.2017
+ *      Author: Vladimir Ageev
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#include <Atoms/LayerStore.h>
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <thread>
+#include <cctype>
+
+namespace {
+/// Shared by all stores, so a revision is never reused for different layers.
+QAtomicInteger<quint64> s_revisions;
+/// Frames of a chunk in chunked files, large enough for the runs to pay off and small enough for partial loads.
+const quint32 s_framesPerChunk = 64;
+/// Frames of a .csv file formatted or parsed at once, the memory needed is a few times this many lines.
+const int csvBatchFrames = 256;
+
+/// Calls work(first, last) for equal parts of the range 0 to count-1 on all cores and waits for them.
+template<typename Work>
+void parallelFor(int count, const Work& work){
+    const int threads = qBound(1, QThread::idealThreadCount(), count);
+    std::vector<std::thread> workers;
+    for(int t = 1; t < threads; t++)
+        workers.emplace_back([&work, count, t, threads] { work(count * t / threads, count * (t + 1) / threads); });
+    work(0, count / threads);
+    for(std::thread& worker: workers) worker.join();
+}
+
+/// Writes the decimal digits of a layer. @returns The end of the written digits.
+inline char* formatLayer(int layer, char* out){
+    char digits[12];
+    int n = 0;
+    do{
+        digits[n++] = '0' + layer % 10;
+        layer /= 10;
+    }while(layer);
+    while(n) *out++ = digits[--n];
+    return out;
+}
+
+/// Parses a decimal number like QString::toFloat, surrounding white space is skipped. @returns 0 if the field isn't a number.
+float parseLayer(const char* begin, const char* end){
+    while(begin < end && isspace((unsigned char) *begin)) begin++;
+    while(begin < end && isspace((unsigned char) end[-1])) end--;
+    const bool negative = begin < end && *begin == '-';
+    if(begin < end && (*begin == '-' || *begin == '+')) begin++;
+    if(begin == end) return 0.f;
+    double value = 0;
+    for(; begin < end && *begin >= '0' && *begin <= '9'; begin++) value = value * 10 + (*begin - '0');
+    if(begin < end && *begin == '.'){
+        double scale = 0.1;
+        for(begin++; begin < end && *begin >= '0' && *begin <= '9'; begin++, scale *= 0.1) value += (*begin - '0') * scale;
+    }
+    if(begin != end) return 0.f;
+    return (negative) ? -value : value;
+}
+
+/*!
+ * @brief Parses a line of layers separated by ',' or ';', empty fields are skipped.
+ * @returns false if the line doesn't have a field for each layer.
+ */
+bool parseLayerLine(const QByteArray& line, QVector<float>& layers, float& maxLayer){
+    const char* p = line.constData();
+    const char* end = p + line.size();
+    while(end > p && (end[-1] == '\n' || end[-1] == '\r')) end--;
+    int count = 0;
+    maxLayer = -1;
+    while(p < end){
+        const char* field = p;
+        while(p < end && *p != ',' && *p != ';') p++;
+        if(p > field){
+            if(count == layers.size()) return false;
+            const float v = parseLayer(field, p);
+            layers[count++] = v;
+            if(v > maxLayer) maxLayer = v;
+        }
+        if(p < end) p++;
+    }
+    return count == layers.size();
+}
+}
+
+LayerStore::LayerStore(){}
+
+LayerStore::LayerStore(const LayerStore& other){
+    *this = other;
+}
+
+LayerStore::LayerStore(LayerStore&& other) noexcept{
+    *this = std::move(other);
+}
+
+LayerStore& LayerStore::operator=(LayerStore&& other) noexcept{
+    if(this == &other) return *this;
+    release();
+    m_numberOfAtoms = other.m_numberOfAtoms;
+    m_bytesPerLayer = other.m_bytesPerLayer;
+    m_frameStride = other.m_frameStride;
+    m_atomStride = other.m_atomStride;
+    m_layout = other.m_layout;
+    m_data = other.m_data;
+    m_maxLayers = std::move(other.m_maxLayers);
+    m_wide = std::move(other.m_wide);
+    m_sasa = std::move(other.m_sasa);
+    m_modified = std::move(other.m_modified);
+    m_frameRevisions = std::move(other.m_frameRevisions);
+    m_groupStarts = std::move(other.m_groupStarts);
+    m_groupAverages = other.m_groupAverages;
+    m_groupAverageRevisions = std::move(other.m_groupAverageRevisions);
+    m_file = other.m_file;
+    m_map = other.m_map;
+    m_fileMaxLayers = other.m_fileMaxLayers;
+    m_writable = other.m_writable;
+    m_revision.store(other.m_revision.load());
+    other.m_data = nullptr;
+    other.m_groupAverages = nullptr;
+    other.m_file = nullptr;
+    other.m_map = nullptr;
+    other.release();
+    return *this;
+}
+
+LayerStore& LayerStore::operator=(const LayerStore& other){
+    if(this == &other) return *this;
+    //the copied frames are averaged again, so the revisions of the frames are new
+    m_groupStarts = other.m_groupStarts;
+    float probeRadius;
+    //mapped read-only, a second writable mapping would write the frames of the copy into the file of the original
+    if(other.isMapped() && map(other.m_file->fileName(), probeRadius)){
+        //frames only changed in the memory of a private mapping are copied, those of a writable one are in the file
+        for(int f = 0; f < other.numberOfFrames(); f++){
+            if(!other.isOverflow(f) && (other.m_modified.empty() || !other.m_modified[f])) continue;
+            if(other.isValid(f)) copyFrame(other, f);
+            else invalidate(f);
+        }
+        m_maxLayers = other.m_maxLayers;
+        m_wide = other.m_wide;
+        m_sasa = other.m_sasa;
+        m_revision.store(other.m_revision.load());
+        return *this;
+    }
+    if(!allocate(other.m_numberOfAtoms, other.numberOfFrames(), other.m_layout)) return *this;
+    //only the written frames are copied, so the untouched ones stay unmapped
+    for(int f = 0; f < other.numberOfFrames(); f++)
+        if(other.isValid(f)) copyFrame(other, f);
+    m_sasa = other.m_sasa;
+    m_revision.store(other.m_revision.load());
+    return *this;
+}
+
+LayerStore::~LayerStore(){
+    release();
+}
+
+bool LayerStore::reset(int numberOfAtoms, int numberOfFrames){
+    return allocate(numberOfAtoms, numberOfFrames);
+}
+
+bool LayerStore::create(const QString& path, int numberOfAtoms, int numberOfFrames, float probeRadius, Layout layout, int bytesPerLayer){
+    if(numberOfAtoms <= 0 || numberOfFrames <= 0 || (bytesPerLayer != 1 && bytesPerLayer != 2)) return false;
+    layerFileHeader header;
+    header.numberOfAtoms = numberOfAtoms;
+    header.numberOfFrames = numberOfFrames;
+    header.probeRadius = probeRadius;
+    header.layout = layout;
+    header.bytesPerLayer = bytesPerLayer;
+    header.computeOffsets();
+
+    QFile* file = new QFile(path);
+    const std::vector<qint32> frameTable(numberOfFrames, -1);
+    const qint64 frameTableSize = frameTable.size()*sizeof(qint32);
+    //the layers are left as a hole, which reads as zeros and only occupies disk space once written
+    if(!file->open(QIODevice::ReadWrite | QIODevice::Truncate) ||
+            file->write(reinterpret_cast<const char*>(&header), sizeof(header)) != (qint64) sizeof(header) ||
+            file->write(reinterpret_cast<const char*>(frameTable.data()), frameTableSize) != frameTableSize ||
+            !file->resize(header.fileSize())){
+        qDebug()<<__LINE__<<": Failed to create the layer file "<<path<<": "<<file->errorString();
+        delete file;
+        return false;
+    }
+    return attach(file, header, true);
+}
+
+bool LayerStore::map(const QString& path, float& probeRadiusOut, bool writable){
+    QFile* file = new QFile(path);
+    layerFileHeader header;
+    if(!file->open((writable) ? QIODevice::ReadWrite : QIODevice::ReadOnly) ||
+            file->read(reinterpret_cast<char*>(&header), sizeof(header)) != (qint64) sizeof(header) ||
+            !header.isValid() || header.compression != layerFileHeader::Raw || file->size() < (qint64) header.fileSize()){
+        qDebug()<<__LINE__<<": "<<path<<" is not a mappable layer file!";
+        delete file;
+        return false;
+    }
+    if(!attach(file, header, writable)) return false;
+    probeRadiusOut = header.probeRadius;
+    return true;
+}
+
+bool LayerStore::save(const QString& path, float probeRadius, Layout layout, Compression compression) const{
+    if(empty() || m_numberOfAtoms <= 0) return false;
+    if(isMapped() && QFileInfo(path).absoluteFilePath() == QFileInfo(*m_file).absoluteFilePath()){
+        qDebug()<<__LINE__<<": "<<path<<" is mapped and can't be overwritten!";
+        return false;
+    }
+    if(compression == layerFileHeader::Chunked) return saveChunked(path, probeRadius);
+    const bool wide = std::any_of(m_maxLayers.begin(), m_maxLayers.end(), [](int maxLayer){ return maxLayer > 255; });
+    LayerStore file;
+    if(!file.create(path, m_numberOfAtoms, numberOfFrames(), probeRadius, layout, (wide) ? 2 : 1)) return false;
+    for(int f = 0; f < numberOfFrames(); f++)
+        if(isValid(f)) file.copyFrame(*this, f);
+    return true;
+}
+
+bool LayerStore::saveChunked(const QString& path, float probeRadius) const{
+    const int width = std::any_of(m_maxLayers.begin(), m_maxLayers.end(), [](int maxLayer){ return maxLayer > 255; }) ? 2 : 1;
+    layerFileHeader header;
+    header.numberOfAtoms = m_numberOfAtoms;
+    header.numberOfFrames = numberOfFrames();
+    header.probeRadius = probeRadius;
+    header.bytesPerLayer = width;
+    header.compression = layerFileHeader::Chunked;
+    header.framesPerChunk = s_framesPerChunk;
+    header.computeOffsets();
+
+    QFile file(path);
+    const std::vector<qint32> frameTable(m_maxLayers.begin(), m_maxLayers.end());
+    const qint64 frameTableSize = frameTable.size()*sizeof(qint32);
+    std::vector<layerChunk> chunks(header.numberOfChunks());
+    const qint64 chunkIndexSize = chunks.size()*sizeof(layerChunk);
+    //the index is written again once the chunks are known
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header)) != (qint64) sizeof(header) ||
+            file.write(reinterpret_cast<const char*>(frameTable.data()), frameTableSize) != frameTableSize ||
+            file.write(reinterpret_cast<const char*>(chunks.data()), chunkIndexSize) != chunkIndexSize){
+        qDebug()<<__LINE__<<": Failed to write the layer file "<<path<<": "<<file.errorString();
+        return false;
+    }
+
+    const size_t frameSize = (size_t)m_numberOfAtoms*width;
+    std::vector<unsigned char> previous(frameSize), current(frameSize);
+    std::vector<char> packed;
+    quint64 offset = header.dataOffset;
+    for(size_t c = 0; c < chunks.size(); c++){
+        const int first = c*s_framesPerChunk;
+        const int last = std::min(first + (int)s_framesPerChunk, numberOfFrames());
+        std::fill(previous.begin(), previous.end(), 0);
+        packed.clear();
+        for(int f = first; f < last; f++){
+            //invalid frames are zeros, which keeps the XOR of the next frame small
+            if(!isValid(f)) std::fill(current.begin(), current.end(), 0);
+            else if(width == 1 && m_bytesPerLayer == 1 && m_atomStride == 1)
+                std::memcpy(current.data(), m_data + index(f, 0), frameSize);
+            else for(int i = 0; i < m_numberOfAtoms; i++){
+                const int l = layer(f, i);
+                current[i*width] = l & 0xFF;
+                if(width == 2) current[i*width + 1] = l >> 8;
+            }
+            for(size_t i = 0; i < frameSize; i++) previous[i] ^= current[i];
+            packRuns(previous.data(), frameSize, packed);
+            previous.swap(current);
+        }
+        chunks[c].offset = offset;
+        chunks[c].size = packed.size();
+        chunks[c].checksum = layerChecksum(packed.data(), packed.size());
+        if(file.write(packed.data(), packed.size()) != (qint64) packed.size()){
+            qDebug()<<__LINE__<<": Failed to write the layer file "<<path<<": "<<file.errorString();
+            return false;
+        }
+        offset += packed.size();
+    }
+    if(!file.seek(header.chunkIndexOffset) ||
+            file.write(reinterpret_cast<const char*>(chunks.data()), chunkIndexSize) != chunkIndexSize){
+        qDebug()<<__LINE__<<": Failed to write the layer file "<<path<<": "<<file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool LayerStore::readHeader(const QString& path, layerFileHeader& header){
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) &&
+            file.read(reinterpret_cast<char*>(&header), sizeof(header)) == (qint64) sizeof(header) && header.isValid();
+}
+
+bool LayerStore::load(const QString& path, float& probeRadiusOut, int firstFrame, int lastFrame){
+    QFile file(path);
+    layerFileHeader header;
+    if(!file.open(QIODevice::ReadOnly) ||
+            file.read(reinterpret_cast<char*>(&header), sizeof(header)) != (qint64) sizeof(header) || !header.isValid()){
+        qDebug()<<__LINE__<<": "<<path<<" is not a layer file of version 2!";
+        return false;
+    }
+    const int frames = header.numberOfFrames;
+    if(lastFrame < 0 || lastFrame >= frames) lastFrame = frames - 1;
+    if(firstFrame < 0) firstFrame = 0;
+
+    if(header.compression == layerFileHeader::Raw){
+        //only the pages of the requested frames are read
+        LayerStore mapped;
+        if(!mapped.map(path, probeRadiusOut) || !reset(header.numberOfAtoms, frames)) return false;
+        for(int f = firstFrame; f <= lastFrame; f++)
+            if(mapped.isValid(f)) copyFrame(mapped, f);
+        return true;
+    }
+    if(!reset(header.numberOfAtoms, frames)) return false;
+    if(!loadChunked(file, header, firstFrame, lastFrame)){
+        qDebug()<<__LINE__<<": "<<path<<" is damaged!";
+        return false;
+    }
+    probeRadiusOut = header.probeRadius;
+    return true;
+}
+
+bool LayerStore::loadChunked(QFile& file, const layerFileHeader& header, int firstFrame, int lastFrame){
+    const int frames = header.numberOfFrames;
+    const int width = header.bytesPerLayer;
+    std::vector<qint32> frameTable(frames);
+    std::vector<layerChunk> chunks(header.numberOfChunks());
+    const qint64 frameTableSize = frameTable.size()*sizeof(qint32);
+    const qint64 chunkIndexSize = chunks.size()*sizeof(layerChunk);
+    if(!file.seek(header.frameTableOffset) ||
+            file.read(reinterpret_cast<char*>(frameTable.data()), frameTableSize) != frameTableSize ||
+            !file.seek(header.chunkIndexOffset) ||
+            file.read(reinterpret_cast<char*>(chunks.data()), chunkIndexSize) != chunkIndexSize)
+        return false;
+    if(firstFrame > lastFrame) return true;
+
+    const size_t frameSize = (size_t)m_numberOfAtoms*width;
+    std::vector<unsigned char> current(frameSize), delta(frameSize), narrow;
+    for(int c = firstFrame/header.framesPerChunk; c <= lastFrame/(int)header.framesPerChunk; c++){
+        if(!file.seek(chunks[c].offset)) return false;
+        const QByteArray packed = file.read(chunks[c].size);
+        if(packed.size() != (int) chunks[c].size || layerChecksum(packed.constData(), packed.size()) != chunks[c].checksum){
+            qDebug()<<__LINE__<<": Checksum of chunk "<<c<<" doesn't match!";
+            return false;
+        }
+        const unsigned char* in = reinterpret_cast<const unsigned char*>(packed.constData());
+        const unsigned char* end = in + packed.size();
+        std::fill(current.begin(), current.end(), 0);
+        const int first = c*header.framesPerChunk;
+        const int last = std::min(first + (int)header.framesPerChunk, frames);
+        for(int f = first; f < last; f++){
+            if(!unpackRuns(in, end, delta.data(), frameSize)) return false;
+            for(size_t i = 0; i < frameSize; i++) current[i] ^= delta[i];
+            if(f < firstFrame || f > lastFrame || frameTable[f] < 0) continue;
+            if(frameTable[f] > 65535 || bytesPerLayer(frameTable[f]) > width) return false;
+            if(width == 2 && bytesPerLayer(frameTable[f]) == 1){
+                //decode() expects the width of the frame
+                narrow.resize(m_numberOfAtoms);
+                for(int i = 0; i < m_numberOfAtoms; i++) narrow[i] = current[2*i];
+                decode(f, frameTable[f], reinterpret_cast<const char*>(narrow.data()));
+            }else
+                decode(f, frameTable[f], reinterpret_cast<const char*>(current.data()));
+        }
+    }
+    return true;
+}
+
+bool LayerStore::writeCsv(QIODevice& device, const QStringList& columns) const{
+    QByteArray header;
+    for(const QString& column: columns)
+        header.append(column.toUtf8()).append(',');
+    header.append('\n');
+    bool written = device.write(header) == header.size();
+    //the lines of a batch are formatted in parallel and written in order
+    std::vector<QByteArray> lines(csvBatchFrames);
+    for(int batch = 0; batch < size() && written; batch += csvBatchFrames){
+        const int count = std::min(csvBatchFrames, size() - batch);
+        parallelFor(count, [&](int first, int last){
+            for(int l = first; l < last; l++){
+                const int f = batch + l;
+                const bool valid = isValid(f);
+                QByteArray& line = lines[l];
+                line.resize(m_numberOfAtoms*6 + 1); //up to five digits and the separator
+                char* out = line.data();
+                for(int i = 0; i < m_numberOfAtoms; i++){
+                    if(valid) out = formatLayer(layer(f, i), out);
+                    *out++ = ',';
+                }
+                *out++ = '\n';
+                line.resize(out - line.data());
+            }
+        });
+        for(int l = 0; l < count && written; l++)
+            written = device.write(lines[l]) == lines[l].size();
+    }
+    return written;
+}
+
+void LayerStore::readCsv(QIODevice& device){
+    device.readLine();//skipline
+    //the lines of a batch are read in order and parsed in parallel, different frames can be set at the same time
+    std::vector<QByteArray> lines(csvBatchFrames);
+    for(int batch = 0; !device.atEnd() && batch < size(); batch += csvBatchFrames){
+        int count = 0;
+        while(count < csvBatchFrames && batch + count < size() && !device.atEnd())
+            lines[count++] = device.readLine();
+        parallelFor(count, [&](int first, int last){
+            QVector<float> layers(m_numberOfAtoms);
+            for(int l = first; l < last; l++){
+                float maxLayer;
+                if(parseLayerLine(lines[l], layers, maxLayer))
+                    setFrame(batch + l, maxLayer, layers);
+                else
+                    setFrame(batch + l, -1, QVector<float>());
+            }
+        });
+    }
+}
+
+LayerStore LayerStore::transposed() const{
+    LayerStore columns;
+    if(!columns.allocate(m_numberOfAtoms, numberOfFrames(), layerFileHeader::AtomMajor)) return columns;
+    //copied in blocks of frames and atoms, so both the reads and the scattered writes stay within a few pages
+    const int block = 64;
+    for(int f0 = 0; f0 < numberOfFrames(); f0 += block)
+        for(int a0 = 0; a0 < m_numberOfAtoms; a0 += block)
+            for(int f = f0; f < qMin(f0 + block, numberOfFrames()); f++){
+                if(!isValid(f) || isWide(f)) continue;
+                for(int a = a0; a < qMin(a0 + block, m_numberOfAtoms); a++) columns.write(columns.index(f, a), layer(f, a));
+            }
+    for(int f = 0; f < numberOfFrames(); f++){
+        if(isValid(f) && isWide(f)){
+            QVector<quint16> wide(m_numberOfAtoms);
+            for(int a = 0; a < m_numberOfAtoms; a++) wide[a] = layer(f, a);
+            columns.m_wide[f] = wide;
+        }
+        columns.m_maxLayers[f] = m_maxLayers[f];
+    }
+    columns.m_revision.store(m_revision.load());
+    columns.m_frameRevisions = m_frameRevisions;
+    return columns;
+}
+
+bool LayerStore::anyValid() const{
+    return std::any_of(m_maxLayers.begin(), m_maxLayers.end(), [](int maxLayer){ return maxLayer >= 0; });
+}
+
+int LayerStore::sum(int frame, int first, int last) const{
+    int sum = 0;
+    if(isOverflow(frame)){
+        const quint16* layers = m_wide[frame].constData();
+        for(int i = first; i < last; i++) sum += layers[i];
+    }else if(m_bytesPerLayer == 2){
+        const quint16* layers = reinterpret_cast<const quint16*>(m_data) + index(frame, first);
+        for(int i = 0; i < last-first; i++) sum += layers[i*m_atomStride];
+    }else{
+        const quint8* layers = m_data + index(frame, first);
+        for(int i = 0; i < last-first; i++) sum += layers[i*m_atomStride];
+    }
+    return sum;
+}
+
+void LayerStore::setGroups(const QVector<int>& groupStarts){
+    m_groupStarts = groupStarts;
+    allocateGroupAverages();
+    //the frames of a mapped file are only read once they are viewed
+    if(isMapped()) return;
+    for(int f = 0; f < numberOfFrames(); f++)
+        if(isValid(f)) updateGroupAverages(f);
+}
+
+float LayerStore::groupAverage(int frame, int group) const{
+    if(m_groupAverages && m_groupAverageRevisions[frame] == m_frameRevisions[frame])
+        return m_groupAverages[(size_t)frame*m_groupStarts.size() + group];
+    const int first = m_groupStarts[group];
+    const int last = (group == m_groupStarts.size() - 1) ? m_numberOfAtoms : m_groupStarts[group + 1];
+    return sum(frame, first, last) / (float) (last - first);
+}
+
+void LayerStore::fill(int frame, QVector<float>& layers) const{
+    if(!isValid(frame)){
+        layers.clear();
+        return;
+    }
+    layers.resize(m_numberOfAtoms);
+    if(isOverflow(frame)){
+        const quint16* wide = m_wide[frame].constData();
+        for(int i = 0; i < m_numberOfAtoms; i++) layers[i] = wide[i];
+    }else if(m_bytesPerLayer == 2){
+        const quint16* words = reinterpret_cast<const quint16*>(m_data) + index(frame, 0);
+        for(int i = 0; i < m_numberOfAtoms; i++) layers[i] = words[i*m_atomStride];
+    }else{
+        const quint8* bytes = m_data + index(frame, 0);
+        for(int i = 0; i < m_numberOfAtoms; i++) layers[i] = bytes[i*m_atomStride];
+    }
+}
+
+void LayerStore::setFrame(int frame, int maxLayer, const QVector<float>& layers, const QVector<float>& sasa){
+    if(maxLayer < 0 || layers.size() != m_numberOfAtoms){
+        invalidate(frame);
+        return;
+    }
+    //the layers are written before the max layer, which marks the frame as valid
+    if(m_bytesPerLayer == 1 && maxLayer > 255){
+        //written in place if the frame was wide before
+        QVector<quint16>& wide = m_wide[frame];
+        wide.resize(m_numberOfAtoms);
+        for(int i = 0; i < m_numberOfAtoms; i++) wide[i] = (quint16) layers[i];
+    }else{
+        for(int i = 0; i < m_numberOfAtoms; i++) write(index(frame, i), (int) layers[i]);
+        m_wide[frame] = QVector<quint16>();
+    }
+    //copied instead of shared, so the caller can write its areas again without a new allocation
+    if(sasa.empty()) m_sasa[frame] = QVector<float>();
+    else{
+        QVector<float>& areas = m_sasa[frame];
+        areas.resize(sasa.size());
+        std::copy(sasa.begin(), sasa.end(), areas.begin());
+    }
+    setMaxLayer(frame, maxLayer);
+}
+
+void LayerStore::invalidate(int frame){
+    //previously written layers are cleared, untouched frames are already zero
+    if(isValid(frame) && !isOverflow(frame))
+        for(int i = 0; i < m_numberOfAtoms; i++) write(index(frame, i), 0);
+    setMaxLayer(frame, -1);
+    m_wide[frame] = QVector<quint16>();
+    m_sasa[frame] = QVector<float>();
+}
+
+void LayerStore::merge(const LayerStore& other){
+    if(other.m_numberOfAtoms != m_numberOfAtoms || other.numberOfFrames() != numberOfFrames()) return;
+    for(int f = 0; f < numberOfFrames(); f++){
+        if(!other.isValid(f)) continue;
+        copyFrame(other, f);
+        m_sasa[f] = other.m_sasa[f];
+    }
+}
+
+void LayerStore::copyFrames(const LayerStore& other, const std::vector<int>& frames){
+    if(other.m_numberOfAtoms != m_numberOfAtoms || other.numberOfFrames() != numberOfFrames()) return;
+    for(int f: frames){
+        if(other.isValid(f)) copyFrame(other, f);
+        else invalidate(f);
+    }
+    m_revision.store(other.m_revision.load());
+}
+
+void LayerStore::encode(int frame, std::vector<char>& out) const{
+    if(bytesPerLayer(maxLayer(frame)) == 2){
+        out.reserve(out.size() + 2*m_numberOfAtoms);
+        for(int i = 0; i < m_numberOfAtoms; i++){
+            const int l = layer(frame, i);
+            out.push_back((char)(l & 0xFF));
+            out.push_back((char)(l >> 8));
+        }
+    }else if(m_bytesPerLayer == 1 && m_atomStride == 1){
+        const char* bytes = reinterpret_cast<const char*>(m_data + index(frame, 0));
+        out.insert(out.end(), bytes, bytes + m_numberOfAtoms);
+    }else{
+        out.reserve(out.size() + m_numberOfAtoms);
+        for(int i = 0; i < m_numberOfAtoms; i++) out.push_back((char) layer(frame, i));
+    }
+}
+
+void LayerStore::decode(int frame, int maxLayer, const char* data){
+    if(maxLayer < 0){
+        invalidate(frame);
+        return;
+    }
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    if(bytesPerLayer(maxLayer) == 2){
+        QVector<quint16> wide(m_numberOfAtoms);
+        for(int i = 0; i < m_numberOfAtoms; i++) wide[i] = bytes[2*i] | (bytes[2*i+1] << 8);
+        if(m_bytesPerLayer == 1) m_wide[frame] = wide;
+        else{
+            for(int i = 0; i < m_numberOfAtoms; i++) write(index(frame, i), wide[i]);
+            m_wide[frame] = QVector<quint16>();
+        }
+    }else{
+        if(m_bytesPerLayer == 1 && m_atomStride == 1)
+            std::memcpy(m_data + index(frame, 0), bytes, m_numberOfAtoms);
+        else
+            for(int i = 0; i < m_numberOfAtoms; i++) write(index(frame, i), bytes[i]);
+        m_wide[frame] = QVector<quint16>();
+    }
+    m_sasa[frame] = QVector<float>();
+    setMaxLayer(frame, maxLayer);
+}
+
+bool LayerStore::hasSASA() const{
+    return std::any_of(m_sasa.begin(), m_sasa.end(), [](const QVector<float>& sasa){ return !sasa.empty(); });
+}
+
+size_t LayerStore::memoryUsage() const{
+    size_t bytes = (isMapped()) ? 0 : (size_t)m_numberOfAtoms*m_maxLayers.size();
+    for(int f = 0; f < numberOfFrames(); f++){
+        bytes += (m_wide[f].size()*sizeof(quint16)) + m_sasa[f].size()*sizeof(float);
+        if(m_groupAverageRevisions[f]) bytes += m_groupStarts.size()*sizeof(float);
+    }
+    return bytes;
+}
+
+void LayerStore::setMaxLayer(int frame, int maxLayer){
+    m_maxLayers[frame] = maxLayer;
+    //deep frames of one byte files only live in memory, so the file doesn't claim them
+    if(m_fileMaxLayers) m_fileMaxLayers[frame] = (isOverflow(frame)) ? -1 : maxLayer;
+    if(!m_modified.empty()) m_modified[frame] = 1;
+    m_frameRevisions[frame] = touch();
+    if(maxLayer >= 0) updateGroupAverages(frame);
+}
+
+void LayerStore::updateGroupAverages(int frame){
+    if(!m_groupAverages) return;
+    //the averages are written before their revision, a frame read in between is summed on the fly
+    float* averages = m_groupAverages + (size_t)frame*m_groupStarts.size();
+    for(int g = 0; g < m_groupStarts.size(); g++){
+        const int first = m_groupStarts[g];
+        const int last = (g == m_groupStarts.size() - 1) ? m_numberOfAtoms : m_groupStarts[g + 1];
+        averages[g] = sum(frame, first, last) / (float) (last - first);
+    }
+    m_groupAverageRevisions[frame] = m_frameRevisions[frame];
+}
+
+void LayerStore::allocateGroupAverages(){
+    std::free(m_groupAverages);
+    m_groupAverages = nullptr;
+    m_groupAverageRevisions.assign(m_maxLayers.size(), 0);
+    const size_t size = (size_t)m_groupStarts.size()*m_maxLayers.size();
+    if(!size) return;
+    //like the layers, only the averages of written frames occupy physical memory
+    m_groupAverages = static_cast<float*>(std::calloc(size, sizeof(float)));
+    if(!m_groupAverages)
+        qDebug()<<__LINE__<<": Not enough memory for the group averages, they are summed when read!";
+}
+
+quint64 LayerStore::touch(){
+    const quint64 revision = s_revisions.fetchAndAddRelaxed(1) + 1;
+    m_revision.store(revision);
+    return revision;
+}
+
+void LayerStore::copyFrame(const LayerStore& other, int frame){
+    const int maxLayer = other.maxLayer(frame);
+    if(m_bytesPerLayer == 1 && maxLayer > 255){
+        QVector<quint16> wide(m_numberOfAtoms);
+        for(int i = 0; i < m_numberOfAtoms; i++) wide[i] = other.layer(frame, i);
+        m_wide[frame] = wide;
+    }else{
+        if(m_bytesPerLayer == 1 && m_atomStride == 1 && other.m_bytesPerLayer == 1 && other.m_atomStride == 1)
+            std::memcpy(m_data + index(frame, 0), other.m_data + other.index(frame, 0), m_numberOfAtoms);
+        else
+            for(int i = 0; i < m_numberOfAtoms; i++) write(index(frame, i), other.layer(frame, i));
+        m_wide[frame] = QVector<quint16>();
+    }
+    setMaxLayer(frame, maxLayer);
+}
+
+bool LayerStore::allocate(int numberOfAtoms, int numberOfFrames, Layout layout){
+    release();
+    m_numberOfAtoms = qMax(numberOfAtoms, 0);
+    m_layout = layout;
+    m_frameStride = (layout == layerFileHeader::AtomMajor) ? 1 : m_numberOfAtoms;
+    m_atomStride = (layout == layerFileHeader::AtomMajor) ? qMax(numberOfFrames, 0) : 1;
+    const size_t size = (size_t)m_numberOfAtoms*qMax(numberOfFrames, 0);
+    if(size){
+        //calloc takes zeroed pages from the system, which are only backed by memory once written
+        m_data = static_cast<quint8*>(std::calloc(size, 1));
+        if(!m_data){
+            qDebug()<<__LINE__<<": Not enough memory for the layers, failed to allocate "<<size<<" bytes!";
+            release();
+            return false;
+        }
+    }
+    m_maxLayers.assign(qMax(numberOfFrames, 0), -1);
+    m_wide.assign(m_maxLayers.size(), QVector<quint16>());
+    m_sasa.assign(m_maxLayers.size(), QVector<float>());
+    m_frameRevisions.assign(m_maxLayers.size(), touch());
+    allocateGroupAverages();
+    return true;
+}
+
+bool LayerStore::attach(QFile* file, const layerFileHeader& header, bool writable){
+    //a private mapping copies the pages of changed frames instead of writing them into the file
+    uchar* map = file->map(0, header.fileSize(), (writable) ? QFileDevice::NoOptions : QFileDevice::MapPrivateOption);
+    if(!map){
+        qDebug()<<__LINE__<<": Failed to map "<<file->fileName()<<": "<<file->errorString();
+        delete file;
+        return false;
+    }
+    release();
+    m_file = file;
+    m_map = map;
+    m_writable = writable;
+    m_numberOfAtoms = header.numberOfAtoms;
+    m_bytesPerLayer = header.bytesPerLayer;
+    m_layout = (Layout) header.layout;
+    m_frameStride = (m_layout == layerFileHeader::AtomMajor) ? 1 : header.numberOfAtoms;
+    m_atomStride = (m_layout == layerFileHeader::AtomMajor) ? header.numberOfFrames : 1;
+    m_data = map + header.dataOffset;
+    m_fileMaxLayers = reinterpret_cast<qint32*>(map + header.frameTableOffset);
+    m_maxLayers.assign(m_fileMaxLayers, m_fileMaxLayers + header.numberOfFrames);
+    for(int& maxLayer: m_maxLayers)
+        if(maxLayer < 0 || (m_bytesPerLayer == 1 && maxLayer > 255)) maxLayer = -1;
+    m_wide.assign(m_maxLayers.size(), QVector<quint16>());
+    m_sasa.assign(m_maxLayers.size(), QVector<float>());
+    if(!writable) m_modified.assign(m_maxLayers.size(), 0);
+    m_frameRevisions.assign(m_maxLayers.size(), touch());
+    allocateGroupAverages();
+    return true;
+}
+
+void LayerStore::release(){
+    if(m_file){
+        m_file->unmap(m_map);
+        delete m_file;
+    }else
+        std::free(m_data);
+    m_file = nullptr;
+    m_map = nullptr;
+    m_fileMaxLayers = nullptr;
+    m_writable = false;
+    m_data = nullptr;
+    m_numberOfAtoms = 0;
+    m_bytesPerLayer = 1;
+    m_frameStride = 0;
+    m_atomStride = 1;
+    m_layout = layerFileHeader::FrameMajor;
+    m_maxLayers.clear();
+    m_wide.clear();
+    m_sasa.clear();
+    m_modified.clear();
+    m_frameRevisions.clear();
+    //the groups belong to the model and are kept
+    std::free(m_groupAverages);
+    m_groupAverages = nullptr;
+    m_groupAverageRevisions.clear();
+}
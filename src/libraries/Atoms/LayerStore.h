@@ -0,0 +1,266 @@
+/**
+ * @file   		LayerStore.h
+ * @author 		Vladimir Ageev
+ * @date   		04.05.2017
+ *
+ * @brief  		Compact storage of the extracted layers of all frames, in memory or memory mapped from a .bald file.
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#ifndef LIBRARIES_ATOMS_LAYERSTORE_H_
+#define LIBRARIES_ATOMS_LAYERSTORE_H_
+
+#include <Atoms/LayerBytes.h>
+#include <QVector>
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+#include <QAtomicInteger>
+#include <vector>
+
+class QFile;
+class QIODevice;
+
+/*!
+ * @brief The layers of all frames of a trajectory for one probe radius.
+ *
+ * Layers are small integers, so they are kept as one unsigned byte per atom in a single
+ * contiguous frames x atoms buffer, a quarter of the memory of floats. Frames deeper than
+ * 255 layers use 16 bit per atom instead, like the .bald files (see LayerBytes.h).
+ * All accessors widen the values on read.
+ *
+ * The buffer is requested zeroed from the system, so frames that are never written don't
+ * occupy physical memory on most systems. Invalid frames read as layer 0.
+ * Different frames can be written by different threads at the same time.
+ *
+ * Instead of memory the layers can also be a memory mapped .bald file of version 2 (see layerFileHeader),
+ * so datasets larger than the memory can be browsed: only the pages of the viewed frames or atoms are read
+ * from disk and the system drops them again if the memory is needed. A file created with create() is
+ * written in place by the extraction threads. The width of a mapped file is fixed, deeper frames
+ * of a one byte file are only kept in memory. The areas (sasa) are never stored in the file.
+ * Stores in memory are frame-major, except the copies made by transposed() for reading atoms over time.
+ *
+ * Files can also be saved chunked and compressed, which makes them much smaller but they have to be loaded
+ * with load() instead of mapped. Single chunks can be loaded without reading the rest of the file.
+ *
+ * The average layer of groups of atoms, like the residues, is kept for each frame (see setGroups()).
+ */
+class LayerStore {
+public:
+	typedef layerFileHeader::Layout Layout;
+	typedef layerFileHeader::Compression Compression;
+
+	LayerStore();
+	/*!
+	 * Copies the layers into memory, a mapped store maps the same file again read-only, so frames set in
+	 * the copy are only kept in its memory. The copy is empty if there isn't enough memory.
+	 */
+	LayerStore(const LayerStore& other);
+	LayerStore(LayerStore&& other) noexcept;
+	LayerStore& operator=(const LayerStore& other);
+	LayerStore& operator=(LayerStore&& other) noexcept;
+	virtual ~LayerStore();
+
+	/// Drops all layers and creates numberOfFrames invalid frames of numberOfAtoms atoms in memory.
+	/// @returns false if there isn't enough memory, the store is then empty.
+	bool reset(int numberOfAtoms, int numberOfFrames);
+
+	/*!
+	 * @brief Creates a .bald file of version 2 with all frames invalid and maps it, replacing the current layers.
+	 * Frames set afterwards are written directly into the file.
+	 * @param bytesPerLayer 1, or 2 if frames may be deeper than 255 layers.
+	 * @returns false if the file can't be created or mapped.
+	 */
+	bool create(const QString& path, int numberOfAtoms, int numberOfFrames, float probeRadius,
+			Layout layout = layerFileHeader::FrameMajor, int bytesPerLayer = 1);
+
+	/*!
+	 * @brief Maps an existing .bald file of version 2, replacing the current layers.
+	 * @param writable If true, changed frames are written into the file, otherwise they are only kept in memory.
+	 * @returns false if the file can't be opened or isn't an uncompressed .bald file of version 2.
+	 */
+	bool map(const QString& path, float& probeRadiusOut, bool writable = false);
+
+	/*!
+	 * @brief Writes all frames into a new .bald file of version 2.
+	 * @param compression Raw files can be mapped, chunked files are a lot smaller but have to be loaded.
+	 * Chunked files are always frame-major.
+	 * @returns false if writing failed.
+	 */
+	bool save(const QString& path, float probeRadius, Layout layout = layerFileHeader::FrameMajor,
+			Compression compression = layerFileHeader::Raw) const;
+
+	/*!
+	 * @brief Reads the frames firstFrame to lastFrame of a .bald file of version 2 into memory, replacing the current layers.
+	 * Of a chunked file only the chunks containing these frames are read, each is verified with its checksum.
+	 * All other frames are invalid.
+	 * @param lastFrame -1 for the last frame of the file.
+	 * @returns false if the file can't be read, isn't a .bald file of version 2 or a chunk is damaged.
+	 */
+	bool load(const QString& path, float& probeRadiusOut, int firstFrame = 0, int lastFrame = -1);
+
+	/// Reads the header of a .bald file. @returns false if it isn't a valid file of version 2.
+	static bool readHeader(const QString& path, layerFileHeader& header);
+
+	/*!
+	 * @brief Writes a header line with the given columns and one line of comma separated layers per frame.
+	 * Invalid frames are written as empty fields.
+	 * @returns false if writing failed.
+	 */
+	bool writeCsv(QIODevice& device, const QStringList& columns) const;
+	/*!
+	 * @brief Reads the lines written by writeCsv into the frames from the first on, fields may also be separated by ';'.
+	 * A line without a layer for each atom invalidates its frame, frames after the last line are kept.
+	 */
+	void readCsv(QIODevice& device);
+
+	/*!
+	 * @brief Copies the layers into an atom-major store in memory, where the frames of each atom are next to each other.
+	 * Reading one atom over many frames, like the heatmap does, then streams through memory. The areas are not copied.
+	 * The copy is empty if there isn't enough memory.
+	 */
+	LayerStore transposed() const;
+
+	/// @returns A number that changes whenever a frame is written, so copies like transposed() can tell if they are outdated.
+	inline quint64 revision() const { return m_revision.load(); }
+	/// @returns A number that changes whenever the frame is written, so values derived from a single frame can be cached.
+	inline quint64 revision(int frame) const { return m_frameRevisions[frame]; }
+
+	/// @returns true if the layers are a memory mapped file.
+	inline bool isMapped() const { return m_file != nullptr; }
+	/// @returns The order of the layers.
+	inline Layout layout() const { return m_layout; }
+
+	inline int numberOfAtoms() const { return m_numberOfAtoms; }
+	inline int numberOfFrames() const { return m_maxLayers.size(); }
+	inline int size() const { return numberOfFrames(); }
+	inline bool empty() const { return m_maxLayers.empty(); }
+
+	/// @returns The deepest layer of the frame or -1 if the frame wasn't extracted.
+	inline int maxLayer(int frame) const { return m_maxLayers[frame]; }
+	inline bool isValid(int frame) const { return m_maxLayers[frame] >= 0; }
+	/// @returns true if the frame is too deep for one byte per atom.
+	inline bool isWide(int frame) const { return m_maxLayers[frame] > 255; }
+	/// @returns true if at least one frame was extracted.
+	bool anyValid() const;
+
+	/// @returns The layer of an atom.
+	inline int layer(int frame, int atom) const {
+		const size_t i = index(frame, atom);
+		if(m_bytesPerLayer == 2) return reinterpret_cast<const quint16*>(m_data)[i];
+		return (isWide(frame)) ? m_wide[frame][atom] : m_data[i];
+	}
+
+	/// @returns The sum of the layers of the atoms first to last-1, like the atoms of a residue.
+	int sum(int frame, int first, int last) const;
+
+	/*!
+	 * @brief Sets the groups of atoms, like the residues, whose average layer is computed whenever a frame is written.
+	 * The groups are kept when the layers are replaced. Frames of a mapped file are only averaged once they are written.
+	 * @param groupStarts The first atom of each group in ascending order, a group ends at the start of the next one.
+	 */
+	void setGroups(const QVector<int>& groupStarts);
+	inline int numberOfGroups() const { return m_groupStarts.size(); }
+	/// @returns The average layer of the atoms of a group, summed on the fly if the frame wasn't averaged when it was written.
+	float groupAverage(int frame, int group) const;
+
+	/// Widens the layers of a frame, for invalid frames layers is cleared.
+	void fill(int frame, QVector<float>& layers) const;
+
+	/*!
+	 * @brief Stores an extracted frame, a maxLayer of -1 invalidates it.
+	 * @param layers The layer of each atom, whole numbers between 0 and maxLayer.
+	 * @param sasa The accessible surface area of each atom, empty if not computed.
+	 */
+	void setFrame(int frame, int maxLayer, const QVector<float>& layers, const QVector<float>& sasa = QVector<float>());
+
+	void invalidate(int frame);
+
+	/// Copies all valid frames of another store with the same number of atoms and frames, the others are kept.
+	void merge(const LayerStore& other);
+	/*!
+	 * @brief Copies frames of another store with the same number of atoms and frames and takes over its revision.
+	 * Keeps a copy made by transposed() up to date if only these frames were written since. The areas are not copied.
+	 */
+	void copyFrames(const LayerStore& other, const std::vector<int>& frames);
+
+	/// Appends the layers of a valid frame in the byte format of LayerBytes.h.
+	void encode(int frame, std::vector<char>& out) const;
+	/// Stores a frame from the byte format of LayerBytes.h.
+	void decode(int frame, int maxLayer, const char* data);
+
+	/// @returns The accessible surface area of each atom, empty if it wasn't computed for the frame.
+	inline const QVector<float>& sasa(int frame) const { return m_sasa[frame]; }
+	/// @returns true if the area was computed for at least one frame.
+	bool hasSASA() const;
+
+	/// @returns The bytes allocated for the layers and group averages, only the written frames occupy physical memory. Mapped layers are not counted.
+	size_t memoryUsage() const;
+
+private:
+	inline size_t index(int frame, int atom) const { return (size_t)frame*m_frameStride + (size_t)atom*m_atomStride; }
+	inline void write(size_t i, int layer){
+		if(m_bytesPerLayer == 2) reinterpret_cast<quint16*>(m_data)[i] = (quint16) layer;
+		else m_data[i] = (quint8) layer;
+	}
+	/// @returns true if the layers of the frame are kept in m_wide.
+	inline bool isOverflow(int frame) const { return m_bytesPerLayer == 1 && isWide(frame); }
+	/// Marks the frame as valid, in the file only if its layers are stored there.
+	void setMaxLayer(int frame, int maxLayer);
+	void copyFrame(const LayerStore& other, int frame);
+	/// @returns The new revision.
+	quint64 touch();
+	/// Averages the groups of a valid frame, keyed by its revision.
+	void updateGroupAverages(int frame);
+	/// Allocates zeroed averages for all frames, none of them is averaged.
+	void allocateGroupAverages();
+	bool saveChunked(const QString& path, float probeRadius) const;
+	bool loadChunked(QFile& file, const layerFileHeader& header, int firstFrame, int lastFrame);
+
+	/// @returns false if there isn't enough memory, the store is then empty.
+	bool allocate(int numberOfAtoms, int numberOfFrames, Layout layout = layerFileHeader::FrameMajor);
+	bool attach(QFile* file, const layerFileHeader& header, bool writable);
+	void release();
+
+	int m_numberOfAtoms = 0;
+	int m_bytesPerLayer = 1;
+	size_t m_frameStride = 0; /// Distance between two frames of the same atom in layers
+	size_t m_atomStride = 1; /// Distance between two atoms of the same frame in layers
+	Layout m_layout = layerFileHeader::FrameMajor;
+	quint8* m_data = nullptr; /// The layers of all frames, calloc'd or inside the mapped file
+	std::vector<int> m_maxLayers; /// Max layer of each frame, -1 if invalid
+	std::vector<QVector<quint16>> m_wide; /// Layers of the frames deeper than 255 layers in one byte stores, empty for all others
+	std::vector<QVector<float>> m_sasa; /// Surface area of each frame, empty if not computed
+	std::vector<char> m_modified; /// Frames changed in a private mapping, empty for all other stores
+	QAtomicInteger<quint64> m_revision;
+	std::vector<quint64> m_frameRevisions; /// Revision of the last write of each frame
+	QVector<int> m_groupStarts; /// First atom of each group, see setGroups()
+	float* m_groupAverages = nullptr; /// Average layer of each group of each frame, calloc'd like the layers, nullptr without groups
+	std::vector<quint64> m_groupAverageRevisions; /// Revision of the frame the averages were computed from, 0 if never
+
+	QFile* m_file = nullptr; /// The mapped file, nullptr for stores in memory
+	uchar* m_map = nullptr;
+	qint32* m_fileMaxLayers = nullptr; /// Frame table of the mapped file, only written if the file is writable
+	bool m_writable = false;
+};
+
+#endif /* LIBRARIES_ATOMS_LAYERSTORE_H_ */
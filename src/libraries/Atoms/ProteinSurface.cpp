@@ -26,42 +26,200 @@
  */
 
 #include <ProteinSurface.h>
-#include <Util/BucketGrid.h>
+#include <SurfaceKernels.h>
+#include <Atoms/LayerCheckpoint.h>
+#include <Atoms/ExtractionQueue.h>
+#include <Util/NeighbourList.h>
 
 #include <QDebug>
 #include <QPair>
 #include <QElapsedTimer>
+#include <QMutexLocker>
+
+#include <limits>
 
 #define EPSILON 0.0001f
 
 //#define DEBUG_EXTRACTION
 
-/*!
- * @brief Cutting face definition
- */
-struct cuttingFace{
-    bool discarded; /// If true then this face can be ignored
-    glm::vec3 center; /// The center of the plane (o), see figure 24
-    glm::vec3 normal; /// Normal of the plane. Used for in-front tests. (n), see figure 24
-    float radius; /// The radius of the intersection sphere (r_c)
-    float normCutDistance; /// Cut distance on unit sphere
-    float normRadius;
-};
-
 QDebug operator<< (QDebug d, const cuttingFace &m){
     d << "cuttingFace[center: "<<m.center<<" normal: "<<m.normal<<" P: "<<(m.center+m.normal)<<" radius: "<<m.radius<<" normCutDis: "<<m.normCutDistance<<"]";
     return d;
 }
 
 struct cutPair{
-    QVector<cuttingFace>::iterator first;
-    QVector<cuttingFace>::iterator second;
+    cuttingFace* first;
+    cuttingFace* second;
     float distance;
 };
 
+/*!
+ * @brief A neighbour of an atom found by the neighbour search.
+ */
+struct cachedNeighbour{
+    int index; /// Atom index of the neighbour
+    int shell; /// The grid shell around the atom containing the neighbour
+    float distance; /// Squared distance to the atom
+
+    /// Ordered by shell, then distance. The index makes the order unique.
+    inline bool operator<(const cachedNeighbour& other) const {
+        if(shell != other.shell) return shell < other.shell;
+        if(distance != other.distance) return distance < other.distance;
+        return index < other.index;
+    }
+};
+
+/*!
+ * @brief The neighbours of all non-solvent atoms of one frame, in the order of the inserted atoms.
+ * The search is done once per frame and shared by all probe radii and all layers.
+ */
+struct frameNeighbours{
+    ArenaVector<cachedNeighbour> neighbors; /// Neighbours of all atoms, one continuous range per atom
+    ArenaVector<int> start; /// Start of the range of each atom, plus the end of the last range
+    ArenaVector<int> enclosingShell; /// Shell of each atom that lies completely outside of the grid
+
+    explicit frameNeighbours(Arena& arena): neighbors(arena), start(arena), enclosingShell(arena){}
+
+    /// Forgets the cache after the arena was reset.
+    inline void release(){
+        neighbors.release(); start.release(); enclosingShell.release();
+    }
+};
+
+/*!
+ * @brief Adds the time until it is destroyed to a counter of extractionMetrics.
+ * Without a counter nothing is measured.
+ */
+class phaseTimer{
+public:
+    explicit phaseTimer(qint64* counter): m_counter(counter){ if(m_counter) m_timer.start(); }
+    ~phaseTimer(){ if(m_counter) *m_counter += m_timer.nsecsElapsed(); }
+
+    /// Adds the time so far and continues with the given counter.
+    inline void switchTo(qint64* counter){
+        if(!m_counter) return;
+        *m_counter += m_timer.nsecsElapsed();
+        m_counter = counter;
+        m_timer.start();
+    }
+private:
+    qint64* m_counter;
+    QElapsedTimer m_timer;
+};
+
+/*!
+ * @brief Scratch data used while classifying a single atom.
+ * All buffers live in the arena of the extraction context and are only valid for one frame.
+ */
+struct extractionScratch{
+    ArenaVector<cachedNeighbour> neighbors;
+    sphereBatch batch;
+    planeBatch planes;
+    ArenaVector<cuttingFace> cutPlanes;
+    ArenaVector<cutPair> cutPlanesPair;
+    ArenaVector<glm::vec3> endPoints;
+    qint64* intersectionTime = nullptr; /// Phase counters, null if phase timing is disabled
+    qint64* endPointTime = nullptr;
+
+    explicit extractionScratch(Arena& arena):
+        neighbors(arena), batch(arena), planes(arena), cutPlanes(arena), cutPlanesPair(arena), endPoints(arena){}
+};
+
 template<typename T>
 inline T pow2(const T& a){ return a*a;}
 
+/// Role of an atom while extracting a region of interest.
+enum regionState : char{
+    FROZEN_ATOM = 0, /// Too far away to influence the region, never peeled
+    REGION_ATOM = 1, /// Peeled, because it influences the atoms of interest
+    INTEREST_ATOM = 2 /// Atom of interest
+};
+
+/*!
+ * @brief Marks all atoms closer than roi.exactLayers*R to an atom of interest as region atoms.
+ * @see regionOfInterest
+ */
+inline void markRegion(
+        const TrajectoryStream::xtcFrame& frame, BucketGrid<int>& grid,
+        const regionOfInterest& roi, float maxProbeRadius, float maxAtomRadius, QVector<char>& region){
+    region.fill(FROZEN_ATOM, frame.positions.size());
+
+    const float influence = roi.exactLayers*2.f*(maxAtomRadius + maxProbeRadius);
+    const float influence2 = pow2(influence);
+    const int maxShell = (int)(influence/grid.getCellSize()) + 1;
+    for(int atom: roi.atoms){
+        if(atom < 0 || atom >= frame.positions.size()) continue;
+        const glm::vec3& pos = frame.positions[atom];
+        const glm::uvec3 cell = grid.getCell(pos);
+        for(int shell = 0; shell <= maxShell; shell++){
+            if(!grid.forEachInShell(cell, shell, [&](int index){
+                const glm::vec3 d(frame.positions[index]-pos);
+                if(region[index] == FROZEN_ATOM && glm::dot(d, d) <= influence2) region[index] = REGION_ATOM;
+            })) break;
+        }
+    }
+    for(int atom: roi.atoms)
+        if(atom >= 0 && atom < frame.positions.size()) region[atom] = INTEREST_ATOM;
+}
+
+/*!
+ * @brief Collects the neighbours of atom i that the extended sphere of the given probe radius can reach.
+ * The candidates are taken from the Verlet list of the atom, which has to be built for at least
+ * this probe radius. The neighbours are appended to out, sorted by grid shell and then by distance,
+ * as if the grid was walked shell by shell like the extraction itself.
+ * @param allShells The extraction only walks the first radiusC shells. If true, the shells up to
+ *        the reach of the extended sphere are searched as well, which the accessible area needs.
+ * @returns The shell of the atom that lies completely outside of the grid.
+ */
+inline int gatherNeighbours(
+        const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, NeighbourList& neighbours,
+        float propeRadius, float maxAtomRadius, int i, bool allShells, ArenaVector<cachedNeighbour>& out){
+    const glm::vec3& posC = frame.positions[i];
+    const float radiusC = model[i].radius + propeRadius;
+    const float reach = radiusC + maxAtomRadius + propeRadius;
+    const float reach2 = pow2(reach); // same bound as used by the extraction
+
+    BucketGrid<int>& grid = neighbours.getGrid();
+    const glm::uvec3& cell = neighbours.getCell(i);
+    const int enclosingShell = grid.getEnclosingShell(cell);
+    const int maxShell = glm::min((allShells) ? (int)ceil(reach/grid.getCellSize()) : (int)(radiusC), enclosingShell-1);
+    const int start = out.size();
+    for(const int* n = neighbours.begin(i); n != neighbours.end(i); n++){
+        const glm::vec3 BtoC(frame.positions[*n]-posC);
+        const float distance = glm::dot(BtoC, BtoC);
+        if(distance >= reach2) continue;
+        const glm::ivec3 offset(glm::abs(glm::ivec3(neighbours.getCell(*n)) - glm::ivec3(cell)));
+        const int shell = glm::max(offset.x, glm::max(offset.y, offset.z));
+        if(shell <= maxShell) out.push_back({*n, shell, distance});
+    }
+    std::sort(out.begin()+start, out.end());
+    return enclosingShell;
+}
+
+/*!
+ * @brief Runs the neighbour search for the given atoms of the frame.
+ * The ranges are stored in the order of atoms, not by atom index.
+ * Float additions are monotonic, so the neighbours found for the biggest probe
+ * radius include the neighbours of every smaller radius.
+ * @returns false if the scratch memory ran out.
+ */
+inline bool cacheNeighbours(
+        const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, NeighbourList& neighbours,
+        const QVector<int>& atoms, float maxProbeRadius, float maxAtomRadius, bool allShells, const QVector<char>& region, frameNeighbours& cache){
+    if(!cache.start.reserve(atoms.size()+1) || !cache.enclosingShell.reserve(atoms.size()))
+        return false;
+    for(int i: atoms){
+        cache.start.push_back(cache.neighbors.size());
+        if(!region.empty() && region[i] == FROZEN_ATOM){
+            cache.enclosingShell.push_back(1);
+            continue;
+        }
+        cache.enclosingShell.push_back(gatherNeighbours(model, frame, neighbours, maxProbeRadius, maxAtomRadius, i, allShells, cache.neighbors));
+    }
+    cache.start.push_back(cache.neighbors.size());
+    return cache.start.size() == atoms.size()+1;
+}
+
 /*!
  * @brief Filters endpoints with the given cutting faces.
  * All resulting endpoints are tested agents the filtered cutting faces, by
@@ -70,26 +228,56 @@ inline T pow2(const T& a){ return a*a;}
  * after the tests, then the sphere and therefore the atom is classified as external,
  * otherwise as internal.
  * @param endPoints The endpoints that are tested and filtered against the cutting faces. Only the 'uncut' enspoints will remain.
+ * @param planes Scratch space for the structure of arrays copy of the not discarded faces.
+ * @returns false if the scratch memory ran out.
  */
-inline void testEndPoints(const QVector<cuttingFace>& cutPlanes, QVector<glm::vec3>& endPoints){
+inline bool testEndPoints(const ArenaVector<cuttingFace>& cutPlanes, ArenaVector<glm::vec3>& endPoints, planeBatch& planes){
     //if *all* end points are in front of the planes then sphere is fully cut
-    QVector<glm::vec3> filteredEndPoints;
-    bool pointRemoved;
-    for(const glm::vec3& p: endPoints){
-        pointRemoved = false;
-        for(const cuttingFace& plane: cutPlanes){
-            if(plane.discarded) continue;
-            //qDebug()<<"p: "<<p<<" dis: "<<(glm::dot(p-plane.center, plane.normal))<<" plane.center:"<<plane.center<<" plane.normal:"<<plane.normal;
-            if(glm::dot(p-plane.center, plane.normal) > EPSILON){//point is in front of plane
-                pointRemoved = true;
-                break;
-            }
-        }
-        if(!pointRemoved) //point hasn't been removed, so we save it
-            filteredEndPoints.push_back(p);
-    }
+    planes.clear();
+    for(const cuttingFace& plane: cutPlanes)
+        if(!plane.discarded) planes.push(plane);
+    if(!planes.pad()) return false;
+
+    cullEndPoints(planes, endPoints, EPSILON);
+    return true;
+}
 
-    endPoints = filteredEndPoints;
+/*!
+ * @brief Shrake-Rupley area of the extended sphere C that is not covered by its neighbours.
+ * A point on C lies inside a neighbouring sphere exactly if it is in front of their cutting face,
+ * so the points are culled with the cutting faces like end points. Discarded faces are
+ * used as well, as the area needs the exact union of all faces.
+ * @param cutPlanes The cutting faces found while classifying C.
+ * @param remainingBegin,remainingEnd The neighbours of the shells the classification didn't reach.
+ * @returns false if the scratch memory ran out.
+ */
+inline bool accessibleArea(
+        const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, float propeRadius, int i,
+        const QVector<glm::vec3>& spherePoints, ArenaVector<cuttingFace>& cutPlanes,
+        const cachedNeighbour* remainingBegin, const cachedNeighbour* remainingEnd, float reach2,
+        extractionScratch& scratch, float& area){
+    const glm::vec3& posC = frame.positions[i];
+    const float radiusC = model[i].radius + propeRadius;
+    area = 0;
+
+    sphereBatch& batch = scratch.batch;
+    batch.clear();
+    for(const cachedNeighbour* n = remainingBegin; n < remainingEnd; n++)
+        if(n->distance < reach2) batch.push(frame.positions[n->index], model[n->index].radius + propeRadius);
+    if(!batch.pad()) return false;
+    if(intersectSpheres(batch, posC, radiusC, cutPlanes)) return true; //fully covered
+
+    ArenaVector<glm::vec3>& points = scratch.endPoints;
+    points.clear();
+    if(!points.reserve(spherePoints.size())) return false;
+    for(const glm::vec3& p: spherePoints) points.push_back(posC + p*radiusC);
+    planeBatch& planes = scratch.planes;
+    planes.clear();
+    for(const cuttingFace& plane: cutPlanes) planes.push(plane);
+    if(!planes.pad()) return false;
+    cullEndPoints(planes, points, 0.f);
+    area = 4.f*3.14159265f*pow2(radiusC)*points.size()/(float)spherePoints.size();
+    return true;
 }
 
 /*!
@@ -132,7 +320,7 @@ inline void getEllipseMinMax(float (&minmax)[2], const cuttingFace& aPlane, floa
  * figure 25.
  * @brief cutPlanesPair Output pairs of cutting faces that intersect.
  */
-inline bool getIntersectionPair(QVector<cuttingFace>::iterator it1, QVector<cuttingFace>::iterator it2, QVector<cutPair>& cutPlanesPair){
+inline bool getIntersectionPair(cuttingFace* it1, cuttingFace* it2, ArenaVector<cutPair>& cutPlanesPair){
     float minmax[2];
     const float dot = glm::dot(it1->normal, it2->normal);
     getEllipseMinMax(minmax, *it1, dot);
@@ -157,24 +345,27 @@ inline bool getIntersectionPair(QVector<cuttingFace>::iterator it1, QVector<cutt
 
 inline bool extractSurface(
         const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, Atoms::layerFrame& layerframe, float propeRadius,
-        BucketGrid<int>& grid, QVector<cuttingFace>& cutPlanes, QVector<cutPair>& cutPlanesPair, QVector<glm::vec3>& endPoints, int i, int layerCount
+        const cachedNeighbour* neighborsBegin, const cachedNeighbour* neighborsEnd, int enclosingShell,
+        extractionScratch& scratch, float maxAtomRadius, int i, int layerCount, const QVector<glm::vec3>& spherePoints
         #ifdef DEBUG_EXTRACTION
         , bool doDebug = false
         #endif
         ){
+    sphereBatch& batch = scratch.batch;
+    ArenaVector<cuttingFace>& cutPlanes = scratch.cutPlanes;
+    ArenaVector<cutPair>& cutPlanesPair = scratch.cutPlanesPair;
+    ArenaVector<glm::vec3>& endPoints = scratch.endPoints;
 
     const glm::vec3& posC = frame.positions[i]; // position of the sphere A in world space
     const float radiusC = model[i].radius + propeRadius; // the extended sphere radius of A
+    const float reach2 = pow2(radiusC + maxAtomRadius + propeRadius); // no sphere further away than this can touch A
 
-    if(layerCount > 42) {
-        qDebug()<<__LINE__<<": ERROR: Reached maximum layer!";
-        return false;
-    }
     //clear data
     cutPlanes.clear();
     endPoints.clear();
 
     bool neighbor = false;
+    const cachedNeighbour* candidate = neighborsBegin;
     int radius = -1;
     const int maxRadius = (radiusC); //glm::max(grid.getWidth(), glm::max(grid.getHeight(), grid.getLength()));//
     while(radius < maxRadius){
@@ -198,44 +389,31 @@ inline bool extractSurface(
 
         const int cutPlaneStart = cutPlanes.size();
 
-        QVector<const QVector<int>*> neighbors;
-        if(!grid.getSurroundings(posC, neighbors, radius)) goto isOutside;
-        if(neighbors.empty()) continue;
+        if(radius >= enclosingShell) goto isOutside; //the shell lies completely outside of the grid
+
+        //the neighbors are sorted by shell and distance, so the current shell is the next continuous range
+        bool found = false;
+        batch.clear();
+        for(; candidate < neighborsEnd && candidate->shell == radius; candidate++){
+            //we don't cut with spheres already with a layer
+            if(layerframe.layers[candidate->index] < layerCount-1) continue;
+            found = true;
+            if(candidate->distance < reach2)
+                batch.push(frame.positions[candidate->index], model[candidate->index].radius + propeRadius);
+        }
+        if(!found) continue;
 
 #ifdef DEBUG_EXTRACTION
         if(doDebug){
-            qDebug()<<"["<<__LINE__<<"]: Extract neighbors:"<<" time: "<<(timer.nsecsElapsed()/1000000.f)<<" neighbors size: "<<neighbors.size();
+            qDebug()<<"["<<__LINE__<<"]: Extract neighbors:"<<" time: "<<(timer.nsecsElapsed()/1000000.f)<<" neighbors size: "<<batch.size();
             timer.start();
         }
 #endif
-        for(const QVector<int>* chunkPtr: neighbors){
-            const QVector<int>& chunk = *chunkPtr;
-            for(int index: chunk){
-
-                if(i == index || layerframe.layers[index] < layerCount-1) continue; //we don't cut with itself or with spheres already with a layer
-                const float radiusB = model[index].radius + propeRadius; //extended sphere radius of sphere B
-                const glm::vec3 BtoC(frame.positions[index]-posC); //vector between both spheres
-
-                //Possible configurations of two spheres inside the sphere cloud.
-                const float distance = glm::length(BtoC);
-                if(radiusB >= distance+radiusC){ //r_b > distance + r_a neighbor fully eats the sphere
-                    goto isInside; // case c or d
-                }
-                if( distance >= (radiusB+radiusC) || radiusC >= distance+radiusB  ){ //ball out if radius or is inside
-                    continue; // case a or b
-                }
-                //else intersection
-                const float cutDistance  =  (pow2(distance)-pow2(radiusB)+pow2(radiusC))/(2.f*distance);//(distance - r_b + r_a) / (2distance)
-                cutPlanes.push_back( { //create new cutting face
-                                       false,
-                                       posC+ glm::normalize(BtoC)*cutDistance,
-                                       glm::normalize(BtoC),
-                                       (float)sqrt(pow2(radiusC)-pow2(cutDistance)),
-                                       -cutDistance/radiusC,
-                                       (float)sqrt(1 - pow2(-cutDistance/radiusC))
-                                     } );
-            }
-        }//for loop end
+        if(!batch.pad()) return false; //out of scratch memory
+
+        //Possible configurations of two spheres inside the sphere cloud.
+        phaseTimer phase(scratch.intersectionTime);
+        if(intersectSpheres(batch, posC, radiusC, cutPlanes)) goto isInside; // case c or d
 
 #ifdef DEBUG_EXTRACTION
         if(doDebug){
@@ -301,7 +479,8 @@ inline bool extractSurface(
 #endif
         if(endPoints.empty()) continue;
 
-        testEndPoints(cutPlanes,endPoints);
+        phase.switchTo(scratch.endPointTime);
+        if(!testEndPoints(cutPlanes,endPoints,scratch.planes)) return false; //out of scratch memory
 #ifdef DEBUG_EXTRACTION
         if(doDebug){
             qDebug()<<"["<<__LINE__<<"]: Test end points:"<<" time: "<<(timer.nsecsElapsed()/1000000.f) <<" endPoints size: "<<endPoints.size();
@@ -312,11 +491,19 @@ inline bool extractSurface(
         }
     } //while loop
 
-    if(!neighbor) return false;
+    if(!neighbor){
+        //nothing in the searched shells cuts the sphere, so it stays on the outermost layer
+        if(layerCount == 1 && !spherePoints.empty())
+            accessibleArea(model, frame, propeRadius, i, spherePoints, cutPlanes, candidate, neighborsEnd, reach2, scratch, layerframe.sasa[i]);
+        return false;
+    }
 
     //the two possible cases for a atom
 isOutside:
     layerframe.layers[i] = layerCount-1;
+    //all neighbours have been intersected, so the faces describe the outermost layer completely
+    if(layerCount == 1 && !spherePoints.empty())
+        accessibleArea(model, frame, propeRadius, i, spherePoints, cutPlanes, candidate, neighborsEnd, reach2, scratch, layerframe.sasa[i]);
     return true;
 isInside:
     layerframe.layers[i] = layerCount;
@@ -396,8 +583,8 @@ void debugFindEndPoints(QString& debugOut,const QVector<Atoms::atom>& model,cons
     QVector<cutPair> cutPlanesPair;
 
     {
-        auto it1 = cutPlanes.begin();
-        auto it2 = cutPlanes.begin()+1;
+        cuttingFace* it1 = cutPlanes.data();
+        cuttingFace* it2 = cutPlanes.data()+1;
 
         float minmax[2];
         const float dot = glm::dot(it1->normal, it2->normal);
@@ -486,50 +673,250 @@ void debugFindEndPoints(QString& debugOut,const QVector<Atoms::atom>& model,cons
     }
 }
 
+double extractionMetrics::framesPerSecond() const{
+    return (wallTime > 0) ? frames/(wallTime/1e9) : 0.0;
+}
+
+double extractionMetrics::atomsPerSecond() const{
+    return (wallTime > 0) ? atoms/(wallTime/1e9) : 0.0;
+}
+
+double extractionMetrics::utilisation() const{
+    return (wallTime > 0) ? (decodeTime + extractionTime)/((double)wallTime*glm::max(threads, 1)) : 0.0;
+}
+
+void extractionMetrics::merge(const extractionMetrics& other){
+    threads += other.threads;
+    frames += other.frames;
+    atoms += other.atoms;
+    peelIterations += other.peelIterations;
+    neighbourListRebuilds += other.neighbourListRebuilds;
+    failedFrames += other.failedFrames;
+    peakScratchMemory = std::max(peakScratchMemory, other.peakScratchMemory);
+    decodeTime += other.decodeTime;
+    gridTime += other.gridTime;
+    neighbourTime += other.neighbourTime;
+    intersectionTime += other.intersectionTime;
+    endPointTime += other.endPointTime;
+    extractionTime += other.extractionTime;
+    wallTime = std::max(wallTime, other.wallTime);
+}
+
+QJsonObject extractionMetrics::toJson() const{
+    QJsonObject phases;
+    phases["decode"] = decodeTime/1e6;
+    phases["grid"] = gridTime/1e6;
+    phases["neighbours"] = neighbourTime/1e6;
+    phases["intersection"] = intersectionTime/1e6;
+    phases["endPoints"] = endPointTime/1e6;
+    phases["extraction"] = extractionTime/1e6;
+
+    QJsonObject json;
+    json["threads"] = threads;
+    json["frames"] = frames;
+    json["atoms"] = (double) atoms;
+    json["framesPerSecond"] = framesPerSecond();
+    json["atomsPerSecond"] = atomsPerSecond();
+    json["peelIterations"] = (double) peelIterations;
+    json["peelIterationsPerFrame"] = (frames > 0) ? peelIterations/(double)frames : 0.0;
+    json["neighbourListRebuilds"] = neighbourListRebuilds;
+    json["failedFrames"] = failedFrames;
+    json["peakScratchMemory"] = (double) peakScratchMemory;
+    json["wallTimeMs"] = wallTime/1e6;
+    json["phaseTimesMs"] = phases;
+    json["utilisation"] = utilisation();
+    return json;
+}
+
+ExtractionContext::ExtractionContext(size_t scratchMemoryLimit): m_arena(scratchMemoryLimit){}
+
+const QVector<glm::vec3>& ExtractionContext::getSpherePoints(int numberOfPoints){
+    if(m_spherePoints.size() != numberOfPoints){
+        //golden section spiral
+        m_spherePoints.resize(numberOfPoints);
+        const float increment = 3.14159265f*(3.f - sqrt(5.f));
+        for(int k = 0; k < numberOfPoints; k++){
+            const float y = 1.f - (k + 0.5f)*2.f/numberOfPoints;
+            const float r = sqrt(1.f - y*y);
+            const float phi = k*increment;
+            m_spherePoints[k] = glm::vec3(cos(phi)*r, y, sin(phi)*r);
+        }
+    }
+    return m_spherePoints;
+}
+
 int extractSurface(const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, Atoms::layerFrame& layerframe, float probeRadius){
-    //first we build a grid to faster find atoms
-    int layerCount = 1;
-    layerframe.maxLayer = -1;
-    layerframe.layers.fill(0,frame.positions.size());
-    int numatoms = std::count(layerframe.layers.begin(), layerframe.layers.end(), 0.0f);
-    qDebug()<<"Number of atoms: " << numatoms;
+    ExtractionContext context;
+    return extractSurface(model, frame, layerframe, probeRadius, context);
+}
 
-    //we build a grid to quickly find the neighbors
-    BucketGrid<int> grid( frame.box, 2.f);
+int extractSurface(const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, Atoms::layerFrame& layerframe, float probeRadius, ExtractionContext& context){
+    QVector<Atoms::layerFrame*> layerframes;
+    layerframes.push_back(&layerframe);
+    if(!extractSurface(model, frame, QVector<float>() << probeRadius, layerframes, context)) return -1;
+    return layerframe.maxLayer;
+}
+
+bool extractSurface(const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, const QVector<float>& probeRadii, const QVector<Atoms::layerFrame*>& layerframes, ExtractionContext& context,
+                    const regionOfInterest& roi, int sasaPoints){
+    Q_ASSERT(probeRadii.size() == layerframes.size());
+    if(probeRadii.empty()) return true;
+    qDebug()<<"Number of atoms: " << frame.positions.size();
+    extractionMetrics& metrics = context.getMetrics();
+    phaseTimer extractionTimer(&metrics.extractionTime);
+    metrics.frames++;
+
+    //first we build a grid and neighbour lists to faster find atoms, they are shared by all probe radii
+    //and the lists are reused by the following frames until an atom moved too far
+    //the solvent is neither inserted nor extracted, so all further loops only visit the inserted atoms
+    QVector<int>& inserted = context.getInserted();
+    inserted.resize(0);
+    float maxAtomRadius = 0;
     for(int i = 0; i < frame.positions.size(); i++){
-        if(model[i].residue == "HOH" || model[i].residue.toLower() == "water") continue;
-        grid.insert(i,frame.positions[i]);
+        if(model[i].solvent) continue;
+        inserted.push_back(i);
+        maxAtomRadius = glm::max(maxAtomRadius, model[i].radius);
     }
-
-    //needed data
-    QVector<cuttingFace> cutPlanes;
-    QVector<cutPair> cutPlanesPair;
-    QVector<glm::vec3> endPoints;
-    //next we cut each ball with its neighbors to see if something is left of it
-    //if yes -> surface atom
-    //if no -> not a surface atom
-    while(true){
-        bool end = true;
-
-        for(int i = 0; i < frame.positions.size(); i++){
-            if(model[i].residue == "HOH" || model[i].residue.toLower() == "water" || layerframe.layers[i] < layerCount-1) continue;
-            if(extractSurface(
-                        model, frame, layerframe, probeRadius,
-                        grid,cutPlanes,cutPlanesPair,endPoints,i, layerCount
-                        )) { end = false;}
-        }
+    const float maxProbeRadius = *std::max_element(probeRadii.begin(), probeRadii.end());
+    QVector<float>& cutoffs = context.getCutoffs();
+    cutoffs.fill(0.f, frame.positions.size());
+    for(int i: inserted) cutoffs[i] = model[i].radius + maxAtomRadius + 2.f*maxProbeRadius; //reach of the extended sphere
+    metrics.atoms += inserted.size();
+    NeighbourList& neighbours = context.getNeighbourList();
+    {
+        phaseTimer gridTimer(&metrics.gridTime);
+        const bool rebuilt = neighbours.update(frame.positions, frame.box, inserted, cutoffs);
+#ifdef DEBUG_EXTRACTION
+        if(rebuilt) qDebug()<<__LINE__<<": Rebuilt neighbour lists for frame "<<frame.index;
+#else
+        Q_UNUSED(rebuilt);
+#endif
+    }
+    metrics.neighbourListRebuilds = neighbours.numberOfRebuilds();
+    BucketGrid<int>& grid = neighbours.getGrid();
+
+    //needed data, everything from the previous frame is released
+    Arena& arena = context.getArena();
+    arena.reset();
+
+    //the region is computed for the biggest probe radius, which is also exact for the smaller ones
+    QVector<char>& region = context.getRegion();
+    if(roi.empty()) region.resize(0);
+    else markRegion(frame, grid, roi, maxProbeRadius, maxAtomRadius, region);
+
+    //the neighbour search is done once for all probe radii and layers,
+    //unless it takes more than half of the scratch memory, then each atom searches again
+    frameNeighbours cache(arena);
+    phaseTimer neighbourTimer(&metrics.neighbourTime);
+    const bool cached = cacheNeighbours(model, frame, neighbours, inserted, maxProbeRadius, maxAtomRadius, sasaPoints > 0, region, cache) && arena.getUsed() <= arena.getCeiling()/2;
+    neighbourTimer.switchTo(nullptr);
+    if(!cached){
+#ifdef DEBUG_EXTRACTION
+        qDebug()<<__LINE__<<": Frame "<<frame.index<<" has too many neighbours to cache them, searching them per atom.";
+#endif
+        arena.reset();
+        cache.release();
+    }
+    extractionScratch scratch(arena);
+    if(context.hasPhaseTiming()){
+        scratch.intersectionTime = &metrics.intersectionTime;
+        scratch.endPointTime = &metrics.endPointTime;
+    }
+    static const QVector<glm::vec3> noPoints;
+    const QVector<glm::vec3>& spherePoints = (sasaPoints > 0) ? context.getSpherePoints(sasaPoints) : noPoints;
+
+    for(int r = 0; r < probeRadii.size(); r++){
+        const float probeRadius = probeRadii[r];
+        Atoms::layerFrame& layerframe = *layerframes[r];
+        int layerCount = 1;
+        layerframe.maxLayer = -1;
+        layerframe.layers.fill(0,frame.positions.size());
+        if(spherePoints.empty()) layerframe.sasa.clear();
+        else layerframe.sasa.fill(0,frame.positions.size());
+        //frozen atoms always stay and cut their neighbors
+        for(int i = 0; i < region.size(); i++)
+            if(region[i] == FROZEN_ATOM) layerframe.layers[i] = std::numeric_limits<float>::max();
+
+        //next we cut each ball with its neighbors to see if something is left of it
+        //if yes -> surface atom
+        //if no -> not a surface atom
+        while(true){
+            bool end = true;
+            bool peeled = false;
+            metrics.peelIterations++;
+
+            for(int p = 0; p < inserted.size(); p++){
+                const int i = inserted[p];
+                if(layerframe.layers[i] < layerCount-1) continue;
+                if(!region.empty() && region[i] == FROZEN_ATOM) continue;
+                const cachedNeighbour* neighborsBegin;
+                const cachedNeighbour* neighborsEnd;
+                int enclosingShell;
+                if(cached){
+                    neighborsBegin = cache.neighbors.constData() + cache.start[p];
+                    neighborsEnd = cache.neighbors.constData() + cache.start[p+1];
+                    enclosingShell = cache.enclosingShell[p];
+                }else{
+                    scratch.neighbors.clear();
+                    enclosingShell = gatherNeighbours(model, frame, neighbours, probeRadius, maxAtomRadius, i, sasaPoints > 0 && layerCount == 1, scratch.neighbors);
+                    neighborsBegin = scratch.neighbors.constData();
+                    neighborsEnd = scratch.neighbors.constData() + scratch.neighbors.size();
+                }
+                if(extractSurface(
+                            model, frame, layerframe, probeRadius,
+                            neighborsBegin, neighborsEnd, enclosingShell,
+                            scratch,maxAtomRadius,i, layerCount, spherePoints
+                            )) {
+                    end = false;
+                    if(layerframe.layers[i] == layerCount-1) peeled = true;
+                }
+                if(arena.hasOverflown()){
+                    metrics.peakScratchMemory = std::max(metrics.peakScratchMemory, arena.getPeak());
+                    metrics.failedFrames++;
+                    qDebug()<<__LINE__<<": ERROR: Frame "<<frame.index<<" needs more than "<<arena.getCeiling()<<" bytes of scratch memory!";
+                    for(int k = r; k < layerframes.size(); k++){
+                        layerframes[k]->maxLayer = -1;
+                        layerframes[k]->layers.clear();
+                        layerframes[k]->sasa.clear();
+                    }
+                    return false;
+                }
+            }
 //#define COMPUTE_SURFACE_ONLY
 #ifdef COMPUTE_SURFACE_ONLY
 //         end after 1st layer, count number of atoms
-        int numatoms = std::count(layerframe.layers.begin(), layerframe.layers.end(), 0.0f);
-        qDebug()<<"Number of surface atoms: " << numatoms;
-        break;
+            int numatoms = std::count(layerframe.layers.begin(), layerframe.layers.end(), 0.0f);
+            qDebug()<<"Number of surface atoms: " << numatoms;
+            break;
 #endif
-        if(end) break;
-        layerCount++;
+            if(end) break;
+            //the depth is unbounded, the outermost remaining atom is always peeled unless frozen atoms enclose the rest
+            if(!peeled){
+                layerCount++;
+                break;
+            }
+            //in a region of interest we are done once all atoms of interest are peeled
+            if(!region.empty() && std::none_of(roi.atoms.begin(), roi.atoms.end(), [&](int atom){
+                    return atom >= 0 && atom < frame.positions.size() && layerframe.layers[atom] >= layerCount;
+                })) break;
+            layerCount++;
+        }
+        layerframe.maxLayer = layerCount-1;
+
+        if(!region.empty()){
+            //only the atoms of interest are reported
+            layerframe.maxLayer = 0;
+            for(int i = 0; i < region.size(); i++){
+                if(region[i] == INTEREST_ATOM) layerframe.maxLayer = glm::max(layerframe.maxLayer, (int)layerframe.layers[i]);
+                else{
+                    layerframe.layers[i] = 0;
+                    if(!layerframe.sasa.empty()) layerframe.sasa[i] = 0;
+                }
+            }
+        }
     }
-    layerframe.maxLayer = layerCount-1;
-    return layerCount-1;
+    metrics.peakScratchMemory = std::max(metrics.peakScratchMemory, arena.getPeak());
+    return true;
 }
 
 void debugExtractSurface(const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, Atoms::layerFrame& layerframe, float probeRadius, int atomID){
@@ -538,21 +925,29 @@ void debugExtractSurface(const QVector<Atoms::atom>& model,const TrajectoryStrea
     layerframe.layers.fill(0,frame.positions.size());
 
     //we build a grid to quickly find the neighbors
-    BucketGrid<int> grid( frame.box, 2.f);
-    for(int i = 0; i < frame.positions.size(); i++)
-        grid.insert(i,frame.positions[i]);
+    QVector<int> inserted;
+    float maxAtomRadius = 0;
+    for(int i = 0; i < frame.positions.size(); i++){
+        inserted.push_back(i);
+        maxAtomRadius = glm::max(maxAtomRadius, model[i].radius);
+    }
+    QVector<float> cutoffs;
+    for(int i = 0; i < frame.positions.size(); i++) cutoffs.push_back(model[i].radius + maxAtomRadius + 2.f*probeRadius);
+    NeighbourList neighbours;
+    neighbours.update(frame.positions, frame.box, inserted, cutoffs);
 
 
     //needed data
-    QVector<cuttingFace> cutPlanes;
-    QVector<cutPair> cutPlanesPair;
-    QVector<glm::vec3> endPoints;
+    Arena arena;
+    extractionScratch scratch(arena);
     qDebug()<<"["<<__LINE__<<"]: "<<"Extract for "<<atomID;
     QElapsedTimer timer;
     timer.restart();
+    const int enclosingShell = gatherNeighbours(model, frame, neighbours, probeRadius, maxAtomRadius, atomID, false, scratch.neighbors);
     extractSurface(
                 model, frame, layerframe, probeRadius,
-                grid,cutPlanes,cutPlanesPair,endPoints,atomID, layerCount
+                scratch.neighbors.constData(), scratch.neighbors.constData() + scratch.neighbors.size(), enclosingShell,
+                scratch,maxAtomRadius,atomID, layerCount, QVector<glm::vec3>()
             #ifdef DEBUG_EXTRACTION
                 , true
             #endif
@@ -562,8 +957,8 @@ void debugExtractSurface(const QVector<Atoms::atom>& model,const TrajectoryStrea
 }
 
 
-ExtractSurfaceThread::ExtractSurfaceThread(Atoms* data, int startFrame, int endFrame, float propeRadius, QObject* parent):
-    QThread(parent), m_data(data), m_start(startFrame), m_end(endFrame), m_propeRadius(propeRadius), m_remainingFrames(m_end-m_start){}
+ExtractSurfaceThread::ExtractSurfaceThread(Atoms* data, int startFrame, int endFrame, const QVector<float>& probeRadii, const QVector<int>& layerSets, QObject* parent):
+    QThread(parent), m_data(data), m_start(startFrame), m_end(endFrame), m_probeRadii(probeRadii), m_layerSets(layerSets), m_remainingFrames(m_end-m_start){}
 
 ExtractSurfaceThread::~ExtractSurfaceThread(){
 
@@ -582,37 +977,135 @@ int ExtractSurfaceThread::getRemainingFrames() const{
     return m_remainingFrames;
 }
 
+void ExtractSurfaceThread::setScratchMemoryLimit(size_t bytes){
+    m_scratchMemoryLimit = bytes;
+}
+
+void ExtractSurfaceThread::setRegionOfInterest(const regionOfInterest& roi){
+    m_roi = roi;
+}
+
+void ExtractSurfaceThread::setCheckpoints(const QVector<QSharedPointer<LayerCheckpoint>>& checkpoints){
+    m_checkpoints = checkpoints;
+}
 
+void ExtractSurfaceThread::setQueue(const QSharedPointer<ExtractionQueue>& queue){
+    m_queue = queue;
+}
+
+void ExtractSurfaceThread::setSASAPoints(int points){
+    m_sasaPoints = points;
+}
+
+void ExtractSurfaceThread::setPhaseTiming(bool enable){
+    m_phaseTiming = enable;
+}
+
+extractionMetrics ExtractSurfaceThread::getMetrics() const{
+    QMutexLocker locker(&m_metricsMutex);
+    return m_metrics;
+}
+
+
+
+size_t estimateExtractionMemory(int numberOfAtoms, int numberOfFrames, int numberOfLayerSets, int numberOfThreads, size_t scratchMemoryLimit, bool sasa,
+                                bool mappedLayers){
+    const size_t atoms = glm::max(numberOfAtoms, 0);
+    //results: the layers (one byte per atom, see LayerStore) and areas of each frame and layer set
+    const size_t perFrame = sizeof(int) + 2*sizeof(QVector<float>) + atoms*(((mappedLayers) ? 0 : 1) + ((sasa) ? sizeof(float) : 0));
+    const size_t results = perFrame*glm::max(numberOfFrames, 0)*glm::max(numberOfLayerSets, 0);
+    //per thread: the decoded frame, the neighbour lists (about 64 neighbours per atom including the skin), the widened
+    //layers of the current frame and the scratch memory
+    const size_t perAtom = sizeof(glm::vec3)*2 + sizeof(glm::uvec3) + sizeof(float) + sizeof(int)*(2 + 64) +
+                           glm::max(numberOfLayerSets, 0)*sizeof(float)*((sasa) ? 2 : 1);
+    const size_t threads = (atoms*perAtom + scratchMemoryLimit)*glm::max(numberOfThreads, 1);
+    return results + threads;
+}
 
 void ExtractSurfaceThread::run(){
-    if(!m_data || m_end < m_start || m_start < 0 || m_propeRadius < 0) {
+    if(!m_data || m_end < m_start || m_start < 0 || m_probeRadii.empty() || m_probeRadii.size() != m_layerSets.size() ||
+            *std::min_element(m_probeRadii.begin(), m_probeRadii.end()) < 0) {
         qDebug()<<__LINE__<<" Warning you are trying to start a extract surface thread with invalid parameters!";
         return;
     }
     TrajectoryStream stream(nullptr,m_data->numberOfAtroms(), &m_data->getOffsets(), m_data->getStream().getFileName());// = m_data->getStream().duplicate(this, 0);
 
+    ExtractionContext context(m_scratchMemoryLimit);
+    context.setPhaseTiming(m_phaseTiming);
+    extractionMetrics& metrics = context.getMetrics();
+    //each frame is extracted into widened layer frames and then stored compactly in the layer sets
+    QVector<Atoms::layerFrame> results(m_layerSets.size());
+    QVector<Atoms::layerFrame*> layerframes(m_layerSets.size());
+    for(int s = 0; s < m_layerSets.size(); s++) layerframes[s] = &results[s];
+    QVector<float> doneLayers;
+    //the statistics of the residues are accumulated while extracting and handed to the layer sets after each block
+    QVector<ResidueStatistics> statistics(m_layerSets.size(), ResidueStatistics(m_data->getGroupStartIDs(), m_data->numberOfAtroms()));
     QElapsedTimer timer;
-    try {
-        for(int i = m_start; i <= m_end && i < (int)m_data->numberOfFrames() && !isInterruptionRequested(); i++){
-            timer.restart();
-            extractSurface(m_data->getAtoms(),  stream.getFrame(i), m_data->getLayer(i), m_propeRadius);
-            //Benchmark
-            const float time = timer.nsecsElapsed()/1000000.f;
-            const int count = i-m_start;
-            if(count == 0) m_averageTime = time;
-            else{
-                m_averageTime = (m_averageTime*count + time)/(float)(count+1);
+    QElapsedTimer wallTimer;
+    wallTimer.start();
+    int extracted = 0;
+    //without a queue all frames are one block
+    ExtractionQueue::block block;
+    block.first = m_start;
+    block.last = m_end;
+    bool more = (m_queue) ? m_queue->next(block) : true;
+    //the memory of the job is checked before it starts (estimateExtractionMemory) and the scratch memory is
+    //bounded by the context, a frame that doesn't fit into it is left invalid (maxLayer -1)
+    while(more && !isInterruptionRequested()){
+        for(ResidueStatistics& s: statistics) s.reset();
+        for(int i = block.first; i <= block.last && i < (int)m_data->numberOfFrames() && !isInterruptionRequested(); i++){
+            //frames already stored in all checkpoints are skipped
+            const bool done = !m_checkpoints.empty() && std::all_of(m_checkpoints.begin(), m_checkpoints.end(),
+                    [i](const QSharedPointer<LayerCheckpoint>& checkpoint){ return checkpoint && checkpoint->isDone(i); });
+            if(!done){
+                timer.restart();
+                //the frame is decoded once for all probe radii
+                phaseTimer decodeTimer(&metrics.decodeTime);
+                const TrajectoryStream::xtcFrame& frame = stream.getFrame(i);
+                decodeTimer.switchTo(nullptr);
+                const bool extractedFrame = extractSurface(m_data->getAtoms(), frame, m_probeRadii, layerframes, context, m_roi, m_sasaPoints);
+                for(int s = 0; s < m_layerSets.size(); s++){
+                    m_data->getLayerSet(m_layerSets[s]).frames.setFrame(i, results[s].maxLayer, results[s].layers, results[s].sasa);
+                    statistics[s].addFrame(i, results[s].maxLayer, results[s].layers);
+                }
+                //a frame that overflowed the scratch memory stays invalid (counted in the metrics), it is neither
+                //checkpointed nor timed, so a resumed extraction tries it again
+                if(extractedFrame){
+                    for(int s = 0; s < m_checkpoints.size(); s++)
+                        if(m_checkpoints[s] && !m_checkpoints[s]->isDone(i)) m_checkpoints[s]->append(i, *layerframes[s]);
+                    //Benchmark
+                    const float time = timer.nsecsElapsed()/1000000.f;
+                    if(extracted == 0) m_averageTime = time;
+                    else{
+                        m_averageTime = (m_averageTime*extracted + time)/(float)(extracted+1);
+                    }
+                    extracted++;
+                }
+            }else{
+                //resumed frames were loaded into the layer sets before
+                for(int s = 0; s < m_layerSets.size(); s++){
+                    const LayerStore& frames = m_data->getLayerSet(m_layerSets[s]).frames;
+                    frames.fill(i, doneLayers);
+                    statistics[s].addFrame(i, frames.maxLayer(i), doneLayers);
+                }
             }
             //progress
-            m_remainingFrames = m_end - i;
-            m_progress = count/(float)(m_end-m_start);
+            if(m_queue){
+                m_remainingFrames = m_queue->remainingFrames();
+                m_progress = m_queue->getProgress();
+            }else{
+                m_remainingFrames = m_end - i;
+                m_progress = (m_end > m_start) ? (i-m_start)/(float)(m_end-m_start) : 1.f;
+            }
+            QMutexLocker locker(&m_metricsMutex);
+            m_metrics = metrics;
+            m_metrics.wallTime = wallTimer.nsecsElapsed();
         }
-    } catch (std::bad_alloc& e) {
-        qDebug()<<"Out of available memory! "<<e.what();
-        m_data->getLayer(m_start).maxLayer = -1;
-        m_data->getLayer(m_start).layers.clear();
-        m_data->getLayer(m_start+1).maxLayer = -1;
-        m_data->getLayer(m_start+1).layers.clear();
+        for(int s = 0; s < m_layerSets.size(); s++) m_data->addResidueStatistics(m_layerSets[s], statistics[s]);
+        more = m_queue && m_queue->next(block);
     }
+    QMutexLocker locker(&m_metricsMutex);
+    m_metrics = metrics;
+    m_metrics.wallTime = wallTimer.nsecsElapsed();
 }
 
@@ -31,7 +31,109 @@
 #define LIBRARIES_ATOMS_PROTEINSURFACE_H_
 
 #include <Atoms/Atoms.h>
+#include <Util/Arena.h>
+#include <Util/NeighbourList.h>
 #include <QThread>
+#include <QSharedPointer>
+#include <QMutex>
+#include <QJsonObject>
+
+class LayerCheckpoint;
+class ExtractionQueue;
+
+/// Default maximum of scratch memory a single extraction thread may use.
+#define DEFAULT_SCRATCH_MEMORY_LIMIT (256u*1024u*1024u)
+
+/*!
+ * @brief Throughput counters of an extraction, summed over all extracted frames.
+ * All times are in nanoseconds. The intersection and end point times are only
+ * measured if phase timing is enabled, as they are taken for every atom.
+ */
+struct extractionMetrics{
+    int threads = 1; /// Number of threads the metrics were merged from
+    int frames = 0; /// Extracted frames
+    qint64 atoms = 0; /// Extracted atoms of all frames, the solvent is not counted
+    qint64 peelIterations = 0; /// Peeling passes of all frames and probe radii, one per layer
+    int neighbourListRebuilds = 0;
+    int failedFrames = 0; /// Frames left invalid, as they needed more scratch memory than the limit
+    size_t peakScratchMemory = 0; /// Most scratch memory a single frame used, in bytes
+
+    qint64 decodeTime = 0; /// Reading and decompressing the frames
+    qint64 gridTime = 0; /// Refitting the grid and rebuilding the neighbour lists
+    qint64 neighbourTime = 0; /// Sorting the neighbours of each atom into the cache
+    qint64 intersectionTime = 0; /// Intersecting the extended spheres and pairing the cutting faces
+    qint64 endPointTime = 0; /// Testing the end points against the cutting faces
+    qint64 extractionTime = 0; /// Whole extractSurface calls, including the phases above
+    qint64 wallTime = 0; /// Since the thread started, including checkpoints and idle time
+
+    double framesPerSecond() const;
+    double atomsPerSecond() const;
+    /// Share of the wall time of all threads spent decoding and extracting.
+    double utilisation() const;
+
+    /// Adds the counters of another thread. The wall time is the longer one, as the threads run in parallel.
+    void merge(const extractionMetrics& other);
+
+    QJsonObject toJson() const;
+};
+
+/*!
+ * @brief Memory reused by consecutive extractSurface calls of one thread.
+ * The neighbour grid is refitted each frame, the neighbour lists are only rebuilt once
+ * an atom moved too far, and all temporary data of the extraction is taken from an arena that is reset each frame. So after the first
+ * frames no more heap allocations are done and the scratch memory stays below the given limit.
+ */
+class ExtractionContext{
+public:
+    ExtractionContext(size_t scratchMemoryLimit = DEFAULT_SCRATCH_MEMORY_LIMIT);
+
+    inline Arena& getArena() { return m_arena; }
+    inline BucketGrid<int>& getGrid() { return m_neighbourList.getGrid(); }
+    inline NeighbourList& getNeighbourList() { return m_neighbourList; }
+    /// The non-solvent atoms, which are the only ones extracted, and their neighbour list cutoffs.
+    inline QVector<int>& getInserted() { return m_inserted; }
+    inline QVector<float>& getCutoffs() { return m_cutoffs; }
+    /// Role of each atom, if only a region of interest is extracted.
+    inline QVector<char>& getRegion() { return m_region; }
+    /// Evenly distributed points on the unit sphere, used for the accessible area.
+    const QVector<glm::vec3>& getSpherePoints(int numberOfPoints);
+
+    /// Counters of all extractions done with this context, see extractionMetrics.
+    inline extractionMetrics& getMetrics() { return m_metrics; }
+    inline bool hasPhaseTiming() const { return m_phaseTiming; }
+    /// Also measures the intersection and end point time of each atom, which slows the extraction down by up to ten percent.
+    inline void setPhaseTiming(bool enable) { m_phaseTiming = enable; }
+private:
+    Arena m_arena;
+    NeighbourList m_neighbourList;
+    QVector<int> m_inserted;
+    QVector<float> m_cutoffs;
+    QVector<char> m_region;
+    QVector<glm::vec3> m_spherePoints;
+    extractionMetrics m_metrics;
+    bool m_phaseTiming = false;
+};
+
+/*!
+ * @brief Restricts the extraction to the surroundings of a set of atoms, like a binding pocket.
+ *
+ * The layer of an atom depends on the atoms peeled before it, so only the atoms
+ * that can influence the region of interest within the first exactLayers peeling
+ * steps are extracted. An extended sphere can only be cut by spheres closer than
+ * R = 2*(max atom radius + probe radius). Atoms further than exactLayers*R away from
+ * every atom of interest are never peeled and always cut, like a frozen shell.
+ * This gives the following accuracy bounds for the atoms of interest:
+ * - Layers up to exactLayers are exact.
+ * - A layer above exactLayers is an upper bound, the exact layer lies between exactLayers+1 and it.
+ *
+ * Atoms outside of the region of interest are reported as layer 0, like water.
+ */
+struct regionOfInterest{
+    QVector<int> atoms; /// The atoms of interest, if empty the whole model is extracted
+    int exactLayers = 3; /// Layers up to this depth are exact
+
+    inline bool empty() const { return atoms.empty(); }
+};
 
 /*!
  * @brief Extracts the SAS layers for a given model and frame.
@@ -55,11 +157,44 @@
  */
 int extractSurface(const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, Atoms::layerFrame& layerframe, float propeRadius);
 
+/*!
+ * @brief Same as above, but reuses the memory of the given context.
+ * @returns Maximum extracted layer or -1 if the scratch memory limit of the context was reached.
+ */
+int extractSurface(const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, Atoms::layerFrame& layerframe, float propeRadius, ExtractionContext& context);
+
+/*!
+ * @brief Extracts the SAS layers of one frame for several probe radii at once.
+ * The neighbour grid and the neighbour search of each atom are shared by all radii,
+ * so extracting n radii is considerably cheaper than n separate runs.
+ * @param probeRadii The radii used for the extended spheres.
+ * @param layerframes Output layer data, one for each probe radius.
+ * @param roi If not empty, only the layers of the region of interest are extracted.
+ * @param sasaPoints If greater than 0, the solvent accessible surface area of each atom is computed
+ *        with this many Shrake-Rupley points per atom and stored in Atoms::layerFrame::sasa.
+ *        A point of an extended sphere is covered by a neighbour exactly if it lies in front of
+ *        the cutting face of the neighbour, so the faces found for the outermost layer are reused.
+ *        Atoms below the outermost layer have no accessible area.
+ * @returns false if the scratch memory limit of the context was reached, the remaining layer frames are then invalid.
+ */
+bool extractSurface(const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, const QVector<float>& probeRadii, const QVector<Atoms::layerFrame*>& layerframes, ExtractionContext& context,
+                    const regionOfInterest& roi = regionOfInterest(), int sasaPoints = 0);
+
 ///@brief Used for debugging.
 void debugExtractSurface(const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, Atoms::layerFrame& layerframe, float propeRadius, int atomID);
 ///@brief Used for debugging.
 void debugFindEndPoints(QString& debugOut, const QVector<Atoms::atom>& model,const TrajectoryStream::xtcFrame& frame, float propeRadius, int condidate, int a, int b);
 
+/*!
+ * @brief Estimates the memory an extraction job needs, so it can be rejected before it starts.
+ * This includes the layers (and areas, if sasa is true) of every extracted frame and layer set
+ * and for each thread its scratch memory limit, neighbour lists and decoded frame.
+ * @param mappedLayers If true, the layers are written into mapped files (see LayerStore::create) and not counted.
+ * @returns The estimated number of bytes.
+ */
+size_t estimateExtractionMemory(int numberOfAtoms, int numberOfFrames, int numberOfLayerSets, int numberOfThreads,
+                                size_t scratchMemoryLimit = DEFAULT_SCRATCH_MEMORY_LIMIT, bool sasa = false, bool mappedLayers = false);
+
 /*!
  * @brief Each thread receives a window of the trajectory to process.
  * Frames of the trajectory are divided into n-parts and processed
@@ -70,25 +205,64 @@ class ExtractSurfaceThread : public QThread
 {
     Q_OBJECT
 public:
-	ExtractSurfaceThread(Atoms* data, int startFrame, int endFrame, float propeRadius, QObject *parent = nullptr);
+	/*!
+	 * @param probeRadii The probe radii extracted from each decoded frame.
+	 * @param layerSets For each probe radius the layer set of data that receives the result.
+	 */
+	ExtractSurfaceThread(Atoms* data, int startFrame, int endFrame, const QVector<float>& probeRadii, const QVector<int>& layerSets, QObject *parent = nullptr);
     virtual ~ExtractSurfaceThread();
     float getProgress() const;
 
+    /// Sets the maximum of scratch memory in bytes this thread may use. Must be called before the thread is started.
+    void setScratchMemoryLimit(size_t bytes);
+
+    /// Restricts the extraction to a region of interest. Must be called before the thread is started.
+    void setRegionOfInterest(const regionOfInterest& roi);
+
+    /*!
+     * @brief Stores each extracted frame in the given checkpoints, one for each layer set.
+     * Frames already done in all checkpoints are skipped. Must be called before the thread is started.
+     */
+    void setCheckpoints(const QVector<QSharedPointer<LayerCheckpoint>>& checkpoints);
+
+    /*!
+     * @brief Takes the frames from a queue shared with other threads instead of extracting startFrame to endFrame,
+     * the progress and remaining frames are then those of the queue. Must be called before the thread is started.
+     */
+    void setQueue(const QSharedPointer<ExtractionQueue>& queue);
+
+    /// Also computes the accessible surface area of each atom with the given number of points per atom, 0 disables it. Must be called before the thread is started.
+    void setSASAPoints(int points);
+
+    /// Also measures the intersection and end point time, see ExtractionContext::setPhaseTiming. Must be called before the thread is started.
+    void setPhaseTiming(bool enable);
+
     //Benchmark
     float getAverageTime() const;
     int getRemainingFrames() const;
+    /// @returns A copy of the metrics of the frames extracted so far, can be called while the thread is running.
+    extractionMetrics getMetrics() const;
 protected:
     void run();
 private:
     Atoms* m_data = nullptr;
     int m_start;
     int m_end;
-    float m_propeRadius;
+    QVector<float> m_probeRadii;
+    QVector<int> m_layerSets;
     int m_remainingFrames;
+    size_t m_scratchMemoryLimit = DEFAULT_SCRATCH_MEMORY_LIMIT;
+    regionOfInterest m_roi;
+    QVector<QSharedPointer<LayerCheckpoint>> m_checkpoints;
+    QSharedPointer<ExtractionQueue> m_queue;
+    int m_sasaPoints = 0;
+    bool m_phaseTiming = false;
 
     float m_progress = 0;
     //Benchmark
     float m_averageTime = -99999;
+    extractionMetrics m_metrics;
+    mutable QMutex m_metricsMutex;
 };
 
 #endif /* LIBRARIES_ATOMS_PROTEINSURFACE_H_ */
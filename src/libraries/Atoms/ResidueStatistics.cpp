@@ -0,0 +1,120 @@
+/*
+ * ResidueStatistics.cpp
+ *
+ *  Created on: 04.05.2017
+ *      Author: Vladimir Ageev
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#include <Atoms/ResidueStatistics.h>
+
+#include <algorithm>
+
+ResidueStatistics::ResidueStatistics(){}
+
+ResidueStatistics::ResidueStatistics(const QVector<int>& groupStartIDs, int numberOfAtoms):
+    m_groupStartIDs(groupStartIDs), m_numberOfAtoms(numberOfAtoms), m_residues(groupStartIDs.size()){}
+
+ResidueStatistics::~ResidueStatistics(){}
+
+void ResidueStatistics::addFrame(int frame, int maxLayer, const QVector<float>& layers){
+    if(maxLayer < 0 || layers.size() < m_numberOfAtoms) return;
+    if(m_firstFrame < 0) m_firstFrame = frame;
+    m_lastFrame = frame;
+    m_numberOfFrames++;
+    for(int g = 0; g < m_residues.size(); g++){
+        const int start = m_groupStartIDs[g];
+        const int end = (g == m_groupStartIDs.size() - 1) ? m_numberOfAtoms : m_groupStartIDs[g + 1];
+        if(end <= start) continue;
+        float sum = 0;
+        bool surface = false;
+        for(int i = start; i < end; i++){
+            sum += layers[i];
+            if(layers[i] == 0) surface = true;
+        }
+        const double depth = sum/(end - start);
+
+        residue& r = m_residues[g];
+        r.frames++;
+        const double delta = depth - r.mean;
+        r.mean += delta/r.frames;
+        r.m2 += delta*(depth - r.mean);
+        if(surface) r.surfaceFrames++;
+        const qint8 state = (surface) ? 1 : 0;
+        if(r.lastState >= 0 && r.lastState != state) r.transitions++;
+        if(r.firstState < 0) r.firstState = state;
+        r.lastState = state;
+    }
+}
+
+void ResidueStatistics::reset(){
+    std::fill(m_residues.begin(), m_residues.end(), residue());
+    m_firstFrame = m_lastFrame = -1;
+    m_numberOfFrames = 0;
+}
+
+void ResidueStatistics::merge(const ResidueStatistics& other){
+    if(other.empty()) return;
+    if(empty()){
+        *this = other;
+        return;
+    }
+    if(other.m_residues.size() != m_residues.size()) return;
+    for(int g = 0; g < m_residues.size(); g++){
+        residue& a = m_residues[g];
+        const residue& b = other.m_residues[g];
+        if(!b.frames) continue;
+        if(!a.frames){
+            a = b;
+            continue;
+        }
+        //the parallel variant of Welford's algorithm by Chan et al.
+        const int frames = a.frames + b.frames;
+        const double delta = b.mean - a.mean;
+        a.mean += delta*b.frames/frames;
+        a.m2 += b.m2 + delta*delta*a.frames*(double)b.frames/frames;
+        a.frames = frames;
+        a.surfaceFrames += b.surfaceFrames;
+        a.transitions += b.transitions + ((a.lastState != b.firstState) ? 1 : 0);
+        a.lastState = b.lastState;
+    }
+    m_lastFrame = other.m_lastFrame;
+    m_numberOfFrames += other.m_numberOfFrames;
+}
+
+ResidueStatistics ResidueStatistics::merged(QList<ResidueStatistics> parts){
+    std::sort(parts.begin(), parts.end(), [](const ResidueStatistics& a, const ResidueStatistics& b){ return a.m_firstFrame < b.m_firstFrame; });
+    ResidueStatistics result;
+    //a part overlapping an earlier one can't be appended
+    for(const ResidueStatistics& part: parts)
+        if(!result.overlaps(part)) result.merge(part);
+    return result;
+}
+
+bool ResidueStatistics::overlaps(const ResidueStatistics& other) const{
+    return !empty() && !other.empty() && m_firstFrame <= other.m_lastFrame && other.m_firstFrame <= m_lastFrame;
+}
+
+ResidueStatistics::residue ResidueStatistics::get(int groupIndex) const{
+    if(groupIndex < 0 || groupIndex >= m_residues.size()) return residue();
+    return m_residues[groupIndex];
+}
@@ -0,0 +1,102 @@
+/**
+ * @file   		ResidueStatistics.h
+ * @author 		Vladimir Ageev
+ * @date   		04.05.2017
+ *
+ * @brief  		Statistics of each residue over time, accumulated in one pass while the frames are extracted.
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#ifndef LIBRARIES_ATOMS_RESIDUESTATISTICS_H_
+#define LIBRARIES_ATOMS_RESIDUESTATISTICS_H_
+
+#include <QVector>
+#include <QList>
+#include <QtGlobal>
+
+/*!
+ * @brief Mean depth, its variance, the fraction of time on the surface and the number of surface transitions of each residue.
+ *
+ * The depth of a residue in a frame is the average layer of its atoms, it is on the surface if at least one
+ * of its atoms is in the outermost layer 0. The frames have to be added in order, so each extraction thread
+ * accumulates its own frame range and the ranges are merged afterwards (see merged()).
+ * The mean and variance use Welford's algorithm, which is numerically stable in a single pass.
+ */
+class ResidueStatistics {
+public:
+	struct residue {
+		int frames = 0; /// Number of accumulated frames
+		double mean = 0; /// Mean depth
+		double m2 = 0; /// Sum of the squared differences from the mean
+		int surfaceFrames = 0; /// Frames on the surface
+		int transitions = 0; /// Changes between on and below the surface from one accumulated frame to the next
+		qint8 firstState = -1; /// 1 if the first frame was on the surface, 0 if not, -1 if there are no frames
+		qint8 lastState = -1;
+
+		/// @returns The population variance of the depth.
+		inline double variance() const { return (frames) ? m2/frames : 0.0; }
+		/// @returns The fraction of frames on the surface, between 0 and 1.
+		inline double surfaceFraction() const { return (frames) ? surfaceFrames/(double)frames : 0.0; }
+	};
+
+	ResidueStatistics();
+	/// @param groupStartIDs The first atom of each residue, see Atoms::getGroupStartIDs.
+	ResidueStatistics(const QVector<int>& groupStartIDs, int numberOfAtoms);
+	virtual ~ResidueStatistics();
+
+	/*!
+	 * @brief Adds a frame, which must come after all frames added so far. Invalid frames (maxLayer -1) are ignored.
+	 * @param layers The layer of each atom.
+	 */
+	void addFrame(int frame, int maxLayer, const QVector<float>& layers);
+
+	/// Removes all frames, keeping the memory.
+	void reset();
+
+	/// Appends the statistics of frames that all come after the frames of this one.
+	void merge(const ResidueStatistics& other);
+
+	/// Merges statistics of disjoint frame ranges in the order of their frames, parts overlapping an earlier part are skipped.
+	static ResidueStatistics merged(QList<ResidueStatistics> parts);
+
+	/// @returns true if the frame ranges of both statistics overlap.
+	bool overlaps(const ResidueStatistics& other) const;
+
+	inline bool empty() const { return m_firstFrame < 0; }
+	inline int firstFrame() const { return m_firstFrame; }
+	inline int lastFrame() const { return m_lastFrame; }
+	/// @returns The number of valid frames added or merged.
+	inline int numberOfFrames() const { return m_numberOfFrames; }
+	inline int numberOfGroups() const { return m_residues.size(); }
+	/// @returns The statistics of a residue, empty ones if the index is out of range.
+	residue get(int groupIndex) const;
+
+private:
+	QVector<int> m_groupStartIDs;
+	int m_numberOfAtoms = 0;
+	QVector<residue> m_residues;
+	int m_firstFrame = -1; /// First added frame, -1 if none
+	int m_lastFrame = -1;
+	int m_numberOfFrames = 0;
+};
+
+#endif /* LIBRARIES_ATOMS_RESIDUESTATISTICS_H_ */
@@ -0,0 +1,193 @@
+/*
+ * SurfaceKernels.cpp
+ *
+ *  Created on: 04.05.2017
+ *      Author: Vladimir Ageev
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#include <SurfaceKernels.h>
+
+#include <cmath>
+
+#if SURFACE_SIMD_WIDTH > 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Thin wrappers around the intrinsics, so the kernels are written once for every width.
+ * All wrappers perform exactly the same IEEE operations as the scalar code, so
+ * the results do not depend on the used instruction set. This needs -ffp-contract=off
+ * next to -march=native (see QTProject.cmake), otherwise the scalar code may be fused into FMAs.
+ */
+namespace {
+
+#if SURFACE_SIMD_WIDTH == 16
+typedef __m512 simdf;
+inline simdf vload(const float* p){ return _mm512_loadu_ps(p); }
+inline void vstore(float* p, simdf a){ _mm512_storeu_ps(p, a); }
+inline simdf vset1(float a){ return _mm512_set1_ps(a); }
+inline simdf vadd(simdf a, simdf b){ return _mm512_add_ps(a, b); }
+inline simdf vsub(simdf a, simdf b){ return _mm512_sub_ps(a, b); }
+inline simdf vmul(simdf a, simdf b){ return _mm512_mul_ps(a, b); }
+inline simdf vdiv(simdf a, simdf b){ return _mm512_div_ps(a, b); }
+inline simdf vsqrt(simdf a){ return _mm512_sqrt_ps(a); }
+inline unsigned vgreaterEqual(simdf a, simdf b){ return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+inline unsigned vgreater(simdf a, simdf b){ return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+#elif SURFACE_SIMD_WIDTH == 8
+typedef __m256 simdf;
+inline simdf vload(const float* p){ return _mm256_loadu_ps(p); }
+inline void vstore(float* p, simdf a){ _mm256_storeu_ps(p, a); }
+inline simdf vset1(float a){ return _mm256_set1_ps(a); }
+inline simdf vadd(simdf a, simdf b){ return _mm256_add_ps(a, b); }
+inline simdf vsub(simdf a, simdf b){ return _mm256_sub_ps(a, b); }
+inline simdf vmul(simdf a, simdf b){ return _mm256_mul_ps(a, b); }
+inline simdf vdiv(simdf a, simdf b){ return _mm256_div_ps(a, b); }
+inline simdf vsqrt(simdf a){ return _mm256_sqrt_ps(a); }
+inline unsigned vgreaterEqual(simdf a, simdf b){ return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ)); }
+inline unsigned vgreater(simdf a, simdf b){ return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+#elif SURFACE_SIMD_WIDTH == 4
+typedef __m128 simdf;
+inline simdf vload(const float* p){ return _mm_loadu_ps(p); }
+inline void vstore(float* p, simdf a){ _mm_storeu_ps(p, a); }
+inline simdf vset1(float a){ return _mm_set1_ps(a); }
+inline simdf vadd(simdf a, simdf b){ return _mm_add_ps(a, b); }
+inline simdf vsub(simdf a, simdf b){ return _mm_sub_ps(a, b); }
+inline simdf vmul(simdf a, simdf b){ return _mm_mul_ps(a, b); }
+inline simdf vdiv(simdf a, simdf b){ return _mm_div_ps(a, b); }
+inline simdf vsqrt(simdf a){ return _mm_sqrt_ps(a); }
+inline unsigned vgreaterEqual(simdf a, simdf b){ return _mm_movemask_ps(_mm_cmpge_ps(a, b)); }
+inline unsigned vgreater(simdf a, simdf b){ return _mm_movemask_ps(_mm_cmpgt_ps(a, b)); }
+#else
+typedef float simdf;
+inline simdf vload(const float* p){ return *p; }
+inline void vstore(float* p, simdf a){ *p = a; }
+inline simdf vset1(float a){ return a; }
+inline simdf vadd(simdf a, simdf b){ return a + b; }
+inline simdf vsub(simdf a, simdf b){ return a - b; }
+inline simdf vmul(simdf a, simdf b){ return a * b; }
+inline simdf vdiv(simdf a, simdf b){ return a / b; }
+inline simdf vsqrt(simdf a){ return std::sqrt(a); }
+inline unsigned vgreaterEqual(simdf a, simdf b){ return a >= b; }
+inline unsigned vgreater(simdf a, simdf b){ return a > b; }
+#endif
+
+const unsigned ALL_LANES = (1u << SURFACE_SIMD_WIDTH) - 1u;
+
+} // namespace
+
+bool intersectSpheres(const sphereBatch& batch, const glm::vec3& posC, float radiusC, ArenaVector<cuttingFace>& cutPlanes){
+    if(batch.empty()) return false;
+    Q_ASSERT(batch.x.size() % SURFACE_SIMD_WIDTH == 0);
+
+    const simdf cx = vset1(posC.x);
+    const simdf cy = vset1(posC.y);
+    const simdf cz = vset1(posC.z);
+    const simdf rC = vset1(radiusC);
+    const simdf rC2 = vmul(rC, rC);
+    const simdf one = vset1(1.f);
+    const simdf minusOne = vset1(-1.f);
+    const simdf two = vset1(2.f);
+
+    // per lane results of the current chunk, written out for the scalar face emission
+    float nx[SURFACE_SIMD_WIDTH], ny[SURFACE_SIMD_WIDTH], nz[SURFACE_SIMD_WIDTH];
+    float ox[SURFACE_SIMD_WIDTH], oy[SURFACE_SIMD_WIDTH], oz[SURFACE_SIMD_WIDTH];
+    float faceRadius[SURFACE_SIMD_WIDTH], normCut[SURFACE_SIMD_WIDTH], normRadius[SURFACE_SIMD_WIDTH];
+
+    const int paddedSize = batch.x.size();
+    for(int i = 0; i < paddedSize; i += SURFACE_SIMD_WIDTH){
+        const simdf rB = vload(batch.radius.constData()+i); //extended sphere radius of sphere B
+        //vector between both spheres
+        const simdf dx = vsub(vload(batch.x.constData()+i), cx);
+        const simdf dy = vsub(vload(batch.y.constData()+i), cy);
+        const simdf dz = vsub(vload(batch.z.constData()+i), cz);
+        const simdf distance = vsqrt(vadd(vadd(vmul(dx, dx), vmul(dy, dy)), vmul(dz, dz)));
+
+        //r_b > distance + r_a neighbor fully eats the sphere, case c or d
+        if(vgreaterEqual(rB, vadd(distance, rC))) return true;
+
+        //ball out if radius or is inside, case a or b
+        const unsigned disjoint = vgreaterEqual(distance, vadd(rB, rC)) | vgreaterEqual(rC, vadd(distance, rB));
+        const unsigned intersecting = ~disjoint & ALL_LANES;
+        if(!intersecting) continue;
+
+        //(distance^2 - r_b^2 + r_a^2) / (2distance)
+        const simdf cutDistance = vdiv(vadd(vsub(vmul(distance, distance), vmul(rB, rB)), rC2), vmul(two, distance));
+        const simdf invLength = vdiv(one, distance);
+        const simdf normalX = vmul(dx, invLength);
+        const simdf normalY = vmul(dy, invLength);
+        const simdf normalZ = vmul(dz, invLength);
+        const simdf cut = vdiv(vmul(minusOne, cutDistance), rC);
+
+        vstore(nx, normalX); vstore(ny, normalY); vstore(nz, normalZ);
+        vstore(ox, vadd(cx, vmul(normalX, cutDistance)));
+        vstore(oy, vadd(cy, vmul(normalY, cutDistance)));
+        vstore(oz, vadd(cz, vmul(normalZ, cutDistance)));
+        vstore(faceRadius, vsqrt(vsub(rC2, vmul(cutDistance, cutDistance))));
+        vstore(normCut, cut);
+        vstore(normRadius, vsqrt(vsub(one, vmul(cut, cut))));
+
+        for(int lane = 0; lane < SURFACE_SIMD_WIDTH; lane++){
+            if(!(intersecting & (1u << lane))) continue;
+            cutPlanes.push_back( { //create new cutting face
+                                   false,
+                                   glm::vec3(ox[lane], oy[lane], oz[lane]),
+                                   glm::vec3(nx[lane], ny[lane], nz[lane]),
+                                   faceRadius[lane],
+                                   normCut[lane],
+                                   normRadius[lane]
+                                 } );
+        }
+    }
+    return false;
+}
+
+void cullEndPoints(const planeBatch& planes, ArenaVector<glm::vec3>& endPoints, float epsilon){
+    if(planes.empty() || endPoints.empty()) return;
+    Q_ASSERT(planes.cx.size() % SURFACE_SIMD_WIDTH == 0);
+
+    const simdf eps = vset1(epsilon);
+    const int paddedSize = planes.cx.size();
+    int kept = 0;
+    for(int p = 0; p < endPoints.size(); p++){
+        const glm::vec3 point = endPoints[p];
+        const simdf px = vset1(point.x);
+        const simdf py = vset1(point.y);
+        const simdf pz = vset1(point.z);
+
+        bool pointRemoved = false;
+        for(int i = 0; i < paddedSize; i += SURFACE_SIMD_WIDTH){
+            //dot(p - center, normal)
+            const simdf dot = vadd(vadd(
+                    vmul(vsub(px, vload(planes.cx.constData()+i)), vload(planes.nx.constData()+i)),
+                    vmul(vsub(py, vload(planes.cy.constData()+i)), vload(planes.ny.constData()+i))),
+                    vmul(vsub(pz, vload(planes.cz.constData()+i)), vload(planes.nz.constData()+i)));
+            if(vgreater(dot, eps)){//point is in front of a plane
+                pointRemoved = true;
+                break;
+            }
+        }
+        if(!pointRemoved) //point hasn't been removed, so we keep it
+            endPoints[kept++] = point;
+    }
+    endPoints.resize(kept);
+}
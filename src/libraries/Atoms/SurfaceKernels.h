@@ -0,0 +1,173 @@
+/**
+ * @file   		SurfaceKernels.h
+ * @author 		Vladimir Ageev
+ * @date   		04.05.2017
+ *
+ * @brief  		Vectorized building blocks of the surface extraction.
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#ifndef LIBRARIES_ATOMS_SURFACEKERNELS_H_
+#define LIBRARIES_ATOMS_SURFACEKERNELS_H_
+
+#include <glm/glm.hpp>
+#include <Util/Arena.h>
+
+/// Number of floats processed at once by the kernels. Depends on the instruction set the library is compiled for.
+#if defined(__AVX512F__)
+#define SURFACE_SIMD_WIDTH 16
+#elif defined(__AVX__)
+#define SURFACE_SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64)
+#define SURFACE_SIMD_WIDTH 4
+#else
+#define SURFACE_SIMD_WIDTH 1
+#endif
+
+/// @returns size rounded up to the next multiple of SURFACE_SIMD_WIDTH.
+inline int paddedSize(int size){
+    return ((size + SURFACE_SIMD_WIDTH - 1)/SURFACE_SIMD_WIDTH)*SURFACE_SIMD_WIDTH;
+}
+
+/*!
+ * @brief Cutting face definition
+ */
+struct cuttingFace{
+    bool discarded; /// If true then this face can be ignored
+    glm::vec3 center; /// The center of the plane (o), see figure 24
+    glm::vec3 normal; /// Normal of the plane. Used for in-front tests. (n), see figure 24
+    float radius; /// The radius of the intersection sphere (r_c)
+    float normCutDistance; /// Cut distance on unit sphere
+    float normRadius;
+};
+
+/*!
+ * @brief Extended spheres stored as structure of arrays, so they can be processed by the SIMD kernels.
+ * The arrays are padded to a multiple of SURFACE_SIMD_WIDTH with spheres that are far away
+ * and therefore disjoint to every sphere of the model.
+ */
+struct sphereBatch{
+    ArenaVector<float> x;
+    ArenaVector<float> y;
+    ArenaVector<float> z;
+    ArenaVector<float> radius;
+
+    explicit sphereBatch(Arena& arena): x(arena), y(arena), z(arena), radius(arena){}
+
+    inline int size() const { return m_count; }
+    inline bool empty() const { return m_count == 0; }
+
+    /// Removes all spheres but keeps the memory.
+    inline void clear(){
+        m_count = 0;
+        x.clear(); y.clear(); z.clear(); radius.clear();
+    }
+
+    inline void push(const glm::vec3& pos, float r){
+        x.push_back(pos.x); y.push_back(pos.y); z.push_back(pos.z); radius.push_back(r);
+        m_count++;
+    }
+
+    /*!
+     * @brief Must be called after the last push, before the batch is given to a kernel.
+     * @returns false if the arena ran out of memory and the batch is incomplete.
+     */
+    inline bool pad(){
+        const int padded = paddedSize(x.size());
+        if(!x.reserve(padded) || !y.reserve(padded) || !z.reserve(padded) || !radius.reserve(padded)) return false;
+        while(x.size() < padded){
+            x.push_back(1e10f); y.push_back(1e10f); z.push_back(1e10f); radius.push_back(0.f);
+        }
+        return y.size() == padded && z.size() == padded && radius.size() == padded;
+    }
+private:
+    int m_count = 0;
+};
+
+/*!
+ * @brief The centers and normals of cutting faces stored as structure of arrays.
+ * The arrays are padded to a multiple of SURFACE_SIMD_WIDTH with faces that cut nothing.
+ */
+struct planeBatch{
+    ArenaVector<float> cx;
+    ArenaVector<float> cy;
+    ArenaVector<float> cz;
+    ArenaVector<float> nx;
+    ArenaVector<float> ny;
+    ArenaVector<float> nz;
+
+    explicit planeBatch(Arena& arena): cx(arena), cy(arena), cz(arena), nx(arena), ny(arena), nz(arena){}
+
+    inline int size() const { return m_count; }
+    inline bool empty() const { return m_count == 0; }
+
+    /// Removes all faces but keeps the memory.
+    inline void clear(){
+        m_count = 0;
+        cx.clear(); cy.clear(); cz.clear();
+        nx.clear(); ny.clear(); nz.clear();
+    }
+
+    inline void push(const cuttingFace& face){
+        cx.push_back(face.center.x); cy.push_back(face.center.y); cz.push_back(face.center.z);
+        nx.push_back(face.normal.x); ny.push_back(face.normal.y); nz.push_back(face.normal.z);
+        m_count++;
+    }
+
+    /*!
+     * @brief Must be called after the last push, before the batch is given to a kernel.
+     * @returns false if the arena ran out of memory and the batch is incomplete.
+     */
+    inline bool pad(){
+        const int padded = paddedSize(cx.size());
+        if(!cx.reserve(padded) || !cy.reserve(padded) || !cz.reserve(padded) ||
+           !nx.reserve(padded) || !ny.reserve(padded) || !nz.reserve(padded)) return false;
+        while(cx.size() < padded){
+            cx.push_back(0.f); cy.push_back(0.f); cz.push_back(0.f);
+            nx.push_back(0.f); ny.push_back(0.f); nz.push_back(0.f);
+        }
+        return cy.size() == padded && cz.size() == padded && nx.size() == padded && ny.size() == padded && nz.size() == padded;
+    }
+private:
+    int m_count = 0;
+};
+
+/*!
+ * @brief Intersects the extended sphere C with a batch of extended spheres.
+ * Each sphere of the batch is classified as eating C, disjoint to C (or contained by C)
+ * or intersecting C. For every intersecting sphere a cutting face is appended to cutPlanes,
+ * in the order of the batch.
+ * @param batch The padded neighbouring spheres.
+ * @returns true if any sphere fully eats C, in which case cutPlanes may only be partially filled.
+ */
+bool intersectSpheres(const sphereBatch& batch, const glm::vec3& posC, float radiusC, ArenaVector<cuttingFace>& cutPlanes);
+
+/*!
+ * @brief Removes all end points that are in front of at least one of the given faces.
+ * A point p is in front of a face if dot(p - center, normal) > epsilon.
+ * The remaining points are compacted in place and keep their order.
+ * @param planes The padded cutting faces.
+ * @param endPoints The points to filter.
+ */
+void cullEndPoints(const planeBatch& planes, ArenaVector<glm::vec3>& endPoints, float epsilon);
+
+#endif /* LIBRARIES_ATOMS_SURFACEKERNELS_H_ */
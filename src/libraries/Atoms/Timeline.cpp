@@ -27,7 +27,7 @@
 
 #include <Timeline.h>
 
-static QColor colorWheel[] = { "#f03e70", "#2ec32e", "#3fbeff", "#c32eb0", "#2e9ec3", "#e3bf42", "#97db82" };
+static const quint32 colorWheel[] = { 0xf03e70, 0x2ec32e, 0x3fbeff, 0xc32eb0, 0x2e9ec3, 0xe3bf42, 0x97db82 };
 static unsigned int colorWheelID = 0;
 
 Tracker::Tracker(Timeline* timeline, int frame): QObject(timeline), m_timeline(timeline), m_frame(0), m_color(colorWheel[colorWheelID]){
@@ -35,12 +35,24 @@ Tracker::Tracker(Timeline* timeline, int frame): QObject(timeline), m_timeline(t
 	connect(&m_timer, SIGNAL(timeout()), this, SLOT(next()));
 
 	colorWheelID++;
-	if(colorWheelID >= sizeof(colorWheel)/sizeof(QColor))
+	if(colorWheelID >= sizeof(colorWheel)/sizeof(quint32))
 		colorWheelID = 0;
 }
 
 Tracker::~Tracker(){}
 
+static QString colorName(int red, int green, int blue){
+	return QString("#%1").arg((red << 16) | (green << 8) | blue, 6, 16, QChar('0'));
+}
+
+QString Tracker::getColor() const{
+	return colorName((m_color >> 16) & 0xff, (m_color >> 8) & 0xff, m_color & 0xff);
+}
+
+QString Tracker::getColorGray() const{
+	return colorName(((m_color >> 16) & 0xff)*0.7, ((m_color >> 8) & 0xff)*0.7, (m_color & 0xff)*0.7);
+}
+
 
 //Tracker::Tracker(const Tracker& frame): m_timeline(frame.m_timeline), m_frame(frame.m_frame){}
 
@@ -33,7 +33,6 @@
 #include <QTimer>
 #include <QVector>
 #include <QVariant>
-#include <QColor>
 
 //forward decleration
 class Timeline;
@@ -45,8 +44,8 @@ class Tracker: public QObject {
 	Q_OBJECT
 	Q_PROPERTY(unsigned int frame READ get WRITE set NOTIFY frameChanged)
 	Q_PROPERTY(unsigned int value READ getValue WRITE setValue NOTIFY frameChanged)
-	Q_PROPERTY(QColor color READ getColor NOTIFY colorChanged)
-	Q_PROPERTY(QColor colorGray READ getColorGray NOTIFY colorChanged)
+	Q_PROPERTY(QString color READ getColor NOTIFY colorChanged)
+	Q_PROPERTY(QString colorGray READ getColorGray NOTIFY colorChanged)
 public:
 	/*!
 	 * @brief Constructor of the tracker
@@ -63,8 +62,10 @@ public:
 	//Frame(const Frame& frame);
 	//void operator=(const Frame& frame);
 
-	inline const QColor& getColor() const {return m_color;}
-	inline const QColor getColorGray() const {return QColor(m_color.red()*0.7, m_color.green()*0.7, m_color.blue()*0.7);}
+	/*! @returns The color of the tracker as #rrggbb, which QML and QColor accept. */
+	QString getColor() const;
+	/*! @returns The darkened color of the tracker as #rrggbb. */
+	QString getColorGray() const;
 
 	/*! @see get */
 	inline operator int() const { return m_frame; }
@@ -147,7 +148,7 @@ signals:
 private:
 	Timeline* m_timeline = nullptr; /// Parent timeline
 	int m_frame;
-	QColor m_color;
+	quint32 m_color; /// 0xRRGGBB
 
 	QTimer m_timer;
 };
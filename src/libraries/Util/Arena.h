@@ -0,0 +1,233 @@
+/**
+ * @file   		Arena.h
+ * @author 		Vladimir Ageev (vladimir.agueev@progsys.de)
+ * @date   		04.05.2017
+ *
+ * @brief  		A bump allocator and a vector using it, for short lived scratch data.
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#ifndef LIBRARIES_UTIL_ARENA_H_
+#define LIBRARIES_UTIL_ARENA_H_
+
+#include <QVector>
+#include <QDebug>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <type_traits>
+
+/*!
+ * @brief A bump allocator. Memory is handed out linearly from big blocks and is only freed all at once by reset().
+ *
+ * If the current block is full a new one is chained. On reset() all chained blocks
+ * are merged into a single block of the combined size, so once the arena has seen the
+ * biggest workload, it no longer touches the heap.
+ * The arena never reserves more memory than the given ceiling. If an allocation would
+ * exceed it, nullptr is returned and the arena is marked as overflown until the next reset().
+ */
+class Arena {
+public:
+	Arena(size_t ceiling = 256u*1024u*1024u, size_t blockSize = 1024u*1024u): m_ceiling(ceiling), m_blockSize(blockSize){}
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	virtual ~Arena(){
+		for(const block& b: m_blocks)
+			std::free(b.data);
+	}
+
+	/*!
+	 * @returns Aligned uninitialized memory, or nullptr if the ceiling would be exceeded.
+	 */
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)){
+		while(m_current < m_blocks.size()){
+			block& b = m_blocks[m_current];
+			const size_t start = (m_offset + alignment - 1) & ~(alignment - 1);
+			if(start + bytes <= b.size){
+				m_offset = start + bytes;
+				m_used += bytes;
+				if(m_used > m_peak) m_peak = m_used;
+				return b.data + start;
+			}
+			//try the next chained block
+			m_current++;
+			m_offset = 0;
+		}
+
+		//chain a new block
+		size_t size = std::max(m_blockSize, bytes + alignment);
+		if(m_reserved + size > m_ceiling){
+			if(m_reserved + bytes + alignment > m_ceiling){
+				if(!m_overflown) qDebug()<<__LINE__<<": Scratch memory limit of "<<m_ceiling<<" bytes reached!";
+				m_overflown = true;
+				return nullptr;
+			}
+			size = m_ceiling - m_reserved;
+		}
+		if(!addBlock(size)) return nullptr;
+		m_current = m_blocks.size()-1;
+		return allocate(bytes, alignment);
+	}
+
+	/// @returns Uninitialized memory for count elements of type T, or nullptr if the ceiling would be exceeded.
+	template<typename T>
+	T* allocate(size_t count){
+		return static_cast<T*>(allocate(count*sizeof(T), alignof(T)));
+	}
+
+	/*!
+	 * @brief Frees everything allocated so far, invalidating all pointers into the arena.
+	 * Chained blocks are merged into one, so the next round fits without chaining.
+	 */
+	void reset(){
+		if(m_blocks.size() > 1){
+			const size_t size = m_reserved;
+			for(const block& b: m_blocks)
+				std::free(b.data);
+			m_blocks.resize(0);
+			m_reserved = 0;
+			addBlock(size);
+		}
+		m_current = 0;
+		m_offset = 0;
+		m_used = 0;
+		m_overflown = false;
+	}
+
+	/// Bytes currently handed out.
+	inline size_t getUsed() const { return m_used; }
+	/// Bytes reserved from the heap.
+	inline size_t getReserved() const { return m_reserved; }
+	/// Maximum of handed out bytes since construction.
+	inline size_t getPeak() const { return m_peak; }
+	inline size_t getCeiling() const { return m_ceiling; }
+	/// True if an allocation failed since the last reset.
+	inline bool hasOverflown() const { return m_overflown; }
+
+private:
+	struct block{
+		char* data;
+		size_t size;
+	};
+
+	bool addBlock(size_t size){
+		char* data = static_cast<char*>(std::malloc(size));
+		if(!data){
+			qDebug()<<__LINE__<<": Failed to reserve "<<size<<" bytes of scratch memory!";
+			m_overflown = true;
+			return false;
+		}
+		m_blocks.push_back({data, size});
+		m_reserved += size;
+		return true;
+	}
+
+	QVector<block> m_blocks;
+	int m_current = 0;
+	size_t m_offset = 0;
+
+	size_t m_ceiling;
+	size_t m_blockSize;
+	size_t m_reserved = 0;
+	size_t m_used = 0;
+	size_t m_peak = 0;
+	bool m_overflown = false;
+};
+
+/*!
+ * @brief A minimal vector of plain data elements living inside an Arena.
+ * Growing copies the elements into a bigger chunk of the arena, the old chunk
+ * is only recycled by the next Arena::reset(). If the arena overflows, the vector
+ * stops growing and further elements are dropped, check Arena::hasOverflown().
+ * A vector must not be used after its arena was reset, unless release() is called first.
+ */
+template<typename T>
+class ArenaVector {
+	static_assert(std::is_trivially_destructible<T>::value, "ArenaVector only supports plain data types!");
+public:
+	typedef T* iterator;
+	typedef const T* const_iterator;
+
+	explicit ArenaVector(Arena& arena): m_arena(&arena){}
+
+	inline int size() const { return m_size; }
+	inline int capacity() const { return m_capacity; }
+	inline bool empty() const { return m_size == 0; }
+
+	inline T* data() { return m_data; }
+	inline const T* data() const { return m_data; }
+	inline const T* constData() const { return m_data; }
+
+	inline T& operator[](int i) { Q_ASSERT(i >= 0 && i < m_size); return m_data[i]; }
+	inline const T& operator[](int i) const { Q_ASSERT(i >= 0 && i < m_size); return m_data[i]; }
+
+	inline T& first() { return m_data[0]; }
+	inline const T& first() const { return m_data[0]; }
+	inline T& last() { return m_data[m_size-1]; }
+	inline const T& last() const { return m_data[m_size-1]; }
+
+	inline iterator begin() { return m_data; }
+	inline iterator end() { return m_data + m_size; }
+	inline const_iterator begin() const { return m_data; }
+	inline const_iterator end() const { return m_data + m_size; }
+
+	/// Removes all elements but keeps the memory.
+	inline void clear() { m_size = 0; }
+
+	/// Removes all elements and forgets the memory, so the vector can be reused after its arena was reset.
+	inline void release() { m_data = nullptr; m_size = 0; m_capacity = 0; }
+
+	inline void push_back(const T& value){
+		if(m_size == m_capacity && !reserve(m_capacity? m_capacity*2 : 16)) return;
+		m_data[m_size++] = value;
+	}
+
+	/// New elements are value initialized.
+	void resize(int size){
+		if(size > m_capacity && !reserve(std::max(size, m_capacity*2))) return;
+		for(int i = m_size; i < size; i++)
+			m_data[i] = T();
+		m_size = size;
+	}
+
+	bool reserve(int capacity){
+		if(capacity <= m_capacity) return true;
+		T* data = m_arena->allocate<T>(capacity);
+		if(!data) return false;
+		if(m_size) std::memcpy(data, m_data, m_size*sizeof(T));
+		m_data = data;
+		m_capacity = capacity;
+		return true;
+	}
+
+private:
+	Arena* m_arena;
+	T* m_data = nullptr;
+	int m_size = 0;
+	int m_capacity = 0;
+};
+
+#endif /* LIBRARIES_UTIL_ARENA_H_ */
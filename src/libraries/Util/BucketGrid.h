@@ -30,6 +30,7 @@
 #define LIBRARIES_ATOMS_BUCKETGRID_H_
 
 #include <QVector>
+#include <algorithm>
 
 #include <Util/AABB.h>
 #include <QDebug>
@@ -38,7 +39,24 @@
 template<typename T>
 class BucketGrid {
 public:
-	BucketGrid(const aabb& box, float radius): m_box(box), m_blockSize(radius){
+	/*!
+	 * @brief Creates an empty grid, call reset() before using it.
+	 */
+	BucketGrid(){}
+
+	BucketGrid(const aabb& box, float radius){
+		reset(box, radius);
+	}
+
+	/*!
+	 * @brief Empties the grid and fits it to a new box.
+	 * The cells are stored in one flat array that is only reallocated when the new
+	 * box needs more cells than any box before. Emptied cells keep their memory, so
+	 * reusing one grid for many frames stops allocating once it has seen the densest frame.
+	 */
+	void reset(const aabb& box, float radius){
+		m_box = box;
+		m_blockSize = radius;
 		//aabb must be valid
 		Q_ASSERT(m_box.max != m_box.min);
 		Q_ASSERT(m_box.max.x > m_box.min.x && m_box.max.y > m_box.min.y && m_box.max.z > m_box.min.z);
@@ -47,21 +65,18 @@ public:
 		m_box.min-=0.01f;
 		m_size = glm::uvec3(1,1,1) + glm::uvec3((m_box.max-m_box.min)/m_blockSize );
 
-		//Allocate memory
-		m_data = new QVector<T> **[m_size.x]();
-	    for (int i = 0; i < m_size.x; i++)
-	    {
-	    	m_data[i] = new QVector<T> *[m_size.y]();
-	        for (int j = 0; j < m_size.y; j++)
-	        	m_data[i][j] = new QVector<T> [m_size.z]();
-	    }
-
+		const int cells = m_size.x*m_size.y*m_size.z;
+		if(cells > m_data.size()) m_data.resize(cells);
+		for(int i = 0; i < cells; i++)
+			m_data[i].clear();
 	}
 
 	unsigned int getWidth() const {return m_size.x;}
 	unsigned int getHeight() const {return m_size.y;}
 	unsigned int getLength() const {return m_size.z;}
-	const glm::uvec3& getSize() const {return m_size;}
+	glm::uvec3 getSize() const {return glm::uvec3(m_size);}
+	/// @returns The edge length of a cell.
+	float getCellSize() const {return m_blockSize;}
 
 	const QVector<T>& get(const glm::vec3& pos){
 		Q_ASSERT(pos.x < m_box.max.x || pos.y < m_box.max.y || pos.z < m_box.max.z);
@@ -76,11 +91,11 @@ public:
 	}
 
 	const QVector<T>& get(const glm::uvec3& pos){
-		return m_data[pos.x][pos.y][pos.z];
+		return cell(pos.x, pos.y, pos.z);
 	}
 
 	const QVector<T>& get(unsigned int x, unsigned int y, unsigned int z){
-		return m_data[x][y][z];
+		return cell(x, y, z);
 	}
 
 	void insert(const T& data, const glm::vec3& pos){
@@ -98,11 +113,11 @@ public:
 
 	void insert(const T& data, const glm::uvec3& pos){
 		//qDebug()<<"insert2 "<<data<<" to "<<pos;
-		m_data[pos.x][pos.y][pos.z].push_back(data);
+		cell(pos.x, pos.y, pos.z).push_back(data);
 	}
 
 	void insert(const T& data, unsigned int x, unsigned int y, unsigned int z){
-		m_data[x][y][z].push_back(data);
+		cell(x, y, z).push_back(data);
 	}
 
 	bool getSurroundings(const glm::vec3& pos, QVector<const QVector<T>*>& out, int radius = 1){
@@ -117,8 +132,8 @@ public:
 
 	inline void get(QVector<const QVector<T>*>& out, int x, int y, int z){
 		if(x >= 0 && x < m_size.x && y >= 0 && y < m_size.y && z >= 0 && z < m_size.z){
-			//qDebug()<<__LINE__<<": Buket Get: "<<"("<<x<<", "<<y<<", "<<z<<") = "<<m_data[x][y][z];
-			const QVector<T>& v = m_data[x][y][z];
+			//qDebug()<<__LINE__<<": Buket Get: "<<"("<<x<<", "<<y<<", "<<z<<") = "<<cell(x, y, z);
+			const QVector<T>& v = cell(x, y, z);
 			if(!v.empty())  out.push_back(&v);
 		}
 	}
@@ -157,28 +172,134 @@ public:
 		return true;
 	}
 
-	void clear(){
-		for(int x = 0; x < m_size.x; x++)
-			for(int y = 0; y < m_size.y; y++)
-				for(int z = 0; z < m_size.z; z++)
-					m_data[x][y][z].clear();
-	}
-
-	virtual ~BucketGrid(){
-		for (int i = 0; i < m_size.x; i++)
-		{
-		    for (int j = 0; j < m_size.y; j++)
-		        delete[] m_data[i][j];
-		    delete[] m_data[i];
+	/*!
+	 * @brief Calls the visitor for each element stored in the cells of the shell with the given radius around pos.
+	 * Works like getSurroundings, but walks the cells directly without building
+	 * an intermediate container of cell pointers.
+	 * @param visit Callable with the signature void(const T&).
+	 * @returns false if the shell lies completely outside of the grid.
+	 */
+	template<typename Visitor>
+	bool forEachInShell(const glm::vec3& pos, int radius, Visitor visit){
+		return forEachInShell(toGrid(pos), radius, visit);
+	}
+
+	template<typename Visitor>
+	bool forEachInShell(const glm::uvec3& pos, int radius, Visitor visit){
+		if(radius <= 0){
+			visitCell( visit, pos.x, pos.y, pos.z );
+			return true;
+		}
+		const int xLimits[2] = {(int)pos.x - radius ,(int)pos.x + radius};
+		const int yLimits[2] = {(int)pos.y - radius ,(int)pos.y + radius};
+		const int zLimits[2] = {(int)pos.z - radius ,(int)pos.z + radius};
+		if(xLimits[0] < 0 && xLimits[1] >= m_size.x && yLimits[0] < 0 && yLimits[1] >= m_size.y && zLimits[0] < 0 && zLimits[1] >= m_size.z)
+			return false;
+		//Boundary
+		for(int y = yLimits[0]; y <= yLimits[1]; y++)
+			for(int z = zLimits[0]; z <= zLimits[1]; z++){
+				visitCell( visit, xLimits[0], y, z  );
+				visitCell( visit, xLimits[1], y, z  );
+			}
+
+		//Inbetween
+		for(int x = xLimits[0]+1; x <= xLimits[1]-1; x++){
+			//Boundary
+			for(int z = zLimits[0]; z <= zLimits[1]; z++){
+				visitCell( visit, x, yLimits[0], z  );
+				visitCell( visit, x, yLimits[1], z  );
+			}
+			//Inbetween
+			for(int y = yLimits[0]+1; y <= yLimits[1]-1; y++){
+				visitCell( visit, x, y, zLimits[0]  );
+				visitCell( visit, x, y, zLimits[1]  );
+			}
+		}
+
+		return true;
+	}
+
+	/*!
+	 * @brief A shell element together with its distance to the query position.
+	 */
+	struct Neighbour{
+		T value;
+		float distance;
+		inline bool operator<(const Neighbour& other) const { return distance < other.distance; }
+	};
+
+	/*!
+	 * @brief Gathers the elements of the shell with the given radius around pos, sorted by ascending distance.
+	 * The output vector is only shrunk and never released, so reusing it between
+	 * calls makes the query allocation free once it has grown to the largest shell.
+	 * @param out Output neighbours, sorted by distance. Previous content is discarded.
+	 *        Any vector of Neighbour with resize, push_back, begin and end (QVector, ArenaVector).
+	 * @param distance Callable with the signature float(const T&) returning the distance of the element to pos,
+	 *        or any monotonic function of it like the squared distance. Elements with a negative distance are skipped.
+	 * @returns false if the shell lies completely outside of the grid.
+	 */
+	template<typename Container, typename DistanceFunc>
+	bool getSortedSurroundings(const glm::vec3& pos, Container& out, int radius, DistanceFunc distance){
+		out.resize(0);
+		const bool inside = forEachInShell(pos, radius, [&out, &distance](const T& data){
+			const float d = distance(data);
+			if(d >= 0.f) out.push_back({data, d});
+		});
+		std::sort(out.begin(), out.end());
+		return inside;
+	}
+
+	/// @returns The cell containing the given position.
+	inline glm::uvec3 getCell(const glm::vec3& pos) const{
+		return toGrid(pos);
+	}
+
+	/*!
+	 * @brief The smallest shell radius around the given cell that lies completely outside of the grid.
+	 * forEachInShell returns false for this and every bigger radius. Always at least 1.
+	 */
+	int getEnclosingShell(const glm::uvec3& pos) const{
+		int radius = 1;
+		for(int axis = 0; axis < 3; axis++){
+			radius = std::max(radius, (int)pos[axis] + 1);
+			radius = std::max(radius, m_size[axis] - (int)pos[axis]);
 		}
-		delete[] m_data;
+		return radius;
+	}
+
+	void clear(){
+		const int cells = m_size.x*m_size.y*m_size.z;
+		for(int i = 0; i < cells; i++)
+			m_data[i].clear();
 	}
 
+	virtual ~BucketGrid(){}
+
 private:
-	glm::ivec3 m_size;
+	inline glm::uvec3 toGrid(const glm::vec3& pos) const{
+		return glm::uvec3(
+				((pos.x - m_box.min.x)/m_blockSize),
+				((pos.y - m_box.min.y)/m_blockSize),
+				((pos.z - m_box.min.z)/m_blockSize)
+		);
+	}
+
+	template<typename Visitor>
+	inline void visitCell(Visitor& visit, int x, int y, int z) const{
+		if(x >= 0 && x < m_size.x && y >= 0 && y < m_size.y && z >= 0 && z < m_size.z){
+			const QVector<T>& v = m_data[(x*m_size.y + y)*m_size.z + z];
+			for(const T& data: v) visit(data);
+		}
+	}
+
+	inline QVector<T>& cell(unsigned int x, unsigned int y, unsigned int z){
+		return m_data[(x*m_size.y + y)*m_size.z + z];
+	}
+
+	glm::ivec3 m_size = glm::ivec3(0,0,0);
 	aabb m_box;
-	float m_blockSize;
-	QVector<T> ***m_data = nullptr; //xyz
+	float m_blockSize = 1.f;
+	QVector<QVector<T>> m_data; //xyz, z changes fastest
 
 };
 
@@ -0,0 +1,155 @@
+/**
+ * @file   		NeighbourList.h
+ * @author 		Vladimir Ageev (vladimir.agueev@progsys.de)
+ * @date   		04.05.2017
+ *
+ * @brief  		A bucket grid with Verlet neighbour lists that are reused across frames.
+ *
+ * @copyright{
+ *   AminoAcidVis
+ *   Copyright (C) 2017 Vladimir Ageev
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *   USA
+ *  }
+ */
+
+#ifndef LIBRARIES_UTIL_NEIGHBOURLIST_H_
+#define LIBRARIES_UTIL_NEIGHBOURLIST_H_
+
+#include <Util/BucketGrid.h>
+#include <QVector>
+
+#include <cmath>
+
+/// Default skin distance in Angstroms added to the cutoffs of the neighbour lists.
+#define DEFAULT_NEIGHBOUR_SKIN 1.f
+
+/*!
+ * @brief Spatial lookup of a set of points that change a little from frame to frame, like the atoms of a trajectory.
+ *
+ * The bucket grid is refitted to every frame and can be queried directly. Additionally each
+ * point has a Verlet list: all points closer than its cutoff plus a skin distance at the
+ * time the lists were built. As long as no point moved more than half the skin since then,
+ * every pair that is closer than the cutoff now is contained in the lists, so they are
+ * reused and only rebuilt once a point moved too far.
+ */
+class NeighbourList {
+public:
+	NeighbourList(float cellSize = 2.f, float skin = DEFAULT_NEIGHBOUR_SKIN): m_cellSize(cellSize), m_skin(skin){}
+
+	/*!
+	 * @brief Refits the grid to a new frame and rebuilds the neighbour lists if needed.
+	 * @param positions Positions of all points.
+	 * @param box Bounding box of all inserted points.
+	 * @param inserted The points stored in the grid and the lists in ascending order, the others are ignored.
+	 * @param cutoffs The distance up to which each point needs its neighbours, one per position.
+	 * @returns true if the neighbour lists were rebuilt.
+	 */
+	bool update(const QVector<glm::vec3>& positions, const aabb& box, const QVector<int>& inserted, const QVector<float>& cutoffs){
+		m_grid.reset(box, m_cellSize);
+		m_cells.resize(positions.size());
+		for(int i: inserted){
+			m_cells[i] = m_grid.getCell(positions[i]);
+			m_grid.insert(i, m_cells[i]);
+		}
+
+		if(!needsRebuild(positions, inserted, cutoffs)) return false;
+		rebuild(positions, inserted, cutoffs);
+		return true;
+	}
+
+	/// Forces a rebuild of the neighbour lists on the next update.
+	void invalidate(){
+		m_inserted.clear();
+	}
+
+	/// The grid of the current frame.
+	BucketGrid<int>& getGrid() { return m_grid; }
+
+	/// @returns The grid cell of the given point in the current frame.
+	inline const glm::uvec3& getCell(int i) const { return m_cells[i]; }
+
+	/// @returns All points that may be closer than the cutoff of point i, in no particular order.
+	inline const int* begin(int i) const { return m_neighbours.constData() + m_start[i]; }
+	inline const int* end(int i) const { return m_neighbours.constData() + m_start[i+1]; }
+
+	/// Calls the visitor with the index of each point of the current frame closer than radius to pos. The position must lie inside the grid.
+	template<typename Visitor>
+	void forEachInRadius(const QVector<glm::vec3>& positions, const glm::vec3& pos, float radius, Visitor visit){
+		const float radius2 = radius*radius;
+		const glm::uvec3 cell = m_grid.getCell(pos);
+		const int maxShell = (int)std::ceil(radius/m_cellSize);
+		for(int shell = 0; shell <= maxShell; shell++){
+			if(!m_grid.forEachInShell(cell, shell, [&](int index){
+				const glm::vec3 d(positions[index]-pos);
+				if(glm::dot(d, d) < radius2) visit(index);
+			})) break;
+		}
+	}
+
+	float getSkin() const { return m_skin; }
+	void setSkin(float skin){
+		m_skin = skin;
+		invalidate();
+	}
+
+	/// @returns How often the neighbour lists were built.
+	int numberOfRebuilds() const { return m_rebuilds; }
+
+private:
+	bool needsRebuild(const QVector<glm::vec3>& positions, const QVector<int>& inserted, const QVector<float>& cutoffs) const{
+		if(inserted != m_inserted || cutoffs != m_cutoffs) return true;
+		const float maxMove2 = (m_skin*0.5f)*(m_skin*0.5f);
+		for(int i: inserted){
+			const glm::vec3 d(positions[i]-m_builtPositions[i]);
+			if(glm::dot(d, d) > maxMove2) return true;
+		}
+		return false;
+	}
+
+	void rebuild(const QVector<glm::vec3>& positions, const QVector<int>& inserted, const QVector<float>& cutoffs){
+		m_inserted = inserted;
+		m_cutoffs = cutoffs;
+		m_builtPositions = positions;
+		m_neighbours.resize(0);
+		m_start.fill(0, positions.size()+1);
+		for(int p = 0; p < inserted.size(); p++){
+			const int i = inserted[p];
+			m_start[i] = m_neighbours.size();
+			forEachInRadius(positions, positions[i], cutoffs[i] + m_skin, [&](int index){
+				if(index != i) m_neighbours.push_back(index);
+			});
+			//points that aren't inserted have an empty list
+			const int next = (p+1 < inserted.size()) ? inserted[p+1] : positions.size();
+			for(int k = i+1; k <= next; k++) m_start[k] = m_neighbours.size();
+		}
+		m_rebuilds++;
+	}
+
+	float m_cellSize;
+	float m_skin;
+	BucketGrid<int> m_grid;
+	QVector<glm::uvec3> m_cells; /// Cell of each point in the current frame
+
+	QVector<int> m_inserted; /// Inserted points when the lists were built
+	QVector<float> m_cutoffs; /// Cutoffs when the lists were built
+	QVector<glm::vec3> m_builtPositions; /// Positions when the lists were built
+	QVector<int> m_neighbours; /// Neighbours of all points, one continuous range per point
+	QVector<int> m_start; /// Start of the range of each point, plus the end of the last range
+	int m_rebuilds = 0;
+};
+
+#endif /* LIBRARIES_UTIL_NEIGHBOURLIST_H_ */
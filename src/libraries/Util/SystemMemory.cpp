@@ -0,0 +1,51 @@
+/*
+ * SystemMemory.cpp
+ *
+ *  Created on: 04.05.2017
+ *      Author: Vladimir Ageev (vladimir.agueev@progsys.de)
+ */
+
+#include <Util/SystemMemory.h>
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+size_t availablePhysicalMemory(){
+#ifdef _WIN32
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	if(GlobalMemoryStatusEx(&status)) return (size_t) status.ullAvailPhys;
+	return 0;
+#elif defined(__linux__)
+	//MemAvailable includes the page cache that can be dropped, the free pages alone are too pessimistic
+	if(FILE* file = fopen("/proc/meminfo", "r")){
+		char line[256];
+		unsigned long long kilobytes = 0;
+		while(fgets(line, sizeof(line), file))
+			if(sscanf(line, "MemAvailable: %llu kB", &kilobytes) == 1) break;
+		fclose(file);
+		if(kilobytes) return (size_t) kilobytes * 1024u;
+	}
+	const long pages = sysconf(_SC_AVPHYS_PAGES);
+	const long pageSize = sysconf(_SC_PAGESIZE);
+	return (pages > 0 && pageSize > 0) ? (size_t) pages * (size_t) pageSize : 0;
+#else
+	return 0;
+#endif
+}
+
+QString formatBytes(size_t bytes){
+	static const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+	double value = bytes;
+	int unit = 0;
+	while(value >= 1024.0 && unit < 4){
+		value /= 1024.0;
+		unit++;
+	}
+	return QString::number(value, 'f', (unit) ? 1 : 0) + " " + units[unit];
+}
@@ -0,0 +1,20 @@
+/*
+ * SystemMemory.h
+ *
+ *  Created on: 04.05.2017
+ *      Author: Vladimir Ageev (vladimir.agueev@progsys.de)
+ */
+
+#ifndef LIBRARIES_UTIL_SYSTEMMEMORY_H_
+#define LIBRARIES_UTIL_SYSTEMMEMORY_H_
+
+#include <QString>
+#include <cstddef>
+
+/// @returns The physical memory in bytes that can still be allocated without swapping, or 0 if it can't be determined.
+size_t availablePhysicalMemory();
+
+/// @returns The given number of bytes as a short human readable string, e.g. "1.5 GB".
+QString formatBytes(size_t bytes);
+
+#endif /* LIBRARIES_UTIL_SYSTEMMEMORY_H_ */